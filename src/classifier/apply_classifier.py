@@ -10,12 +10,15 @@
 # All other columns are copied over to the final CSV.
 
 import argparse
+import sqlite3
 from pathlib import Path
 
 import pandas as pd
 import stanza
 import simpletransformers.classification as cl
 
+from reddit_ids import decode_frame, unpack_id
+
 # Command line args
 ap = argparse.ArgumentParser()
 ap.add_argument("--input", default="sample_data.csv", help="input CSV (filename only)")
@@ -29,6 +32,11 @@ ap.add_argument(
     default="id",
     help="name of the column that uniquely identifies each text row",
 )
+ap.add_argument(
+    "--trigram-db",
+    default=None,
+    help="database from the processing module with a trigrams table (skips sentence splitting)",
+)
 args = ap.parse_args()
 
 UNFINISHED_DIR = Path("./csvs/unfinished")
@@ -54,85 +62,101 @@ if args.text_col not in df.columns:
 if id_col not in df.columns:
     raise ValueError(f"ID column '{id_col}' not found in input CSV.")
 
-# Stanza pipeline for sentence splitting
-p = stanza.Pipeline(lang="en", processors="tokenize")
-
-# Split texts into sentences using list buffers
-buf_docid = []   # original document ID from df[id_col]
-buf_sent_id = [] # sentence index within document
-buf_text = []    # sentence text
-
-texts = df[args.text_col].fillna("").tolist()
-doc_ids = df[id_col].tolist()
-
-for doc_id, text in zip(doc_ids, texts):
-    doc = p(text)
-    for sent_id, sentence in enumerate(doc.sentences, start=1):
-        buf_docid.append(doc_id)
-        buf_sent_id.append(sent_id)
-        buf_text.append(sentence.text)
-
-sentences_final = pd.DataFrame(
-    {
-        id_col: buf_docid,   # same column name as in the original CSV
-        "sent_id": buf_sent_id,
-        "text": buf_text,
-    }
-)
-
-####################################################################
-##################### 2) Converting to trigram #####################
-####################################################################
+# csvs exported straight from the database have packed integer ids, db_to_csv.py already decodes them
+decode_frame(df)
+
+if args.trigram_db is not None:
+    # trigrams were already split by the processing module (Wrapper::trigrams), so skip stanza
+    conn = sqlite3.connect(args.trigram_db)
+    final = pd.read_sql_query("SELECT id, trigram_id, sent_trigram FROM trigrams ORDER BY id, trigram_id", conn)
+    conn.close()
+
+    # matched with the prefix, a comment and a submission can have the same base36 id
+    final["id"] = final["id"].map(unpack_id)
+    final = final.rename(columns={"id": id_col})
+    final = final[final[id_col].isin(df[id_col])].reset_index(drop=True)
+    if final.empty and len(df):
+        raise ValueError(f"No trigrams for the ids in '{id_col}', they need their t1_/t3_ prefix (export the csv with db_to_csv.py again).")
+else:
+    # Stanza pipeline for sentence splitting
+    p = stanza.Pipeline(lang="en", processors="tokenize")
+
+    # Split texts into sentences using list buffers
+    buf_docid = []   # original document ID from df[id_col]
+    buf_sent_id = [] # sentence index within document
+    buf_text = []    # sentence text
+
+    texts = df[args.text_col].fillna("").tolist()
+    doc_ids = df[id_col].tolist()
+
+    for doc_id, text in zip(doc_ids, texts):
+        doc = p(text)
+        for sent_id, sentence in enumerate(doc.sentences, start=1):
+            buf_docid.append(doc_id)
+            buf_sent_id.append(sent_id)
+            buf_text.append(sentence.text)
+
+    sentences_final = pd.DataFrame(
+        {
+            id_col: buf_docid,   # same column name as in the original CSV
+            "sent_id": buf_sent_id,
+            "text": buf_text,
+        }
+    )
 
-# Helper function for creating sentence trigrams.
-# Sentence trigram is the main input for the authdetect model.
-def create_ngram(text_list):
-    no_steps = len(text_list) - 2
-    indexes = [list(range(x, x + 3)) for x in range(no_steps)]
-    ngrams = [" ".join(text_list[i] for i in idx) for idx in indexes]
-    return ngrams
-
-
-# Wrangle extracted sentences into sentence trigrams using buffers
-u_docs = sentences_final[id_col].unique()
-
-cp = sentences_final[id_col].to_numpy()
-tt = sentences_final["text"].to_numpy()
-jj = len(cp)
-
-buf_tri = []
-buf_tri_docid = []
-buf_tri_id = []
-
-count_docs = len(u_docs)
-j = 0
-
-for n in range(count_docs):
-    doc_id = u_docs[n]
-
-    # collect all sentences for this document
-    text_list = []
-    while j < jj and cp[j] == doc_id:
-        text_list.append(tt[j])
-        j += 1
-
-    if len(text_list) < 3:
-        sentence_trigram = [" ".join(text_list)]
-    else:
-        sentence_trigram = create_ngram(text_list)
-
-    for trig_id, trig in enumerate(sentence_trigram, start=1):
-        buf_tri.append(trig)
-        buf_tri_id.append(trig_id)
-        buf_tri_docid.append(doc_id)
-
-final = pd.DataFrame(
-    {
-        id_col: buf_tri_docid,      # original ID column
-        "trigram_id": buf_tri_id,   # index within document
-        "sent_trigram": buf_tri,
-    }
-)
+    ####################################################################
+    ##################### 2) Converting to trigram #####################
+    ####################################################################
+
+    # Helper function for creating sentence trigrams.
+    # Sentence trigram is the main input for the authdetect model.
+    def create_ngram(text_list):
+        no_steps = len(text_list) - 2
+        indexes = [list(range(x, x + 3)) for x in range(no_steps)]
+        ngrams = [" ".join(text_list[i] for i in idx) for idx in indexes]
+        return ngrams
+
+
+    # Wrangle extracted sentences into sentence trigrams using buffers
+    u_docs = sentences_final[id_col].unique()
+
+    cp = sentences_final[id_col].to_numpy()
+    tt = sentences_final["text"].to_numpy()
+    jj = len(cp)
+
+    buf_tri = []
+    buf_tri_docid = []
+    buf_tri_id = []
+
+    count_docs = len(u_docs)
+    j = 0
+
+    for n in range(count_docs):
+        doc_id = u_docs[n]
+
+        # collect all sentences for this document
+        text_list = []
+        while j < jj and cp[j] == doc_id:
+            text_list.append(tt[j])
+            j += 1
+
+        if len(text_list) < 3:
+            sentence_trigram = [" ".join(text_list)]
+        else:
+            sentence_trigram = create_ngram(text_list)
+
+        for trig_id, trig in enumerate(sentence_trigram, start=1):
+            buf_tri.append(trig)
+            buf_tri_id.append(trig_id)
+            buf_tri_docid.append(doc_id)
+
+    final = pd.DataFrame(
+        {
+            id_col: buf_tri_docid,      # original ID column
+            "trigram_id": buf_tri_id,   # index within document
+            "sent_trigram": buf_tri,
+        }
+    )
 
 ####################################################################
 ####### 3) Applying authdetect model and outputting results ########
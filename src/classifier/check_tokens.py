@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+
+# Checks token shards written by the processing module (Wrapper::tokenize, see processing/include/bpe.hpp)
+# against the huggingface tokenizer of the model on a random sample of trigrams, since the C++ tokenizer
+# is a rewrite and the classifier would silently get worse if the two ever disagree.
+#
+#   python check_tokens.py --shards tokens/month --db month.db --model path/to/authdetect
+#
+# --model is the same local copy of the model vocab.json and merges.txt were given to tokenize() from.
+
+import argparse
+import glob
+import random
+import sqlite3
+import struct
+import sys
+
+from transformers import AutoTokenizer
+
+from reddit_ids import pack_id
+
+HEADER = struct.Struct("<8sIIQQQQQ")  # TokenShardHeader
+KEY = struct.Struct("<16sII")         # TokenShardKey
+
+ap = argparse.ArgumentParser()
+ap.add_argument("--shards", required=True, help="prefix the shards were written to ({prefix}_00000.tok, ...)")
+ap.add_argument("--db", required=True, help="database with the trigrams table the shards were made from")
+ap.add_argument("--model", required=True, help="model directory (or huggingface name) to load the tokenizer from")
+ap.add_argument("--sample", type=int, default=1000, help="number of rows to check")
+ap.add_argument("--seed", type=int, default=0)
+args = ap.parse_args()
+
+tok = AutoTokenizer.from_pretrained(args.model)
+conn = sqlite3.connect(args.db)
+rng = random.Random(args.seed)
+
+shards = []
+for fn in sorted(glob.glob(f"{glob.escape(args.shards)}_[0-9][0-9][0-9][0-9][0-9].tok")):
+    with open(fn, "rb") as f:
+        data = f.read()
+    magic, version, width, rows, ids, mask, lengths, keys = HEADER.unpack_from(data)
+    if magic != b"CMSCTOK1":
+        sys.exit(f"{fn} is not a token shard")
+    shards.append((fn, data, width, rows, ids, lengths, keys))
+
+total = sum(s[3] for s in shards)
+if total == 0:
+    sys.exit(f"no rows in shards {args.shards}_*.tok")
+
+checked = bad = 0
+for n in sorted(rng.sample(range(total), min(args.sample, total))):
+    for fn, data, width, rows, ids, lengths, keys in shards:
+        if n < rows:
+            break
+        n -= rows
+
+    key, trigram_id, _ = KEY.unpack_from(data, keys + n * KEY.size)
+    reddit_id = key.rstrip(b"\0").decode()
+    row = conn.execute(
+        "SELECT sent_trigram FROM trigrams WHERE id = ? AND trigram_id = ?", (pack_id(reddit_id), trigram_id)
+    ).fetchone()
+    if row is None:
+        print(f"{fn} row {n}: {reddit_id} trigram {trigram_id} is not in {args.db}")
+        bad += 1
+        continue
+
+    full = tok(row[0])["input_ids"]
+    want = tok(row[0], truncation=True, max_length=width)["input_ids"]
+    want += [tok.pad_token_id] * (width - len(want))
+    got = list(struct.unpack_from(f"<{width}i", data, ids + n * width * 4))
+    (length,) = struct.unpack_from("<I", data, lengths + n * 4)
+
+    checked += 1
+    if got != want or length != len(full):
+        bad += 1
+        at = next((i for i, (a, b) in enumerate(zip(got, want)) if a != b), min(len(got), len(want)))
+        print(f"{fn} row {n} ({reddit_id} trigram {trigram_id}): differs at token {at}, length {length} vs {len(full)}")
+        print(f"  text: {row[0]!r}")
+        print(f"  shard: {got[max(0, at - 3):at + 5]}")
+        print(f"  model: {want[max(0, at - 3):at + 5]}")
+
+conn.close()
+print(f"{checked} rows checked, {bad} differ")
+sys.exit(1 if bad else 0)
@@ -2,6 +2,8 @@ import sqlite3
 import csv
 from pathlib import Path
 
+from reddit_ids import decode_row
+
 # convert .db to .csv since classifier script accepts .csv files
 
 DB_DIR = Path("../../data")
@@ -23,8 +25,9 @@ for db_path in DB_DIR.glob("*.db"):
 
     for table in tables:
         cur.execute(f"SELECT * FROM {table}")
-        rows = cur.fetchall()
         col_names = [desc[0] for desc in cur.description]
+        # ids are packed integers in the database
+        rows = [decode_row(col_names, row) for row in cur.fetchall()]
 
         csv_filename = f"{db_stem}_{table}.csv"
         csv_path = OUT_DIR / csv_filename
@@ -0,0 +1,59 @@
+# ids written by the processing module are packed integers (see packId in processing/src/include/common.hpp):
+# the base36 id shifted left by 3, with the digit of its t1_/t3_ prefix in the low 3 bits (0 if it had none)
+
+import math
+import numbers
+
+ID_TYPE_BITS = 3
+DIGITS = "0123456789abcdefghijklmnopqrstuvwxyz"
+
+
+def unpack_id(packed, prefix=True):
+    """Packed id -> reddit id ("t1_abc123", or "abc123" with prefix=False).
+
+    Anything that is not a packed id (strings, None, NaN) is returned as is.
+    """
+    if isinstance(packed, bool) or not isinstance(packed, numbers.Real):
+        return packed
+    if isinstance(packed, float):
+        if math.isnan(packed):
+            return packed
+        packed = int(packed)
+
+    packed = int(packed)
+    kind = packed & ((1 << ID_TYPE_BITS) - 1)
+    v = packed >> ID_TYPE_BITS
+
+    out = ""
+    while True:
+        v, d = divmod(v, 36)
+        out = DIGITS[d] + out
+        if v == 0:
+            break
+
+    return f"t{kind}_{out}" if prefix and kind else out
+
+
+def pack_id(reddit_id, kind=0):
+    """Reddit id ("t1_abc123", or "abc123" with its type as kind) -> packed id, the inverse of unpack_id."""
+    if len(reddit_id) > 3 and reddit_id[0] == "t" and reddit_id[2] == "_":
+        kind = int(reddit_id[1])
+        reddit_id = reddit_id[3:]
+    return int(reddit_id, 36) << ID_TYPE_BITS | kind
+
+
+# all of them keep their t1_/t3_ prefix, a comment and a submission can have the same base36 id
+ID_COLUMNS = {"id": True, "parent_id": True, "link_id": True}
+
+
+def decode_row(names, row):
+    """Decode the packed id columns of one sqlite row (a tuple), by column name."""
+    return tuple(unpack_id(v, ID_COLUMNS[n]) if n in ID_COLUMNS else v for n, v in zip(names, row))
+
+
+def decode_frame(df):
+    """Decode the packed id columns of a dataframe in place (columns that are already text are left alone)."""
+    for col, prefix in ID_COLUMNS.items():
+        if col in df.columns and df[col].dtype.kind in "iuf":
+            df[col] = df[col].map(lambda v: unpack_id(v, prefix))
+    return df
@@ -0,0 +1,58 @@
+#ifndef CMSC_BLOOM_HPP
+#define CMSC_BLOOM_HPP
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+// bloom filter over 64 bit keys (i.e. packed ids, see packId), for throwing away most of a dump before looking at a hash set
+// blocked: all k bits of a key are in the same 64 byte block, so a lookup touches one cache line
+class BloomFilter {
+private:
+    std::vector<uint64_t> bits;
+    uint64_t blocks;
+    int k;
+
+    // splitmix64 finalizer, ids are sequential so they need mixing
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+public:
+    // sized for n keys at a false positive rate of about fp
+    BloomFilter(size_t n, double fp = 0.01) {
+        double m = std::max(512.0, -(double) std::max(n, (size_t) 1) * std::log(fp) / (std::log(2.0) * std::log(2.0)));
+        blocks = (uint64_t) std::ceil(m / 512);
+        bits.assign(blocks * 8, 0);
+        k = std::clamp((int) std::round(m / std::max(n, (size_t) 1) * std::log(2.0)), 1, 16);
+    }
+
+    void insert(uint64_t key) {
+        uint64_t h = mix(key);
+        uint64_t* b = &bits[(h % blocks) * 8];
+        uint32_t h1 = (uint32_t) (h >> 32), h2 = (uint32_t) h | 1;
+        for (int i = 0; i < k; i++) {
+            uint32_t bit = (h1 + i * h2) & 511;
+            b[bit >> 6] |= 1ull << (bit & 63);
+        }
+    }
+
+    bool contains(uint64_t key) const {
+        uint64_t h = mix(key);
+        const uint64_t* b = &bits[(h % blocks) * 8];
+        uint32_t h1 = (uint32_t) (h >> 32), h2 = (uint32_t) h | 1;
+        for (int i = 0; i < k; i++) {
+            uint32_t bit = (h1 + i * h2) & 511;
+            if (!(b[bit >> 6] & (1ull << (bit & 63)))) return false;
+        }
+        return true;
+    }
+
+    size_t bytes() const { return bits.size() * sizeof(uint64_t); }
+};
+
+#endif
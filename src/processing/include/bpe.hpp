@@ -0,0 +1,331 @@
+#ifndef CMSC_BPE_HPP
+#define CMSC_BPE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <format>
+#include <thread>
+#include <algorithm>
+
+#include <glaze/glaze.hpp>
+
+#include "timing.hpp"
+
+// byte level bpe (gpt2/roberta), loads vocab.json and merges.txt from a local copy of the model
+// https://github.com/openai/gpt-2/blob/master/src/encoder.py
+// this only needs to handle ascii (anything else is removed by sanitize), non ascii bytes are treated as punctuation
+// classifier/check_tokens.py compares the shards written with this against the model's own (huggingface) tokenizer
+class BPETokenizer {
+private:
+    struct _Merge {
+        int rank;
+        int id;
+    };
+
+    std::unordered_map<std::string, int> vocab;
+    std::unordered_map<uint64_t, _Merge> merges;
+    int byteIds[256];
+
+    static uint64_t key(int a, int b) { return ((uint64_t) (uint32_t) a << 32) | (uint32_t) b; }
+
+    // gpt2 maps every byte to a printable unicode char so that the vocab doesnt contain whitespace/control chars
+    static std::string byteChar(unsigned char b) {
+        int cp = b;
+        if (!((b >= 33 && b <= 126) || (b >= 161 && b <= 172) || b >= 174)) {
+            int n = 0;
+            for (int i = 0; i < b; i++) if (!((i >= 33 && i <= 126) || (i >= 161 && i <= 172) || i >= 174)) n++;
+            cp = 256 + n;
+        }
+
+        std::string s;
+        if (cp < 0x80) s += (char) cp;
+        else {
+            s += (char) (0xc0 | (cp >> 6));
+            s += (char) (0x80 | (cp & 0x3f));
+        }
+        return s;
+    }
+
+    int lookup(const std::string& tok) const {
+        auto it = vocab.find(tok);
+        return it == vocab.end() ? unk : it->second;
+    }
+
+    static bool space(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+    static bool letter(unsigned char c) { return std::isalpha(c); }
+    static bool digit(unsigned char c) { return std::isdigit(c); }
+    static bool other(unsigned char c) { return !space(c) && !letter(c) && !digit(c); }
+public:
+    int bos = 0, pad = 1, eos = 2, unk = 3;
+
+    BPETokenizer(const std::string& vocabFile, const std::string& mergesFile) {
+        std::string buf;
+        auto err = glz::read_file_json(vocab, vocabFile, buf);
+        if (err) throw std::runtime_error(std::format("(bpe.hpp) Unable to read vocab {}! Glaze error code: {}", vocabFile, (uint32_t) err.ec));
+
+        if (vocab.count("<s>")) bos = vocab["<s>"];
+        if (vocab.count("<pad>")) pad = vocab["<pad>"];
+        if (vocab.count("</s>")) eos = vocab["</s>"];
+        if (vocab.count("<unk>")) unk = vocab["<unk>"];
+        // after unk, bytes missing from the vocab are unk
+        for (int b = 0; b < 256; b++) byteIds[b] = lookup(byteChar(b));
+
+        std::ifstream f(mergesFile);
+        if (!f) throw std::runtime_error("(bpe.hpp) Unable to open merges " + mergesFile);
+
+        std::string line;
+        int rank = 0;
+        while (std::getline(f, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line.starts_with("#version")) continue;
+
+            size_t sp = line.find(' ');
+            if (sp == std::string::npos) continue;
+
+            auto a = vocab.find(line.substr(0, sp));
+            auto b = vocab.find(line.substr(sp + 1));
+            auto m = vocab.find(line.substr(0, sp) + line.substr(sp + 1));
+            if (a != vocab.end() && b != vocab.end() && m != vocab.end()) merges.emplace(key(a->second, b->second), _Merge{rank, m->second});
+            rank++;
+        }
+    }
+
+    // 's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+    // written out by hand since we only need ascii
+    template <typename F>
+    static void pretokenize(std::string_view s, F&& emit) {
+        size_t n = s.size(), i = 0;
+        while (i < n) {
+            size_t j = i;
+            unsigned char c = s[i];
+
+            if (c == '\'' && i + 1 < n) {
+                std::string_view r = s.substr(i + 1, 2);
+                if (r.starts_with("re") || r.starts_with("ve") || r.starts_with("ll")) j = i + 3;
+                else if (r[0] == 's' || r[0] == 't' || r[0] == 'm' || r[0] == 'd') j = i + 2;
+            }
+
+            if (j == i) {
+                size_t k = (c == ' ' && i + 1 < n) ? i + 1 : i;
+                unsigned char d = s[k];
+                if (letter(d)) { j = k; while (j < n && letter(s[j])) j++; }
+                else if (digit(d)) { j = k; while (j < n && digit(s[j])) j++; }
+                else if (other(d)) { j = k; while (j < n && other(s[j])) j++; }
+                else {
+                    // whitespace, leave the last one to be the prefix of the next word
+                    while (j < n && space(s[j])) j++;
+                    if (j < n && j - i > 1) j--;
+                }
+            }
+
+            emit(s.substr(i, j - i));
+            i = j;
+        }
+    }
+
+    // appends ids of a pretokenized word, lowest rank pair is merged first (all occurrences, left to right)
+    void bpe(std::string_view word, std::vector<int>& out) const {
+        std::vector<int> w;
+        w.reserve(word.size());
+        for (unsigned char c : word) w.push_back(byteIds[c]);
+
+        while (w.size() > 1) {
+            const _Merge* best = nullptr;
+            int a = 0, b = 0;
+            for (size_t i = 0; i + 1 < w.size(); i++) {
+                auto it = merges.find(key(w[i], w[i + 1]));
+                if (it != merges.end() && (!best || it->second.rank < best->rank)) {
+                    best = &it->second;
+                    a = w[i];
+                    b = w[i + 1];
+                }
+            }
+            if (!best) break;
+
+            size_t o = 0;
+            for (size_t i = 0; i < w.size(); i++) {
+                if (i + 1 < w.size() && w[i] == a && w[i + 1] == b) {
+                    w[o++] = best->id;
+                    i++;
+                } else w[o++] = w[i];
+            }
+            w.resize(o);
+        }
+
+        out.insert(out.end(), w.begin(), w.end());
+    }
+
+    // words repeat a lot, so each thread should keep one of these around
+    using Cache = std::unordered_map<std::string, std::vector<int>>;
+
+    // <s> ... </s>, not truncated
+    void encode(std::string_view text, std::vector<int>& out, Cache* cache = nullptr) const {
+        out.clear();
+        out.push_back(bos);
+        pretokenize(text, [&](std::string_view word) {
+            if (!cache) return bpe(word, out);
+
+            if (cache->size() > ((size_t) 1 << 18)) cache->clear();
+            auto it = cache->find(std::string(word));
+            if (it == cache->end()) {
+                std::vector<int> ids;
+                bpe(word, ids);
+                it = cache->emplace(word, std::move(ids)).first;
+            }
+            out.insert(out.end(), it->second.begin(), it->second.end());
+        });
+        out.push_back(eos);
+    }
+
+    size_t size() const { return vocab.size(); }
+};
+
+// shard layout, every section is 64 byte aligned so a reader can mmap the file and use the sections as arrays directly
+// header | ids int32[rows][width] | mask uint8[rows][width] | lengths uint32[rows] | keys TokenShardKey[rows]
+// lengths are before truncation (including <s> and </s>), so any length > width was truncated
+struct TokenShardHeader {
+    char magic[8] = {'C', 'M', 'S', 'C', 'T', 'O', 'K', '1'};
+    uint32_t version = 1;
+    uint32_t width = 0;
+    uint64_t rows = 0;
+    uint64_t ids = 0;
+    uint64_t mask = 0;
+    uint64_t lengths = 0;
+    uint64_t keys = 0;
+};
+
+// which trigram a row belongs to, id is null padded (t1_ or t3_ prefixed reddit ids are ~10 chars)
+struct TokenShardKey {
+    char id[16];
+    uint32_t trigram_id;
+    uint32_t _pad = 0;
+};
+
+struct TokenShard_Output {
+    size_t rows = 0;
+    size_t truncated = 0;
+    size_t tokens = 0;
+    int shards = 0;
+};
+
+class TokenShardWriter {
+private:
+    const BPETokenizer& tok;
+    std::string prefix;
+    uint32_t width;
+    size_t rowsPerShard;
+    int threads;
+
+    std::vector<std::string> texts;
+    std::vector<TokenShardKey> keys;
+    std::vector<BPETokenizer::Cache> caches;
+
+    TokenShard_Output stats{};
+
+    static uint64_t align(uint64_t n) { return (n + 63) & ~(uint64_t) 63; }
+
+    void write() {
+        if (texts.empty()) return;
+#ifdef BENCHMARK_ENABLED
+        auto t_tok = Benchmark::timestamp();
+#endif
+        size_t rows = texts.size();
+        std::vector<int32_t> ids(rows * width, tok.pad);
+        std::vector<uint8_t> mask(rows * width, 0);
+        std::vector<uint32_t> lengths(rows);
+
+        auto work = [&](int t, size_t start, size_t end) {
+            std::vector<int> out;
+            for (size_t r = start; r < end; r++) {
+                tok.encode(texts[r], out, &caches[t]);
+                lengths[r] = out.size();
+
+                // same as huggingface truncation, keep the start and end with </s>
+                if (out.size() > width) {
+                    out.resize(width);
+                    out.back() = tok.eos;
+                }
+                std::copy(out.begin(), out.end(), ids.begin() + r * width);
+                std::fill_n(mask.begin() + r * width, out.size(), 1);
+            }
+        };
+
+        int n = std::min((size_t) threads, rows);
+        size_t per = (rows + n - 1) / n;
+        std::vector<std::jthread> workers;
+        for (int t = 1; t < n; t++) workers.emplace_back(work, t, t * per, std::min(rows, (t + 1) * per));
+        work(0, 0, std::min(rows, per));
+        workers.clear();
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Tokenize", t_tok);
+#endif
+
+        TokenShardHeader h;
+        h.width = width;
+        h.rows = rows;
+        h.ids = align(sizeof(TokenShardHeader));
+        h.mask = align(h.ids + ids.size() * sizeof(int32_t));
+        h.lengths = align(h.mask + mask.size());
+        h.keys = align(h.lengths + lengths.size() * sizeof(uint32_t));
+
+        std::string file = std::format("{}_{:05}.tok", prefix, stats.shards);
+        std::ofstream f(file, std::ios::binary);
+        if (!f) throw std::runtime_error("(bpe.hpp) Unable to open shard " + file);
+
+        auto section = [&](uint64_t offset, const void* data, size_t size) {
+            std::string pad(offset - (uint64_t) f.tellp(), '\0');
+            f.write(pad.data(), pad.size());
+            f.write((const char*) data, size);
+        };
+        f.write((const char*) &h, sizeof(h));
+        section(h.ids, ids.data(), ids.size() * sizeof(int32_t));
+        section(h.mask, mask.data(), mask.size());
+        section(h.lengths, lengths.data(), lengths.size() * sizeof(uint32_t));
+        section(h.keys, keys.data(), keys.size() * sizeof(TokenShardKey));
+
+        for (uint32_t l : lengths) {
+            stats.tokens += l;
+            if (l > width) stats.truncated++;
+        }
+        stats.rows += rows;
+        stats.shards++;
+
+        texts.clear();
+        keys.clear();
+    }
+public:
+    // shards are written to {prefix}_00000.tok, {prefix}_00001.tok, ...
+    TokenShardWriter(const BPETokenizer& tok, const std::string& prefix, uint32_t width = 512, size_t rowsPerShard = (size_t) 1 << 16, int threads = 0)
+        : tok(tok), prefix(prefix), width(width), rowsPerShard(rowsPerShard), threads(threads) {
+        if (this->threads <= 0) this->threads = std::max(1u, std::thread::hardware_concurrency());
+        caches.resize(this->threads);
+    }
+
+    // the last shard is only written here if flush() was not called, call it to see errors
+    ~TokenShardWriter() {
+        try { flush(); } catch (...) {}
+    }
+
+    void push(std::string_view id, uint32_t trigram_id, std::string_view text) {
+        TokenShardKey& k = keys.emplace_back();
+        memset(k.id, 0, sizeof(k.id));
+        memcpy(k.id, id.data(), std::min(id.size(), sizeof(k.id)));
+        k.trigram_id = trigram_id;
+        texts.emplace_back(text);
+
+        if (texts.size() == rowsPerShard) write();
+    }
+
+    void flush() { write(); }
+
+    const TokenShard_Output& status() const { return stats; }
+};
+
+#endif
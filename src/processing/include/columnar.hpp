@@ -0,0 +1,816 @@
+#ifndef CMSC_COLUMNAR_HPP
+#define CMSC_COLUMNAR_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <charconv>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <format>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <zstd.h>
+
+#include "types.hpp"
+#include "sink.hpp"
+#include "timing.hpp"
+
+// columnar file for re-running filters/aggregates over ingested data without going back to the dumps (or sqlite)
+// rows are cut into blocks, every column of a block is one chunk with its own encoding:
+//   int/bool  frame of reference bit packed, or delta (zigzag) bit packed if that is smaller (i.e. created_utc)
+//   text      dictionary codes (bit packed like ints) if the column repeats a lot (subreddit), otherwise a zstd frame (body, id)
+//   real      raw doubles
+// every chunk has a zone map (min/max, dictionary codes for dictionary chunks) and chunks with few distinct values
+// (distinguished, most lexicon columns) also have a bitmap per value, so filters on those never decode anything
+//
+// layout (little endian)
+// "CMSCCOL1" | chunks ... | footer | footer offset uint64 | "CMSCCOL1"
+// footer: table, columns (name, type), dictionaries, blocks (rows, per column chunk offset/size/encoding/nulls/min/max/index)
+// a chunk is [null bitmap uint64[(rows + 63) / 64] if it has nulls] data [bitmap index]
+enum ColumnEncoding : uint8_t { CE_PACK, CE_DELTA, CE_DICT, CE_ZSTD, CE_REAL };
+
+struct Columnar_Output {
+    size_t blocks = 0;
+    // skipped by zone maps without looking at any chunk
+    size_t blocksSkipped = 0;
+    // filters answered by a bitmap index (no decoding)
+    size_t indexed = 0;
+    // rows of blocks that were not skipped
+    size_t rows = 0;
+    size_t matched = 0;
+};
+
+namespace columnar {
+    inline constexpr char magic[8] = {'C', 'M', 'S', 'C', 'C', 'O', 'L', '1'};
+    // chunks with at most this many distinct values get a bitmap index
+    inline constexpr size_t indexMax = 16;
+
+    struct Chunk {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        ColumnEncoding enc = CE_PACK;
+        uint32_t nulls = 0;
+        // doubles are stored as their bits for CE_REAL
+        int64_t min = 0;
+        int64_t max = 0;
+        // relative to offset, 0 if there is no index
+        uint64_t index = 0;
+    };
+
+    inline size_t words(size_t rows) { return (rows + 63) / 64; }
+
+    template <typename V>
+    void put(std::string& out, V v) { out.append((const char*) &v, sizeof(V)); }
+    inline void putStr(std::string& out, std::string_view s) {
+        put<uint32_t>(out, s.size());
+        out += s;
+    }
+
+    inline uint64_t zigzag(int64_t v) { return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63); }
+    inline int64_t unzigzag(uint64_t v) { return (int64_t) (v >> 1) ^ -(int64_t) (v & 1); }
+
+    inline void pack(const uint64_t* v, size_t n, int bits, std::string& out) {
+        if (bits == 0) return;
+
+        size_t start = out.size();
+        out.resize(start + words(n * bits) * 8, 0);
+        char* p = out.data() + start;
+
+        uint64_t acc = 0;
+        int fill = 0;
+        for (size_t i = 0; i < n; i++) {
+            acc |= v[i] << fill;
+            fill += bits;
+            if (fill >= 64) {
+                memcpy(p, &acc, 8);
+                p += 8;
+                fill -= 64;
+                acc = fill ? v[i] >> (bits - fill) : 0;
+            }
+        }
+        if (fill) memcpy(p, &acc, 8);
+    }
+
+    inline void unpack(const uint8_t* p, size_t n, int bits, uint64_t* out) {
+        if (bits == 0) {
+            std::fill_n(out, n, 0);
+            return;
+        }
+
+        uint64_t mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+        auto load = [p](size_t w) { uint64_t v; memcpy(&v, p + w * 8, 8); return v; };
+        for (size_t i = 0; i < n; i++) {
+            size_t bit = i * bits, w = bit >> 6;
+            int off = bit & 63;
+            uint64_t v = load(w) >> off;
+            if (off + bits > 64) v |= load(w + 1) << (64 - off);
+            out[i] = v & mask;
+        }
+    }
+
+    inline bool isNull(const uint8_t* nulls, size_t r) { return nulls && (nulls[r >> 3] >> (r & 7)) & 1; }
+}
+
+// writes the columnar file, rows are buffered until a block is full and the footer is written on close (or destruction)
+// text columns decide on dictionary encoding after their first block (at least 4 rows per distinct value)
+class ColumnarSink : public Sink {
+private:
+    struct _Col {
+        std::vector<int64_t> ints;
+        std::vector<double> reals;
+        std::string text;
+        std::vector<uint32_t> lens;
+        std::vector<uint64_t> nulls;
+        uint32_t nullCount = 0;
+
+        // -1 undecided, 0 no, 1 yes
+        int dict = -1;
+        // codes are in order of first appearance, keys of the map are stable so dictionary can point at them
+        std::unordered_map<std::string, uint32_t> codes;
+        std::vector<const std::string*> dictionary;
+    };
+
+    std::ofstream f;
+    ZSTD_CCtx* cctx;
+    std::vector<_Col> data;
+    std::string chunk;
+    std::string dir;
+    std::vector<uint64_t> scratch;
+
+    size_t blockRows;
+    size_t maxDict;
+    size_t pending = 0;
+    size_t numBlocks = 0;
+    bool closed = false;
+
+    void emit(const std::string& s) {
+        f.write(s.data(), s.size());
+        bytes += s.size();
+    }
+
+    // null rows take the value of the row before (so they never widen the packed range)
+    void encodeInts(_Col& c, std::vector<int64_t>& v, size_t n, bool dict, columnar::Chunk& meta) {
+        size_t first = 0;
+        while (first < n && columnar::isNull((const uint8_t*) c.nulls.data(), first)) first++;
+        if (first == n) {
+            meta.enc = dict ? CE_DICT : CE_PACK;
+            chunk += (char) 0;
+            return;
+        }
+
+        int64_t prev = v[first];
+        meta.min = meta.max = prev;
+        for (size_t r = 0; r < n; r++) {
+            if (columnar::isNull((const uint8_t*) c.nulls.data(), r)) v[r] = prev;
+            prev = v[r];
+            meta.min = std::min(meta.min, v[r]);
+            meta.max = std::max(meta.max, v[r]);
+        }
+
+        int forBits = std::bit_width((uint64_t) meta.max - (uint64_t) meta.min);
+        uint64_t deltaMax = 0;
+        if (!dict) for (size_t r = 1; r < n; r++) deltaMax = std::max(deltaMax, columnar::zigzag(v[r] - v[r - 1]));
+        int deltaBits = std::bit_width(deltaMax);
+
+        scratch.resize(n);
+        if (!dict && deltaBits < forBits) {
+            meta.enc = CE_DELTA;
+            chunk += (char) deltaBits;
+            columnar::put<int64_t>(chunk, v[0]);
+            for (size_t r = 1; r < n; r++) scratch[r - 1] = columnar::zigzag(v[r] - v[r - 1]);
+            columnar::pack(scratch.data(), n - 1, deltaBits, chunk);
+        } else {
+            meta.enc = dict ? CE_DICT : CE_PACK;
+            chunk += (char) forBits;
+            for (size_t r = 0; r < n; r++) scratch[r] = (uint64_t) v[r] - (uint64_t) meta.min;
+            columnar::pack(scratch.data(), n, forBits, chunk);
+        }
+
+        // index: count, then value int64 and a bitmap of rows per distinct value (null rows are in none)
+        std::vector<int64_t> distinct;
+        for (size_t r = 0; r < n && distinct.size() <= columnar::indexMax; r++) {
+            if (columnar::isNull((const uint8_t*) c.nulls.data(), r)) continue;
+            if (std::find(distinct.begin(), distinct.end(), v[r]) == distinct.end()) distinct.push_back(v[r]);
+        }
+        if (distinct.size() > columnar::indexMax) return;
+
+        std::sort(distinct.begin(), distinct.end());
+        std::vector<uint64_t> maps(distinct.size() * columnar::words(n), 0);
+        for (size_t r = 0; r < n; r++) {
+            if (columnar::isNull((const uint8_t*) c.nulls.data(), r)) continue;
+            size_t k = std::lower_bound(distinct.begin(), distinct.end(), v[r]) - distinct.begin();
+            maps[k * columnar::words(n) + (r >> 6)] |= 1ull << (r & 63);
+        }
+
+        meta.index = chunk.size();
+        columnar::put<uint32_t>(chunk, distinct.size());
+        for (size_t k = 0; k < distinct.size(); k++) {
+            columnar::put<int64_t>(chunk, distinct[k]);
+            chunk.append((const char*) (maps.data() + k * columnar::words(n)), columnar::words(n) * 8);
+        }
+    }
+
+    void encodeText(_Col& c, size_t n, columnar::Chunk& meta) {
+        if (c.dict == -1) {
+            std::unordered_map<std::string_view, bool> seen;
+            size_t pos = 0;
+            for (uint32_t l : c.lens) {
+                seen[std::string_view(c.text).substr(pos, l)] = true;
+                pos += l;
+            }
+            c.dict = seen.size() * 4 <= n;
+        }
+
+        if (c.dict == 1 && c.dictionary.size() < maxDict) {
+            std::vector<int64_t> v(n);
+            size_t pos = 0;
+            for (size_t r = 0; r < n; r++) {
+                auto [it, added] = c.codes.try_emplace(c.text.substr(pos, c.lens[r]), c.dictionary.size());
+                if (added) c.dictionary.push_back(&it->first);
+                v[r] = it->second;
+                pos += c.lens[r];
+            }
+            encodeInts(c, v, n, true, meta);
+            return;
+        }
+
+        meta.enc = CE_ZSTD;
+        std::string raw((const char*) c.lens.data(), n * sizeof(uint32_t));
+        raw += c.text;
+
+        size_t start = chunk.size();
+        chunk.resize(start + ZSTD_compressBound(raw.size()));
+        size_t z = ZSTD_compress2(cctx, chunk.data() + start, chunk.size() - start, raw.data(), raw.size());
+        if (ZSTD_isError(z)) throw std::runtime_error(std::format("(columnar.hpp) zstd error: {}", ZSTD_getErrorName(z)));
+        chunk.resize(start + z);
+    }
+
+    void cut() {
+        if (pending == 0) return;
+
+#ifdef BENCHMARK_ENABLED
+        auto t_encode = Benchmark::timestamp();
+#endif
+        columnar::put<uint32_t>(dir, pending);
+        for (size_t i = 0; i < cols.size(); i++) {
+            _Col& c = data[i];
+            columnar::Chunk meta;
+            meta.offset = bytes;
+            meta.nulls = c.nullCount;
+
+            chunk.clear();
+            if (c.nullCount) chunk.append((const char*) c.nulls.data(), columnar::words(pending) * 8);
+
+            switch (cols[i].second) {
+                case ST_INT:
+                case ST_BOOL: encodeInts(c, c.ints, pending, false, meta); break;
+                case ST_TEXT: encodeText(c, pending, meta); break;
+                case ST_REAL: {
+                    meta.enc = CE_REAL;
+                    double lo = std::numeric_limits<double>::infinity(), hi = -lo;
+                    for (size_t r = 0; r < pending; r++) {
+                        if (columnar::isNull((const uint8_t*) c.nulls.data(), r)) continue;
+                        lo = std::min(lo, c.reals[r]);
+                        hi = std::max(hi, c.reals[r]);
+                    }
+                    meta.min = std::bit_cast<int64_t>(lo);
+                    meta.max = std::bit_cast<int64_t>(hi);
+                    chunk.append((const char*) c.reals.data(), pending * sizeof(double));
+                    break;
+                }
+                case ST_BLOB: break;
+            }
+            meta.size = chunk.size();
+            emit(chunk);
+
+            columnar::put(dir, meta.offset);
+            columnar::put(dir, meta.size);
+            columnar::put(dir, meta.enc);
+            columnar::put(dir, meta.nulls);
+            columnar::put(dir, meta.min);
+            columnar::put(dir, meta.max);
+            columnar::put(dir, meta.index);
+
+            c.ints.clear();
+            c.reals.clear();
+            c.text.clear();
+            c.lens.clear();
+            std::fill(c.nulls.begin(), c.nulls.end(), 0);
+            c.nullCount = 0;
+        }
+
+        numBlocks++;
+        pending = 0;
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Columnar encode", t_encode);
+#endif
+    }
+public:
+    // maxDict caps the dictionary of a column, blocks after that fall back to zstd for it
+    ColumnarSink(const std::string& file, size_t blockRows = 16384, int level = 3, size_t maxDict = (size_t) 1 << 22)
+        : f(file, std::ios::binary), cctx(ZSTD_createCCtx()), blockRows(blockRows), maxDict(maxDict) {
+        if (!f) throw std::runtime_error("(columnar.hpp) Unable to open " + file);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        emit(std::string(columnar::magic, 8));
+    }
+
+    ~ColumnarSink() {
+        try { close(); } catch (...) {}
+        ZSTD_freeCCtx(cctx);
+    }
+
+    void open(const std::string& t, const SchemaColumns& c) override {
+        if (reopen(t, c)) return;
+        data.resize(cols.size());
+        for (auto& d : data) d.nulls.resize(columnar::words(blockRows), 0);
+    }
+
+    void write(const SchemaValue* values, size_t n) override {
+        for (size_t r = 0; r < n; r++) {
+            for (size_t i = 0; i < cols.size(); i++) {
+                const SchemaValue& v = *values++;
+                _Col& c = data[i];
+                if (v.kind == SchemaValue::SV_NULL || (v.kind == SchemaValue::SV_TEXT && cols[i].second != ST_TEXT)) {
+                    c.nulls[pending >> 6] |= 1ull << (pending & 63);
+                    c.nullCount++;
+                }
+
+                switch (cols[i].second) {
+                    case ST_INT:
+                    case ST_BOOL: c.ints.push_back(v.kind == SchemaValue::SV_REAL ? (int64_t) v.d : v.i); break;
+                    case ST_REAL: c.reals.push_back(v.kind == SchemaValue::SV_INT ? (double) v.i : v.d); break;
+                    case ST_TEXT: {
+                        // old dumps have some ids as numbers (see parent_id in mainSchema)
+                        size_t start = c.text.size();
+                        if (v.kind == SchemaValue::SV_TEXT) c.text += v.s;
+                        else if (v.kind != SchemaValue::SV_NULL) {
+                            char tmp[32];
+                            auto res = v.kind == SchemaValue::SV_INT ? std::to_chars(tmp, tmp + sizeof(tmp), v.i) : std::to_chars(tmp, tmp + sizeof(tmp), v.d);
+                            c.text.append(tmp, res.ptr);
+                        }
+                        c.lens.push_back(c.text.size() - start);
+                        break;
+                    }
+                    case ST_BLOB: break;
+                }
+            }
+
+            if (++pending == blockRows) cut();
+        }
+        rows += n;
+    }
+
+    // writes the last block and the footer, nothing can be written afterwards
+    void close() {
+        if (closed) return;
+        closed = true;
+        cut();
+
+        std::string footer;
+        columnar::putStr(footer, table);
+        columnar::put<uint32_t>(footer, cols.size());
+        for (const auto& [k, type] : cols) {
+            columnar::putStr(footer, k);
+            columnar::put<uint8_t>(footer, type);
+        }
+        for (const auto& c : data) {
+            columnar::put<uint32_t>(footer, c.dictionary.size());
+            for (const std::string* s : c.dictionary) columnar::putStr(footer, *s);
+        }
+        columnar::put<uint64_t>(footer, numBlocks);
+        footer += dir;
+
+        uint64_t at = bytes;
+        columnar::put(footer, at);
+        footer.append(columnar::magic, 8);
+        emit(footer);
+        f.flush();
+    }
+};
+
+// filter for ColumnarReader::scan, bounds are inclusive
+struct ColumnFilter {
+    std::string column;
+    int64_t lo = std::numeric_limits<int64_t>::min();
+    int64_t hi = std::numeric_limits<int64_t>::max();
+    double dlo = -std::numeric_limits<double>::infinity();
+    double dhi = std::numeric_limits<double>::infinity();
+    bool isText = false;
+    std::string text;
+
+    static ColumnFilter between(const std::string& column, int64_t lo, int64_t hi) {
+        ColumnFilter f;
+        f.column = column;
+        f.lo = lo;
+        f.hi = hi;
+        return f;
+    }
+    static ColumnFilter betweenReal(const std::string& column, double lo, double hi) {
+        ColumnFilter f;
+        f.column = column;
+        f.dlo = lo;
+        f.dhi = hi;
+        return f;
+    }
+    static ColumnFilter equals(const std::string& column, int64_t v) { return between(column, v, v); }
+    static ColumnFilter equals(const std::string& column, const std::string& v) {
+        ColumnFilter f;
+        f.column = column;
+        f.isText = true;
+        f.text = v;
+        return f;
+    }
+};
+
+// memory maps a file written by ColumnarSink, scan only looks at the chunks it needs
+// blocks are skipped by zone maps, filters on indexed chunks are answered by bitmaps, everything else is decoded per block
+class ColumnarReader {
+private:
+    struct _Block {
+        uint32_t rows;
+        std::vector<columnar::Chunk> chunks;
+    };
+
+    // one decoded chunk of the current block
+    struct _Decoded {
+        size_t block = SIZE_MAX;
+        std::vector<int64_t> ints;
+        std::vector<std::string_view> text;
+        std::string raw;
+        const uint8_t* nulls = nullptr;
+    };
+
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    std::string table;
+    SchemaColumns cols;
+    std::vector<std::vector<std::string_view>> dicts;
+    std::vector<std::unordered_map<std::string_view, int64_t>> lookup;
+    std::vector<_Block> blocks;
+    size_t total = 0;
+
+    ZSTD_DCtx* dctx;
+    std::vector<_Decoded> decoded;
+    std::vector<uint64_t> scratch;
+
+    ColumnarReader(const ColumnarReader&) = delete;
+    ColumnarReader& operator=(const ColumnarReader&) = delete;
+
+    struct _In {
+        const uint8_t* p;
+        const uint8_t* end;
+
+        template <typename V>
+        V get() {
+            if (end - p < (ptrdiff_t) sizeof(V)) throw std::runtime_error("(columnar.hpp) Truncated columnar file");
+            V v;
+            memcpy(&v, p, sizeof(V));
+            p += sizeof(V);
+            return v;
+        }
+
+        std::string_view str() {
+            uint32_t n = get<uint32_t>();
+            if ((size_t) (end - p) < n) throw std::runtime_error("(columnar.hpp) Truncated columnar file");
+            std::string_view s((const char*) p, n);
+            p += n;
+            return s;
+        }
+    };
+
+    void map(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("(columnar.hpp) Unable to open " + path);
+        LARGE_INTEGER sz;
+        GetFileSizeEx(file, &sz);
+        length = sz.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) throw std::runtime_error("(columnar.hpp) Unable to map " + path);
+        base = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!base) throw std::runtime_error("(columnar.hpp) Unable to map " + path);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) throw std::runtime_error("(columnar.hpp) Unable to open " + path);
+        struct stat st;
+        fstat(fd, &st);
+        length = st.st_size;
+        void* p = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("(columnar.hpp) Unable to map " + path);
+        base = (const uint8_t*) p;
+#endif
+    }
+
+    void unmap() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (base) munmap((void*) base, length);
+#endif
+        base = nullptr;
+    }
+
+    const uint8_t* at(const columnar::Chunk& c) const { return base + c.offset; }
+    const uint8_t* body(const columnar::Chunk& c, uint32_t rows) const { return at(c) + (c.nulls ? columnar::words(rows) * 8 : 0); }
+
+    // decodes column i of block b (once per block)
+    _Decoded& decode(size_t b, size_t i) {
+        _Decoded& d = decoded[i];
+        if (d.block == b) return d;
+
+#ifdef BENCHMARK_ENABLED
+        auto t_decode = Benchmark::timestamp();
+#endif
+        const columnar::Chunk& c = blocks[b].chunks[i];
+        uint32_t n = blocks[b].rows;
+        const uint8_t* p = body(c, n);
+        d.block = b;
+        d.nulls = c.nulls ? at(c) : nullptr;
+
+        switch (c.enc) {
+            case CE_PACK:
+            case CE_DICT: {
+                scratch.resize(n);
+                columnar::unpack(p + 1, n, p[0], scratch.data());
+                d.ints.resize(n);
+                for (size_t r = 0; r < n; r++) d.ints[r] = (int64_t) (scratch[r] + (uint64_t) c.min);
+                if (c.enc == CE_DICT) {
+                    d.text.resize(n);
+                    for (size_t r = 0; r < n; r++) d.text[r] = dicts[i][d.ints[r]];
+                }
+                break;
+            }
+            case CE_DELTA: {
+                int64_t v;
+                memcpy(&v, p + 1, 8);
+                scratch.resize(n);
+                columnar::unpack(p + 9, n - 1, p[0], scratch.data());
+                d.ints.resize(n);
+                d.ints[0] = v;
+                for (size_t r = 1; r < n; r++) d.ints[r] = v = v + columnar::unzigzag(scratch[r - 1]);
+                break;
+            }
+            case CE_REAL: {
+                d.ints.resize(n);
+                memcpy(d.ints.data(), p, n * sizeof(double));
+                break;
+            }
+            case CE_ZSTD: {
+                size_t zsize = c.size - (p - at(c));
+                unsigned long long raw = ZSTD_getFrameContentSize(p, zsize);
+                if (raw == ZSTD_CONTENTSIZE_ERROR || raw == ZSTD_CONTENTSIZE_UNKNOWN) throw std::runtime_error("(columnar.hpp) Corrupt text chunk");
+                d.raw.resize(raw);
+                size_t r = ZSTD_decompressDCtx(dctx, d.raw.data(), raw, p, zsize);
+                if (ZSTD_isError(r)) throw std::runtime_error(std::format("(columnar.hpp) zstd error: {}", ZSTD_getErrorName(r)));
+
+                d.text.resize(n);
+                const char* s = d.raw.data() + n * sizeof(uint32_t);
+                for (size_t r = 0; r < n; r++) {
+                    uint32_t l;
+                    memcpy(&l, d.raw.data() + r * sizeof(uint32_t), sizeof(uint32_t));
+                    d.text[r] = std::string_view(s, l);
+                    s += l;
+                }
+                break;
+            }
+        }
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Columnar decode", t_decode);
+#endif
+        return d;
+    }
+
+    // text filters on dictionary chunks become a code range (lo > hi if the value is not in the dictionary)
+    struct _Filter {
+        size_t col;
+        SchemaType type;
+        const ColumnFilter* f;
+        int64_t code = -1;
+    };
+
+    // if the zone map says nothing in the chunk can match
+    bool outside(const _Filter& f, const columnar::Chunk& c, uint32_t rows) const {
+        if (c.nulls == rows) return true;
+        switch (c.enc) {
+            case CE_ZSTD: return false;
+            case CE_DICT: return f.code < c.min || f.code > c.max;
+            case CE_REAL: return f.f->dhi < std::bit_cast<double>(c.min) || f.f->dlo > std::bit_cast<double>(c.max);
+            default: return f.f->hi < c.min || f.f->lo > c.max;
+        }
+    }
+
+    bool match(const _Filter& f, const _Decoded& d, const columnar::Chunk& c, size_t r) const {
+        switch (c.enc) {
+            case CE_ZSTD: return d.text[r] == f.f->text;
+            case CE_DICT: return d.ints[r] == f.code;
+            case CE_REAL: {
+                double v = std::bit_cast<double>(d.ints[r]);
+                return v >= f.f->dlo && v <= f.f->dhi;
+            }
+            default: return d.ints[r] >= f.f->lo && d.ints[r] <= f.f->hi;
+        }
+    }
+public:
+    ColumnarReader(const std::string& path) : dctx(ZSTD_createDCtx()) {
+        map(path);
+        try {
+            if (length < 24 || memcmp(base, columnar::magic, 8) != 0 || memcmp(base + length - 8, columnar::magic, 8) != 0)
+                throw std::runtime_error("(columnar.hpp) Not a columnar file (or it was not closed): " + path);
+
+            uint64_t at;
+            memcpy(&at, base + length - 16, 8);
+            if (at > length - 16) throw std::runtime_error("(columnar.hpp) Truncated columnar file");
+            _In in{base + at, base + length - 16};
+
+            table = in.str();
+            uint32_t n = in.get<uint32_t>();
+            for (uint32_t i = 0; i < n; i++) {
+                std::string k(in.str());
+                cols.push_back({k, (SchemaType) in.get<uint8_t>()});
+            }
+
+            dicts.resize(n);
+            for (auto& d : dicts) {
+                uint32_t size = in.get<uint32_t>();
+                d.reserve(size);
+                for (uint32_t k = 0; k < size; k++) d.push_back(in.str());
+            }
+
+            blocks.resize(in.get<uint64_t>());
+            for (auto& b : blocks) {
+                b.rows = in.get<uint32_t>();
+                b.chunks.resize(n);
+                for (auto& c : b.chunks) {
+                    c.offset = in.get<uint64_t>();
+                    c.size = in.get<uint64_t>();
+                    c.enc = in.get<ColumnEncoding>();
+                    c.nulls = in.get<uint32_t>();
+                    c.min = in.get<int64_t>();
+                    c.max = in.get<int64_t>();
+                    c.index = in.get<uint64_t>();
+                    if (c.offset + c.size > at) throw std::runtime_error("(columnar.hpp) Chunk out of bounds");
+                }
+                total += b.rows;
+            }
+        } catch (...) {
+            unmap();
+            ZSTD_freeDCtx(dctx);
+            throw;
+        }
+
+        lookup.resize(cols.size());
+        decoded.resize(cols.size());
+    }
+
+    ~ColumnarReader() {
+        unmap();
+        ZSTD_freeDCtx(dctx);
+    }
+
+    const std::string& name() const { return table; }
+    const SchemaColumns& fields() const { return cols; }
+    size_t rows() const { return total; }
+    size_t size() const { return blocks.size(); }
+
+    int column(const std::string& name) const {
+        auto it = std::find_if(cols.begin(), cols.end(), [&](const auto& c) { return c.first == name; });
+        return it == cols.end() ? -1 : (int) (it - cols.begin());
+    }
+
+    // calls fn(row) for every row matching all filters, row has one value per column in select (in that order)
+    // text points into the mapping (or the decoded block), so copy it if it needs to live longer than the call
+    Columnar_Output scan(const std::vector<ColumnFilter>& filters, const std::vector<std::string>& select, const std::function<void(const SchemaValue*)>& fn) {
+        Columnar_Output out{};
+        out.blocks = blocks.size();
+
+        auto resolve = [&](const std::string& name) {
+            int i = column(name);
+            if (i == -1) throw std::runtime_error(std::format("(columnar.hpp) {} has no column {}", table, name));
+            return (size_t) i;
+        };
+
+        std::vector<_Filter> fs;
+        for (const auto& f : filters) {
+            _Filter r{resolve(f.column), ST_TEXT, &f};
+            r.type = cols[r.col].second;
+            if (f.isText != (r.type == ST_TEXT)) throw std::runtime_error("(columnar.hpp) Filter type does not match column " + f.column);
+
+            if (f.isText) {
+                auto& l = lookup[r.col];
+                if (l.empty()) for (size_t k = 0; k < dicts[r.col].size(); k++) l[dicts[r.col][k]] = k;
+                auto it = l.find(f.text);
+                r.code = it == l.end() ? -1 : it->second;
+            }
+            fs.push_back(r);
+        }
+
+        std::vector<size_t> sel;
+        for (const auto& s : select) sel.push_back(resolve(s));
+
+#ifdef BENCHMARK_ENABLED
+        auto t_scan = Benchmark::timestamp();
+#endif
+        std::vector<SchemaValue> row(sel.size());
+        std::vector<uint64_t> mask, hit;
+        for (size_t b = 0; b < blocks.size(); b++) {
+            const _Block& blk = blocks[b];
+            uint32_t n = blk.rows;
+
+            if (std::any_of(fs.begin(), fs.end(), [&](const _Filter& f) { return outside(f, blk.chunks[f.col], n); })) {
+                out.blocksSkipped++;
+                continue;
+            }
+            out.rows += n;
+
+            size_t w = columnar::words(n);
+            mask.assign(w, ~0ull);
+            if (n & 63) mask[w - 1] = (1ull << (n & 63)) - 1;
+
+            for (const auto& f : fs) {
+                const columnar::Chunk& c = blk.chunks[f.col];
+                if (c.index) {
+                    // or together the bitmaps of every value in range, same test as match()
+                    const uint8_t* p = at(c) + c.index;
+                    uint32_t k;
+                    memcpy(&k, p, 4);
+                    p += 4;
+
+                    hit.assign(w, 0);
+                    for (uint32_t v = 0; v < k; v++, p += 8 + w * 8) {
+                        int64_t val;
+                        memcpy(&val, p, 8);
+                        if (c.enc == CE_DICT ? val != f.code : (val < f.f->lo || val > f.f->hi)) continue;
+                        for (size_t x = 0; x < w; x++) {
+                            uint64_t bits;
+                            memcpy(&bits, p + 8 + x * 8, 8);
+                            hit[x] |= bits;
+                        }
+                    }
+                    for (size_t x = 0; x < w; x++) mask[x] &= hit[x];
+                    out.indexed++;
+                    continue;
+                }
+
+                const _Decoded& d = decode(b, f.col);
+                for (size_t x = 0; x < w; x++) {
+                    for (uint64_t bits = mask[x]; bits; bits &= bits - 1) {
+                        size_t r = x * 64 + std::countr_zero(bits);
+                        if (columnar::isNull(d.nulls, r) || !match(f, d, c, r)) mask[x] &= ~(1ull << (r & 63));
+                    }
+                }
+            }
+
+            std::vector<_Decoded*> picked;
+            for (size_t i : sel) picked.push_back(&decode(b, i));
+
+            for (size_t x = 0; x < w; x++) {
+                for (uint64_t bits = mask[x]; bits; bits &= bits - 1) {
+                    size_t r = x * 64 + std::countr_zero(bits);
+                    for (size_t k = 0; k < sel.size(); k++) {
+                        const _Decoded& d = *picked[k];
+                        SchemaValue& v = row[k];
+                        if (columnar::isNull(d.nulls, r)) v.null();
+                        else if (blk.chunks[sel[k]].enc == CE_ZSTD || blk.chunks[sel[k]].enc == CE_DICT) v.text(d.text[r]);
+                        else if (blk.chunks[sel[k]].enc == CE_REAL) v.real(std::bit_cast<double>(d.ints[r]));
+                        else v.integer(d.ints[r]);
+                    }
+                    fn(row.data());
+                    out.matched++;
+                }
+            }
+        }
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Columnar scan", t_scan);
+#endif
+
+        return out;
+    }
+};
+
+#endif
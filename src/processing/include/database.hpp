@@ -8,6 +8,12 @@
 #include <stdexcept>
 #include <chrono>
 #include <format>
+#include <thread>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <algorithm>
 #include <regex>
 #include <generator>
 #include <functional>
@@ -16,24 +22,344 @@
 #include "sqlite3.h"
 
 #include "types.hpp"
+#include "schema.hpp"
 #include "reader.hpp"
 #include "timing.hpp"
+#include "dedup.hpp"
+#include "queue.hpp"
+#include "sink.hpp"
 
 namespace fs = std::filesystem;
 
-#define RAW_TEXT(FIELD) {#FIELD, ST_TEXT, [](const auto& json, std::string& out) { out = json.FIELD; }}
-#define INT(FIELD) {#FIELD, ST_INT, [](const auto& json, std::string& out) { out = std::to_string((int) json.FIELD); }}
-#define BOOL(FIELD) {#FIELD, ST_BOOL, [](const auto& json, std::string& out) { out = ((char) json.FIELD) + 48; }}
+#define RAW_TEXT(FIELD) {#FIELD, ST_TEXT, [](const auto& json, SchemaValue& out) { out.text(json.FIELD); }}
+#define INT(FIELD) {#FIELD, ST_INT, [](const auto& json, SchemaValue& out) { out.integer((int64_t) json.FIELD); }}
+#define BOOL(FIELD) {#FIELD, ST_BOOL, [](const auto& json, SchemaValue& out) { out.integer(json.FIELD ? 1 : 0); }}
+
+// time is in us (summed over all writers), reader waits for a free batch buffer (writers are behind), writers wait for a filled one (reader is behind)
+struct Writer_Output {
+    size_t batches = 0;
+    int connections = 0;
+    int64_t readerStall = 0;
+    int64_t writerStall = 0;
+
+    // settings at the end of the read (of the last writer), see Database::setAdaptive
+    int insBuf = 0;
+    size_t writeBuf = 0;
+};
 
 // notice that all strings are encoded as utf8, so we dont need to do any conversions
 // https://github.com/ArthurHeitmann/arctic_shift/blob/bde0d2e8d41c0b6ade62ff79f69a77d633741482/file_content_explanations.md?plain=1#L12
 
-template <TRedditData T>
+// S is either the runtime Schema or a CompiledSchema (schema.hpp)
+template <TRedditData T, TSchema<T> S = Schema<T>>
 class Database {
 private:
-    const Schema<T> table;
+    const S table;
     sqlite3* db;
 
+    FingerprintSet* dedup = nullptr;
+    DedupMode dedupMode = DD_OFF;
+
+    // extra per row work (i.e. side tables), commit hooks run inside the open transaction right before it is ended
+    std::vector<std::function<void(const T&)>> rowHooks;
+    std::vector<std::function<void()>> commitHooks;
+
+    void preCommit() { for (const auto& f : commitHooks) f(); }
+
+    // rows handed to a writer thread, values are rows.size() * (number of columns)
+    // first is the rowid of the first row (only bound when sharding)
+    struct _Batch {
+        std::vector<SchemaValue> values;
+        std::vector<const T*> rows;
+        int64_t first = 0;
+    };
+
+    // rows per insert (ins) and per transaction (txn) of one writer
+    // when adaptive, this hill climbs on bytes/s (bound bytes over time spent writing) measured once per transaction:
+    // keep moving a setting in the same direction while it gets faster, turn around when it gets slower
+    // and switch to the other setting after turning around twice
+    struct _Tuner {
+        int ins = 5;
+        size_t txn = 50000;
+        int maxIns = 1;
+        size_t minTxn = 1;
+        size_t maxTxn = (size_t) 1 << 22;
+
+        bool adaptive = false;
+        int param = 0;
+        int dir = 1;
+        int flips = 0;
+        double last = 0;
+
+        size_t bytes = 0;
+        int64_t us = 0;
+
+        void step() {
+            if (param == 0) ins = std::clamp(dir > 0 ? ins * 2 : ins / 2, 1, maxIns);
+            else txn = std::clamp(dir > 0 ? txn * 3 / 2 : txn * 2 / 3, minTxn, maxTxn);
+        }
+
+        void commit() {
+            double rate = us ? (double) bytes / (double) us : 0;
+            bytes = 0;
+            us = 0;
+            if (!adaptive) return;
+
+            if (rate < last) {
+                dir = -dir;
+                if (++flips % 2 == 0) param ^= 1;
+            }
+            last = rate;
+            step();
+        }
+    };
+
+    // one per writer thread, an unsharded read has a single writer on the database connection itself
+    struct _Writer {
+        sqlite3* conn = nullptr;
+        std::string file;
+        BoundedQueue<int> filled;
+
+        // insert statements by number of rows, prepared on first use
+        std::vector<sqlite3_stmt*> stmts;
+        _Tuner tune;
+
+        size_t rows = 0;
+        size_t sinceCommit = 0;
+        size_t batches = 0;
+        int64_t stall = 0;
+
+        _Writer(size_t depth) : filled(depth) {}
+    };
+
+    // buffers in flight between the reader and the writer threads, and rows per buffer (rounded down to a multiple of insBuf)
+    int queueDepth = 4;
+    size_t batchRows = 1024;
+    Writer_Output wstats{};
+
+    std::string path;
+    int shards = 0;
+    bool mergeShards = true;
+
+    // shards are merged through ATTACH, which is limited to 10 databases by default
+    static constexpr int maxShards = 8;
+    static constexpr const char* manifest = "shards";
+
+    bool adaptive = false;
+    Sink* sink = nullptr;
+
+    // every file read into the table (file name, table, size, mtime, content hash, rows written, rowids of those rows)
+    // rows and last_rowid stay null until the read commits, so a read that was cut short is never taken as done
+    // the hash is only there for appends that read the whole file, taken from the compressed bytes as the reader streams them
+    static constexpr const char* processedFiles = "files";
+    bool append = false;
+    std::vector<std::function<void(int64_t)>> truncateHooks;
+
+    std::function<bool(std::string_view)> keep;
+    std::function<bool(const T&)> filter;
+
+    void createFiles() {
+        exec(std::format("CREATE TABLE IF NOT EXISTS {} (file TEXT, tbl TEXT, size INTEGER, mtime INTEGER, hash TEXT, rows INTEGER, first_rowid INTEGER, last_rowid INTEGER)", processedFiles));
+    }
+
+    static int64_t mtime(const std::string& file) {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::file_clock::to_sys(fs::last_write_time(file)).time_since_epoch()).count();
+    }
+
+    static std::string hashString(const Fingerprint& f) { return std::format("{:016x}{:016x}", f.hi, f.lo); }
+
+    // same chunks as the reader hashes in (see Reader::hashInput)
+    static std::string contentHash(const std::string& file) { return hashString(fileFingerprint(file, Reader::inputChunk())); }
+
+    // cmd with values bound as ?1, ?2, ... (file names and paths can have quotes in them, so they are never pasted into sql)
+    sqlite3_stmt* bound(const std::string& cmd, const std::vector<std::string>& values) const {
+        sqlite3_stmt* stmt;
+        tryThrowSql(sqlite3_prepare_v2(db, cmd.c_str(), cmd.size() + 1, &stmt, nullptr), "Could not create prepared statement: " + cmd);
+        for (size_t i = 0; i < values.size(); i++) sqlite3_bind_text(stmt, i + 1, values[i].c_str(), values[i].size(), SQLITE_TRANSIENT);
+        return stmt;
+    }
+
+    void execBound(const std::string& cmd, const std::vector<std::string>& values) const {
+        sqlite3_stmt* stmt = bound(cmd, values);
+        int ret = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (ret != SQLITE_DONE) tryThrowSql(ret, "Could not run " + cmd);
+    }
+
+    // cmd with the file name as ?1 and the table as ?2
+    sqlite3_stmt* fileStatement(const std::string& cmd, const std::string& name) const { return bound(cmd, {name, table.name}); }
+    void execFile(const std::string& cmd, const std::string& name) const { execBound(cmd, {name, table.name}); }
+
+    // rowid the next read starts after, shards that were not merged yet have taken rowids too (see setShards)
+    int64_t lastRowid() const {
+        exec(std::format("CREATE TABLE IF NOT EXISTS {} (file TEXT, tbl TEXT, rows INTEGER, first_rowid INTEGER, last_rowid INTEGER)", manifest));
+        return std::max(
+            scalar(std::format("SELECT max(rowid) FROM {}", table.name)),
+            scalar(std::format("SELECT max(last_rowid) FROM {} WHERE tbl = ?1", manifest), {table.name}));
+    }
+
+    sqlite3_stmt* statement(_Writer& w, int rows) const {
+        if ((int) w.stmts.size() <= rows) w.stmts.resize(rows + 1, nullptr);
+        if (!w.stmts[rows]) w.stmts[rows] = prepare(w.conn, rows, shards > 1);
+        return w.stmts[rows];
+    }
+
+    // writer thread, inserts a batch tune.ins rows at a time, then (unsharded only) runs the row hooks and commits every tune.txn rows
+    template <int InsBuf>
+    void write(_Writer& w, const _Batch& batch, int e_len) {
+        bool sharded = shards > 1;
+        auto t_write = Benchmark::timestamp();
+        int rows = batch.rows.size();
+
+        if (sink) {
+#ifdef BENCHMARK_ENABLED
+            auto t_sink = Benchmark::timestamp();
+#endif
+            sink->write(batch.values.data(), rows);
+            w.rows += rows;
+            for (const T* j : batch.rows) for (const auto& f : rowHooks) f(*j);
+
+            if ((w.sinceCommit += rows) >= w.tune.txn) {
+                preCommit();
+                sink->flush();
+                sqlite3_exec(w.conn, "END TRANSACTION", nullptr, nullptr, nullptr);
+                sqlite3_exec(w.conn, "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+                w.sinceCommit = 0;
+            }
+#ifdef BENCHMARK_ENABLED
+            Benchmark::sum("Sink", t_sink);
+#endif
+            return;
+        }
+
+#ifdef BENCHMARK_ENABLED
+        auto t_sql = Benchmark::timestamp();
+#endif
+        auto insert = [&](sqlite3_stmt* stmt, int r, int n) {
+            const SchemaValue* v = &batch.values[r * e_len];
+            int e_i, p = 1;
+            if (sharded) {
+                for (int k = 0; k < n; k++) {
+                    sqlite3_bind_int64(stmt, p++, batch.first + r + k);
+                    for (e_i = 0; e_i < e_len; e_i++) bind(stmt, p++, v[k * e_len + e_i]);
+                }
+            } else if (InsBuf != 0 && n == InsBuf) {
+                bindRows<InsBuf>(stmt, v, e_len);
+            } else for (e_i = 0; e_i < n * e_len; e_i++) bind(stmt, e_i + 1, v[e_i]);
+
+            int ret = sqlite3_step(stmt);
+            if (ret != SQLITE_DONE) throw std::runtime_error("Could not step prepared statement: " + std::string(sqlite3_errmsg(w.conn)));
+        };
+
+        // leftover rows need a statement of their own width, otherwise the unbound rows are inserted as NULL
+        int r = 0;
+        while (r < rows) {
+            int n = std::min(w.tune.ins, rows - r);
+            sqlite3_stmt* stmt = statement(w, n);
+            insert(stmt, r, n);
+            sqlite3_reset(stmt);
+            r += n;
+        }
+        w.rows += rows;
+
+        for (const SchemaValue& v : std::span(batch.values.data(), rows * e_len)) w.tune.bytes += v.kind == SchemaValue::SV_TEXT || v.kind == SchemaValue::SV_BLOB ? v.s.size() : 8;
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("SQL", t_sql);
+#endif
+
+        if (!sharded) for (const T* j : batch.rows) for (const auto& f : rowHooks) f(*j);
+
+        bool commit = (w.sinceCommit += rows) >= w.tune.txn;
+        if (commit) {
+            if (!sharded) preCommit();
+#ifdef BENCHMARK_ENABLED
+            t_sql = Benchmark::timestamp();
+#endif
+            // note that we dont use exec(...) here for performance
+            sqlite3_exec(w.conn, "END TRANSACTION", nullptr, nullptr, nullptr);
+            sqlite3_exec(w.conn, "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+#ifdef BENCHMARK_ENABLED
+            Benchmark::sum("SQL", t_sql);
+#endif
+            w.sinceCommit = 0;
+        }
+
+        w.tune.us += Benchmark::elapsed_us(t_write);
+        if (commit) w.tune.commit();
+    }
+
+    // INSERT with rows * (number of columns) parameters, with an explicit rowid in front of every row if asked for
+    sqlite3_stmt* prepare(sqlite3* conn, int rows, bool rowid = false) const {
+        std::stringstream sbind;
+        for (int j = 0; j < rows; j++) {
+            sbind << (rowid ? "(?," : "(");
+            for (int i = 0; i < (int) table.size() - 1; i++) sbind << "?,";
+            sbind << "?)";
+            if (j != rows - 1) sbind << ",";
+        }
+
+        sqlite3_stmt* stmt;
+        std::string stmtStr = std::format("INSERT INTO {} ({}{}) VALUES {}", table.name, rowid ? "rowid," : "", table.columns_ins(), sbind.str());
+        int ret = sqlite3_prepare_v3(conn, stmtStr.c_str(), stmtStr.size() + 1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+        tryThrowSql(ret, "Could not create prepared statement: " + stmtStr);
+
+        return stmt;
+    }
+
+    void run(sqlite3* conn, const std::string& cmd) const {
+        char* err = 0;
+        int ret = sqlite3_exec(conn, cmd.c_str(), nullptr, nullptr, &err);
+        tryThrowSql(ret, "Could not run " + cmd, err);
+    }
+
+    // first column of the first row as an integer (0 if there are no rows), values are bound as in bound()
+    int64_t scalar(const std::string& cmd, const std::vector<std::string>& values = {}) const {
+        sqlite3_stmt* stmt = bound(cmd, values);
+        int64_t v = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+        sqlite3_finalize(stmt);
+        return v;
+    }
+
+    // scratch database with just the table, nothing to recover if we crash so no journal
+    sqlite3* openShard(const std::string& file) const {
+        if (fs::exists(file)) fs::remove(file);
+
+        sqlite3* conn;
+        int ret = sqlite3_open_v2(file.c_str(), &conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+        if (ret != SQLITE_OK) sqlite3_close(conn);
+        tryThrowSql(ret, "Could not open shard " + file);
+
+        run(conn, std::format(
+            "PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF; \
+            CREATE TABLE {} ({}) STRICT; \
+            BEGIN TRANSACTION;",
+            table.name, table.columns()));
+        return conn;
+    }
+
+    // InsBuf rows of e_len values, a constant trip count over the rows, and a compiled schema binds the columns of a row through
+    // its tuple (see CompiledSchema::bindRow) so only its groups loop
+    template <int InsBuf>
+    void bindRows(sqlite3_stmt* stmt, const SchemaValue* v, int e_len) const {
+        if constexpr (requires { table.bindRow(v, [](const SchemaValue&) {}); }) {
+            int p = 1;
+            auto one = [&](const SchemaValue& x) { bind(stmt, p++, x); };
+            for (int k = 0; k < InsBuf; k++) table.bindRow(v + k * e_len, one);
+        } else {
+            for (int e = 0; e < InsBuf * e_len; e++) bind(stmt, e + 1, v[e]);
+        }
+    }
+
+    static void bind(sqlite3_stmt* stmt, int i, const SchemaValue& v) {
+        switch (v.kind) {
+            case SchemaValue::SV_NULL: sqlite3_bind_null(stmt, i); break;
+            case SchemaValue::SV_INT: sqlite3_bind_int64(stmt, i, v.i); break;
+            case SchemaValue::SV_REAL: sqlite3_bind_double(stmt, i, v.d); break;
+            case SchemaValue::SV_TEXT: sqlite3_bind_text(stmt, i, v.s.data(), v.s.size(), SQLITE_STATIC); break;
+            case SchemaValue::SV_BLOB: sqlite3_bind_blob(stmt, i, v.s.data(), v.s.size(), SQLITE_STATIC); break;
+        }
+    }
+
     Database(const Database&) = delete;
     Database& operator=(const Database&) = delete;
 
@@ -49,8 +375,9 @@ private:
         }
     }
 public:
-    Database(const std::string& file, const Schema<T>& table, bool clear = false) : table(table) {
-        int ret = sqlite3_open_v2(file.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr); 
+    // vfs is the name of a registered sqlite vfs (i.e. ZstdVfs, see vfs.hpp), default one if not given
+    Database(const std::string& file, const S& table, bool clear = false, const char* vfs = nullptr) : table(table), path(file) {
+        int ret = sqlite3_open_v2(file.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, vfs);
         tryThrowSql(ret, "Could not open database " + file);
 
         exec("BEGIN TRANSACTION", "Unable to start transaction in database initialization");
@@ -78,85 +405,368 @@ public:
     }
 
     const std::string& getSchema() const { return table.columns(); }
+    const Writer_Output& writeStatus() const { return wstats; }
+    sqlite3* handle() const { return db; }
+
+    void addHook(const std::function<void(const T&)>& row, const std::function<void()>& commit = nullptr) {
+        if (row) rowHooks.push_back(row);
+        if (commit) commitHooks.push_back(commit);
+    }
+
+    // write through n connections into n shard files ({file}.{i}.shard) in parallel, n <= 1 turns it off (at most maxShards)
+    // shards are merged back into the table at the end of read with the same rowids (and so order) an unsharded read would give
+    // if merge is false they are left as is and listed in the shards table instead, the sampling queries need merge() first
+    // (unsharded reads and processed() merge them themselves, the next sharded read continues after their rowids)
+    void setShards(int n, bool merge = true) {
+        shards = std::min(n, maxShards);
+        mergeShards = merge;
+    }
+
+    // moves every shard of this table listed in the shards table into the table (in rowid order) and deletes them
+    void merge() {
+        exec(std::format("CREATE TABLE IF NOT EXISTS {} (file TEXT, tbl TEXT, rows INTEGER, first_rowid INTEGER, last_rowid INTEGER)", manifest));
+
+        // shards of the same read share first_rowid
+        std::vector<std::pair<int64_t, std::string>> files;
+        sqlite3_stmt* stmt = bound(std::format("SELECT first_rowid, file FROM {} WHERE tbl = ?1 ORDER BY first_rowid", manifest), {table.name});
+        while (sqlite3_step(stmt) == SQLITE_ROW) files.push_back({sqlite3_column_int64(stmt, 0), (const char*) sqlite3_column_text(stmt, 1)});
+        sqlite3_finalize(stmt);
+
+#ifdef BENCHMARK_ENABLED
+        auto t_merge = Benchmark::timestamp();
+#endif
+        // a shard is in rowid order, so ORDER BY on the UNION ALL of one read is a merge and the table is appended to in order
+        for (size_t g = 0, end; g < files.size(); g = end) {
+            for (end = g; end < files.size() && files[end].first == files[g].first; end++) {}
+
+            std::string sel;
+            for (size_t i = g; i < end; i++) {
+                execBound(std::format("ATTACH DATABASE ?1 AS shard{}", i - g), {files[i].second});
+                if (i != g) sel += " UNION ALL ";
+                sel += std::format("SELECT rowid,{} FROM shard{}.{}", table.columns_ins(), i - g, table.name);
+            }
+
+            exec("BEGIN TRANSACTION");
+            exec(std::format("INSERT INTO {0} (rowid,{1}) {2} ORDER BY 1", table.name, table.columns_ins(), sel));
+            exec("END TRANSACTION");
+
+            for (size_t i = g; i < end; i++) {
+                exec(std::format("DETACH DATABASE shard{}", i - g));
+                fs::remove(files[i].second);
+            }
+        }
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Merge", t_merge);
+#endif
+
+        execBound(std::format("DELETE FROM {} WHERE tbl = ?1", manifest), {table.name});
+    }
+
+    // read() skips files that are already in the files table (see processed), so new files can be added to an existing table
+    void setAppend(bool on) { append = on; }
+
+    // fn(first) runs inside the transaction of processed() right before rows from rowid first on are deleted (i.e. for side tables)
+    void onTruncate(const std::function<void(int64_t)>& fn) { truncateHooks.push_back(fn); }
+
+    // true if file (by name) was read into this table before and has not changed since: same size and mtime, or same size and
+    // content hash (only the mtime is updated then), the file is only hashed here if its mtime changed
+    // otherwise whatever an earlier read of it left behind (a changed file, or a read that was cut short) is deleted along with
+    // everything read after it, so reading it and the files after it again ends the same as reading them into an empty table
+    bool processed(const std::string& file) {
+        createFiles();
+        std::string name = fs::path(file).filename().string();
+
+        sqlite3_stmt* stmt = fileStatement(std::format("SELECT first_rowid, rows IS NOT NULL, size, mtime, hash FROM {} WHERE file = ?1 AND tbl = ?2", processedFiles), name);
+        if (sqlite3_step(stmt) != SQLITE_ROW) {
+            sqlite3_finalize(stmt);
+            return false;
+        }
+        int64_t first = sqlite3_column_int64(stmt, 0);
+        bool done = sqlite3_column_int(stmt, 1);
+        int64_t size = sqlite3_column_int64(stmt, 2), t = sqlite3_column_int64(stmt, 3);
+        std::string hash = sqlite3_column_type(stmt, 4) == SQLITE_NULL ? "" : (const char*) sqlite3_column_text(stmt, 4);
+        sqlite3_finalize(stmt);
+
+        if (done && size == (int64_t) fs::file_size(file)) {
+            int64_t now = mtime(file);
+            if (t == now) return true;
+            if (!hash.empty() && hash == contentHash(file)) {
+                execFile(std::format("UPDATE {} SET mtime = {} WHERE file = ?1 AND tbl = ?2", processedFiles, now), name);
+                return true;
+            }
+        }
+
+        std::cout << std::format("{} {}, removing its rows (and everything read after it)\n", name, done ? "changed" : "was not finished");
+        // rows still in shards would not be deleted, and would then take rowids that are handed out again
+        merge();
+        exec("BEGIN TRANSACTION");
+        for (const auto& f : truncateHooks) f(first);
+        exec(std::format("DELETE FROM {} WHERE rowid >= {}", table.name, first));
+        execBound(std::format("DELETE FROM {} WHERE tbl = ?1 AND first_rowid >= {}", processedFiles, first), {table.name});
+        exec("END TRANSACTION");
+        return false;
+    }
+
+    // lines keep says no to are skipped before they are parsed (see Reader::prefilter), nullptr to read everything
+    void setPrefilter(const std::function<bool(std::string_view)>& f) { keep = f; }
+
+    // rows f says no to are dropped after they are parsed (counted as filtered), i.e. the exact check behind a prefilter that may
+    // let a few lines too many through, nullptr to keep everything valid() keeps
+    void setFilter(const std::function<bool(const T&)>& f) { filter = f; }
+
+    // send rows to sink instead of the table (the table is still created, hooks still write to this database), nullptr for sqlite
+    // caller owns it, may be shared between databases with the same columns (i.e. comments and submissions)
+    void setSink(Sink* s) { sink = s; }
+
+    // tune rows per insert and per transaction while reading (insBuf and writeBuf of read are only the starting point)
+    // does nothing for read<InsBuf> since that fixes rows per insert
+    void setAdaptive(bool on) { adaptive = on; }
+
+    // pragmas for loading a database that can be rebuilt from the dumps anyway (a crash mid write may corrupt it)
+    // these are per connection, logs what sqlite actually chose
+    void bulkLoad(int cacheMiB = 256) {
+        exec(std::format(
+            "PRAGMA journal_mode = MEMORY; \
+            PRAGMA synchronous = OFF; \
+            PRAGMA temp_store = MEMORY; \
+            PRAGMA cache_size = -{};",
+            cacheMiB * 1024));
 
+        std::string out;
+        for (const char* p : {"journal_mode", "synchronous", "temp_store", "cache_size"}) {
+            sqlite3_stmt* stmt;
+            std::string cmd = std::format("PRAGMA {}", p);
+            tryThrowSql(sqlite3_prepare_v2(db, cmd.c_str(), cmd.size() + 1, &stmt, nullptr), "Could not create prepared statement: " + cmd);
+            if (sqlite3_step(stmt) == SQLITE_ROW) out += std::format("{}{} = {}", out.empty() ? "" : ", ", p, (const char*) sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+        }
+        std::cout << std::format("Bulk load ({}): {}", table.name, out) << std::endl;
+    }
+
+    // set may be shared between databases (i.e. comments and submissions), caller owns it
+    void setDedup(FingerprintSet* set, DedupMode mode) requires TRedditText<T> {
+        dedup = set;
+        dedupMode = set ? mode : DD_OFF;
+    }
+
+    // InsBuf fixes the number of rows per insert at compile time (overrides insBuf), so full inserts bind a constant number of rows
+    // (see bindRows)
+    // parsing and filling rows happens on this thread, inserting and transactions on the writer thread(s)
+    // row/commit hooks run on the writer thread, or on this thread when sharding (the connection is otherwise idle then)
+    template <int InsBuf = 0>
     const Reader_Output read(const std::string& file, const size_t count = 0, int writeBuf = 50000, int insBuf = 5, bool exitOnErr = true) {
+        if (append && processed(file)) {
+            Reader_Output out{};
+            out.fileName = fs::path(file).filename().string();
+            out.fileSize = fs::file_size(file);
+            out.skipped = true;
+            return out;
+        }
+
         Reader reader(file, count);
+        if (keep) reader.prefilter(keep);
+        if (append) reader.hashInput();
+        if constexpr (InsBuf != 0) insBuf = InsBuf;
 
-        if (count != 0) writeBuf = (int) std::min((size_t) writeBuf, count / 10);
+        if (count != 0) writeBuf = (int) std::max((size_t) 1, std::min((size_t) writeBuf, count / 10));
 
-        std::stringstream sbind;
-        for (int j = 0; j < insBuf; j++) {
-            sbind << "(";
-            for (int i = 0; i < (int) table.def.size() - 1; i++) sbind << "?,";
-            sbind << "?)";
-            if (j != insBuf - 1) sbind << ",";
+        int e_len = S::width != 0 ? (int) S::width : (int) table.size();
+        size_t rowsPerBatch = std::max((size_t) insBuf, (batchRows / insBuf) * insBuf);
+
+        int n = sink ? 1 : std::max(1, shards);
+        bool sharded = n > 1;
+        // every writer should be able to have one buffer queued while the reader fills another
+        int depth = std::max(queueDepth, 2 * n);
+
+        std::vector<_Batch> batches(depth);
+        for (auto& b : batches) {
+            b.values.resize(rowsPerBatch * e_len);
+            b.rows.reserve(rowsPerBatch);
         }
 
-        sqlite3_stmt* stmt;
-        std::string stmtStr = std::format("INSERT INTO {} ({}) VALUES {}", table.name, table.columns_ins(), sbind.str());
-        int ret = sqlite3_prepare_v3(db, stmtStr.c_str(), stmtStr.size() + 1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
-        tryThrowSql(ret, "Could not create prepared statement: " + stmtStr);
+        // text is bound straight from the records, so the records of a batch need to stay alive until it is written
+        // every buffer parses into its own part of the ring, so this holds whatever order the writers finish in
+        RecordRing<T> records(rowsPerBatch * depth);
+
+        BoundedQueue<int> free(depth);
+        for (int i = 0; i < depth; i++) free.push(i);
+
+        // an unsharded read lets sqlite pick rowids, which would be the ones shards that are still listed already have
+        if (!sharded) merge();
+        // rowid of the last row so far, sharded rows get explicit rowids continuing from here
+        int64_t last = lastRowid();
+        std::vector<std::unique_ptr<_Writer>> writers;
+        if (sharded) {
+            int64_t listed = scalar(std::format("SELECT count(*) FROM {}", manifest));
+            for (int k = 0; k < n; k++) {
+                auto& w = writers.emplace_back(std::make_unique<_Writer>(depth));
+                w->file = std::format("{}.{}.shard", path, listed + k);
+                w->conn = openShard(w->file);
+            }
+        } else {
+            writers.emplace_back(std::make_unique<_Writer>(depth))->conn = db;
+        }
+
+        // listed before anything is written, see processed()
+        int64_t start = last;
+        std::string name = fs::path(file).filename().string();
+        createFiles();
+        execFile(std::format("DELETE FROM {} WHERE file = ?1 AND tbl = ?2", processedFiles), name);
+        execFile(std::format("INSERT INTO {} VALUES (?1, ?2, {}, {}, NULL, NULL, {}, NULL)", processedFiles, fs::file_size(file), mtime(file), start + 1), name);
 
-        int e_len = table.def.size();
-        int e_i = 0, ins_off = 0, ins_cnt = 0;
-        size_t _count = 0;
-        std::vector<std::string> writeBuffer(insBuf * e_len, "");
+        wstats = {};
+        wstats.connections = n;
+        for (auto& w : writers) {
+            w->tune.maxIns = std::max(1, std::min((int) rowsPerBatch, sqlite3_limit(w->conn, SQLITE_LIMIT_VARIABLE_NUMBER, -1) / (e_len + 1)));
+            w->tune.ins = std::min(insBuf, w->tune.maxIns);
+            w->tune.txn = std::max((size_t) 1, (size_t) writeBuf / n);
+            w->tune.minTxn = rowsPerBatch;
+            w->tune.adaptive = adaptive && InsBuf == 0;
+        }
 
-        const char* beginTrans = "BEGIN TRANSACTION";
-        const char* endTrans = "END TRANSACTION";
+        std::exception_ptr err;
+        std::mutex errLock;
 
         exec("BEGIN TRANSACTION");
+        if (sink) sink->open(table.name, table.fields());
 
-        // note that we dont use exec(...) below for performance
-        for (const auto& j : reader.decompress<T>(writeBuf, count, exitOnErr)) {
-#ifdef BENCHMARK_ENABLED
-            auto t_process = Benchmark::timestamp();
-#endif
-            for (e_i = 0; e_i < e_len; e_i++) table.def[e_i].callback(j, writeBuffer[ins_cnt++]);
-            _count++;
-#ifdef BENCHMARK_ENABLED
-            Benchmark::sum("Process", t_process);
-#endif
-            if (_count % insBuf == 0) {
+        std::vector<std::jthread> threads;
+        for (auto& wp : writers) {
+            threads.emplace_back([&, w = wp.get()]() {
+                try {
+                    int b;
+                    while (true) {
+                        auto t_wait = Benchmark::timestamp();
+                        if (!w->filled.pop(b)) break;
+                        w->stall += Benchmark::elapsed_us(t_wait);
+
+                        write<InsBuf>(*w, batches[b], e_len);
+                        w->batches++;
+                        free.push(b);
+                    }
+                    if (sharded) run(w->conn, "END TRANSACTION");
+                } catch (...) {
+                    std::lock_guard l(errLock);
+                    if (!err) err = std::current_exception();
+                    free.close();
+                }
+                for (sqlite3_stmt* stmt : w->stmts) sqlite3_finalize(stmt);
+            });
+        }
+
+        auto acquire = [&]() {
+            int b;
+            auto t_wait = Benchmark::timestamp();
+            if (!free.pop(b)) return -1;
+            wstats.readerStall += Benchmark::elapsed_us(t_wait);
+
+            batches[b].rows.clear();
+            records.seek(b * rowsPerBatch);
+            return b;
+        };
+
+        int turn = 0;
+        size_t sinceCommit = 0;
+        auto handoff = [&](int b) {
+            batches[b].first = last + 1;
+            last += batches[b].rows.size();
+            writers[turn]->filled.push(b);
+            turn = (turn + 1) % n;
+
+            // hooks write to this connection, so it needs its own commits
+            if (sharded && (sinceCommit += batches[b].rows.size()) >= (size_t) writeBuf) {
+                preCommit();
+                sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, nullptr);
+                sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+                sinceCommit = 0;
+            }
+        };
+
+        auto stop = [&]() {
+            for (auto& w : writers) w->filled.close();
+            threads.clear();
+            for (auto& w : writers) {
+                wstats.batches += w->batches;
+                wstats.writerStall += w->stall;
+                wstats.insBuf = w->tune.ins;
+                wstats.writeBuf = w->tune.txn * n;
+                if (w->conn != db) sqlite3_close(w->conn);
+            }
+        };
+
+        int cur = acquire();
+        try {
+            for (const auto& j : reader.decompress<T>(writeBuf, count, exitOnErr, &records)) {
+                if (filter && !filter(j)) {
+                    reader.filtered();
+                    continue;
+                }
+
+                if constexpr (TRedditText<T>) {
+                    if (dedupMode != DD_OFF) {
 #ifdef BENCHMARK_ENABLED
-                auto t_sql = Benchmark::timestamp();
+                        auto t_dedup = Benchmark::timestamp();
 #endif
-                // write here instead of in above loop where we call all the callbacks so we can individually measure the performance of process v sql
-                for (e_i = 0; e_i < ins_cnt; e_i++) sqlite3_bind_text(stmt, e_i + 1, writeBuffer[e_i].c_str(), writeBuffer[e_i].size(), SQLITE_STATIC);
-
-                if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("Could not step prepared statement: " + std::string(sqlite3_errmsg(db)));
-                sqlite3_reset(stmt);
-                ins_cnt = 0;
+                        bool seen = !dedup->insert(j.text());
 #ifdef BENCHMARK_ENABLED
-                Benchmark::sum("SQL", t_sql);
+                        Benchmark::sum("Dedup", t_dedup);
 #endif
-            }
+                        if (seen) {
+                            reader.duplicate();
+                            if (dedupMode == DD_DROP) continue;
+                        }
+                    }
+                }
 
-            if (_count % writeBuf == 0) {
 #ifdef BENCHMARK_ENABLED
-                auto t_sql = Benchmark::timestamp();
+                auto t_process = Benchmark::timestamp();
 #endif
-                sqlite3_exec(db, endTrans, nullptr, nullptr, nullptr);
-                sqlite3_exec(db, beginTrans, nullptr, nullptr, nullptr);
+                _Batch& batch = batches[cur];
+                table.fill(j, &batch.values[batch.rows.size() * e_len]);
+                batch.rows.push_back(&j);
+                records.keep();
+                if (sharded) for (const auto& f : rowHooks) f(j);
 #ifdef BENCHMARK_ENABLED
-                Benchmark::sum("SQL", t_sql);
+                Benchmark::sum("Process", t_process);
 #endif
+                if (batch.rows.size() == rowsPerBatch) {
+                    handoff(cur);
+                    if ((cur = acquire()) == -1) break;
+                }
             }
+
+            if (cur != -1 && !batches[cur].rows.empty()) handoff(cur);
+        } catch (...) {
+            free.close();
+            stop();
+            throw;
         }
 
-        if (ins_cnt != 0) {
-            sqlite3_clear_bindings(stmt);
-            for (e_i = 0; e_i < ins_cnt; e_i++) sqlite3_bind_text(stmt, e_i + 1, writeBuffer[e_i].c_str(), writeBuffer[e_i].size(), SQLITE_STATIC);
-            sqlite3_step(stmt);
+        stop();
+        if (err) std::rethrow_exception(err);
+
+        if (sharded) {
+            int64_t first = last - (int64_t) std::accumulate(writers.begin(), writers.end(), (size_t) 0, [](size_t a, const auto& w) { return a + w->rows; });
+            for (const auto& w : writers) {
+                execBound(std::format("INSERT INTO {} VALUES (?1, ?2, {}, {}, {})", manifest, w->rows, first + 1, last), {w->file, table.name});
+            }
         }
 
+        Fingerprint hash = reader.inputHash();
+        execFile(std::format("UPDATE {} SET rows = {}, last_rowid = {}, hash = {} WHERE file = ?1 AND tbl = ?2",
+            processedFiles, last - start, last, hash.empty() ? "NULL" : std::format("'{}'", hashString(hash))), name);
+
+        preCommit();
+        if (sink) sink->flush();
         exec("END TRANSACTION");
-        exec("PRAGMA optimize");
 
-        ret = sqlite3_finalize(stmt);
-        tryThrowSql(ret, "Could not close prepared statement");
+        if (sharded && mergeShards) merge();
+        exec("PRAGMA optimize");
 
         reader.print_end();
+        std::cout << std::format("Writer: {} batches over {} connections, reader waited {:.0f} ms, writers waited {:.0f} ms\n",
+            wstats.batches, wstats.connections, wstats.readerStall / 1000.0, wstats.writerStall / 1000.0);
+        std::cout << std::format("Writer: {} rows per insert, {} rows per transaction{}\n", wstats.insBuf, wstats.writeBuf, adaptive && InsBuf == 0 ? " (adaptive)" : "");
 
         return reader.status();
     }
@@ -0,0 +1,246 @@
+#ifndef CMSC_DEDUP_HPP
+#define CMSC_DEDUP_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <format>
+
+// 64x64 -> 128 multiply, gcc/mingw only (__extension__ keeps -pedantic quiet)
+__extension__ typedef unsigned __int128 _u128;
+
+struct Fingerprint {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const Fingerprint&) const = default;
+    bool empty() const { return lo == 0 && hi == 0; }
+};
+
+// two lane multiply-xor hash (same idea as wyhash), not cryptographic but we only need to catch copy pasted bodies
+// 128 bits so that we can treat a match in the exact set as an actual duplicate
+inline Fingerprint fingerprint(std::string_view str) {
+    constexpr uint64_t k0 = 0xa0761d6478bd642full, k1 = 0xe7037ed1a0b428dbull, k2 = 0x8ebc6af09c88c6e3ull, k3 = 0x589965cc75374cc3ull;
+    auto mix = [](uint64_t a, uint64_t b) { _u128 r = (_u128) a * b; return (uint64_t) r ^ (uint64_t) (r >> 64); };
+
+    const char* p = str.data();
+    size_t n = str.size();
+    uint64_t a = k0 ^ n, b = k1 ^ (n * k2);
+    uint64_t x, y;
+
+    for (; n >= 16; n -= 16, p += 16) {
+        memcpy(&x, p, 8);
+        memcpy(&y, p + 8, 8);
+        a = mix(a ^ x, k1 ^ y);
+        b = mix(b ^ y, k3 ^ x) + a;
+    }
+
+    x = 0; y = 0;
+    if (n > 8) {
+        memcpy(&x, p, 8);
+        memcpy(&y, p + 8, n - 8);
+    } else memcpy(&x, p, n);
+    a = mix(a ^ x, k1 ^ y ^ n);
+    b = mix(b ^ y, k3 ^ x) + a;
+
+    Fingerprint f{ mix(a ^ k0, b ^ k3), mix(b ^ k2, a ^ k1) };
+    if (f.empty()) f.lo = 1; // 0 is reserved for empty slots
+    return f;
+}
+
+// content hash of a byte stream fed in chunks, each chunk fingerprinted and chained onto the hash so far
+// the same bytes in different chunk sizes hash differently, so whoever compares two of these has to use the same chunks
+class ChainedFingerprint {
+private:
+    Fingerprint h{};
+public:
+    void add(std::string_view chunk) {
+        Fingerprint c = fingerprint(chunk);
+        uint64_t chain[4] = {h.lo, h.hi, c.lo, c.hi};
+        h = fingerprint(std::string_view((const char*) chain, sizeof(chain)));
+    }
+
+    Fingerprint value() const { return h; }
+};
+
+// content hash of a whole file in chunk byte chunks, used to recognize input files that were already read
+inline Fingerprint fileFingerprint(const std::string& file, size_t chunk = (size_t) 1 << 20) {
+    std::ifstream f(file, std::ios::binary);
+    if (!f) throw std::runtime_error("(dedup.hpp) Unable to open " + file);
+
+    std::string buf(chunk, '\0');
+    ChainedFingerprint h;
+    while (f.read(buf.data(), buf.size()) || f.gcount() > 0) h.add(std::string_view(buf.data(), f.gcount()));
+    return h.value();
+}
+
+// approximate set used once the exact set would go over the memory cap
+// https://www.cs.cmu.edu/~dga/papers/cuckoo-conext2014.pdf
+// 4 x 32 bit tags per bucket, so false positive rate is around 8 / 2^32 per lookup
+class CuckooFilter {
+private:
+    static constexpr int slots = 4;
+    static constexpr int maxKicks = 500;
+
+    std::vector<uint32_t> table;
+    size_t mask;
+    uint32_t stash = 0;
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+    size_t alt(size_t i, uint32_t tag) const { return (i ^ ((size_t) tag * 0x5bd1e995)) & mask; }
+
+    bool has(size_t b, uint32_t tag) const {
+        const uint32_t* s = &table[b * slots];
+        return s[0] == tag || s[1] == tag || s[2] == tag || s[3] == tag;
+    }
+
+    bool put(size_t b, uint32_t tag) {
+        uint32_t* s = &table[b * slots];
+        for (int i = 0; i < slots; i++) {
+            if (s[i] == 0) {
+                s[i] = tag;
+                return true;
+            }
+        }
+
+        return false;
+    }
+public:
+    // buckets should be a power of 2
+    CuckooFilter(size_t buckets) : table(buckets * slots, 0), mask(buckets - 1) {}
+
+    bool contains(const Fingerprint& f) const {
+        uint32_t tag = (uint32_t) f.hi | 1;
+        size_t i1 = f.lo & mask;
+        return has(i1, tag) || has(alt(i1, tag), tag) || stash == tag;
+    }
+
+    // false if the filter is full (entry is dropped)
+    bool insert(const Fingerprint& f) {
+        uint32_t tag = (uint32_t) f.hi | 1;
+        size_t i = f.lo & mask;
+        if (put(i, tag) || put(alt(i, tag), tag)) return true;
+        if (stash != 0) return false;
+
+        for (int k = 0; k < maxKicks; k++) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            std::swap(tag, table[i * slots + (rng % slots)]);
+            i = alt(i, tag);
+            if (put(i, tag)) return true;
+        }
+
+        stash = tag;
+        return true;
+    }
+
+    size_t bytes() const { return table.size() * sizeof(uint32_t); }
+};
+
+// set of body fingerprints, exact (open addressing, linear probing) until it would pass maxBytes
+// after that an approximate set moves everything into a cuckoo filter of roughly maxBytes, which can take a new body for a
+// duplicate (fine for counting, not for dropping), an exact one stops taking new fingerprints instead: later bodies are still
+// checked against the ones it has, so a duplicate of those is still caught, but a duplicate of a later body is not
+class FingerprintSet {
+private:
+    std::vector<Fingerprint> table;
+    size_t mask;
+    size_t maxBytes;
+    bool approximate;
+    bool full = false;
+    size_t count = 0;
+    size_t overflow = 0;
+
+    CuckooFilter* filter = nullptr;
+
+    FingerprintSet(const FingerprintSet&) = delete;
+    FingerprintSet& operator=(const FingerprintSet&) = delete;
+
+    bool place(std::vector<Fingerprint>& t, size_t m, const Fingerprint& f) const {
+        for (size_t i = f.lo & m;; i = (i + 1) & m) {
+            if (t[i].empty()) {
+                t[i] = f;
+                return true;
+            }
+            if (t[i] == f) return false;
+        }
+    }
+
+    // the table is never full (see grow), so this ends on an empty slot
+    bool has(const Fingerprint& f) const {
+        for (size_t i = f.lo & mask; !table[i].empty(); i = (i + 1) & mask) if (table[i] == f) return true;
+        return false;
+    }
+
+    void grow() {
+        size_t n = table.size() * 2;
+        if (n * sizeof(Fingerprint) > maxBytes && !approximate) {
+            std::cout << std::format("\n(dedup.hpp) {} fingerprints fill the memory cap of {} bytes, later bodies are only checked against these\n", count, maxBytes);
+            full = true;
+            return;
+        }
+        if (n * sizeof(Fingerprint) > maxBytes) {
+            size_t buckets = 1;
+            while (buckets * 2 * 4 * sizeof(uint32_t) <= maxBytes) buckets *= 2;
+
+            std::cout << std::format("\n(dedup.hpp) {} fingerprints exceeds memory cap of {} bytes, switching to cuckoo filter\n", count, maxBytes);
+            filter = new CuckooFilter(buckets);
+            for (const auto& f : table) if (!f.empty()) filter->insert(f);
+
+            std::vector<Fingerprint>().swap(table);
+            return;
+        }
+
+        std::vector<Fingerprint> t(n);
+        for (const auto& f : table) if (!f.empty()) place(t, n - 1, f);
+        table.swap(t);
+        mask = n - 1;
+    }
+public:
+    // the first table is at most maxBytes (but at least 4 slots, so one is still empty when it can not grow)
+    FingerprintSet(size_t maxBytes = (size_t) 1 << 30, bool approximate = true) : maxBytes(maxBytes), approximate(approximate) {
+        size_t n = 4;
+        while (n < ((size_t) 1 << 16) && n * 2 * sizeof(Fingerprint) <= maxBytes) n *= 2;
+        table.resize(n);
+        mask = n - 1;
+    }
+    ~FingerprintSet() { delete filter; }
+
+    // true if f was not in the set before
+    bool insert(const Fingerprint& f) {
+        if (filter) {
+            if (filter->contains(f)) return false;
+            if (!filter->insert(f)) overflow++;
+            count++;
+            return true;
+        }
+
+        if (full) {
+            if (has(f)) return false;
+            overflow++;
+            count++;
+            return true;
+        }
+
+        if (!place(table, mask, f)) return false;
+        // keep load under 0.7
+        if (++count * 10 > table.size() * 7) grow();
+        return true;
+    }
+
+    bool insert(std::string_view str) { return insert(fingerprint(str)); }
+
+    bool exact() const { return filter == nullptr; }
+    size_t size() const { return count; }
+    // fingerprints that were not kept (full cuckoo filter, or a full exact set)
+    size_t dropped() const { return overflow; }
+    size_t bytes() const { return filter ? filter->bytes() : table.size() * sizeof(Fingerprint); }
+};
+
+enum DedupMode { DD_OFF, DD_COUNT, DD_DROP };
+
+#endif
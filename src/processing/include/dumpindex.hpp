@@ -0,0 +1,342 @@
+#ifndef CMSC_DUMPINDEX_HPP
+#define CMSC_DUMPINDEX_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <format>
+
+#include <zstd.h>
+
+#include "graph.hpp"
+#include "mapped.hpp"
+#include "timing.hpp"
+
+// where every row of a zstd dump is, so a few thousand rows can be pulled out without reading the whole file
+// a row is its key (i.e. packed id, see packId) and the offset of its line in the decompressed stream, and a checkpoint is a place
+// decompression can start over from: the start of every zstd frame (compressed offset, decompressed offset)
+// the monthly dumps are one frame, and zstd can not pick up in the middle of one (it would need the window, up to 2 GiB), so there
+// fetch still decompresses from the start up to the last row it wants (without parsing anything), reencode the dump into small
+// frames once for actual seeks
+//
+// layout, sections are 64 byte aligned and mapped as arrays
+// header | rows {key int64, offset uint64}[rows] sorted by key | checkpoints {in uint64, out uint64}[checkpoints] sorted
+struct DumpIndexHeader {
+    char magic[8] = {'C', 'M', 'S', 'C', 'I', 'D', 'X', '1'};
+    uint32_t version = 1;
+    uint32_t _pad = 0;
+    uint64_t rows = 0;
+    uint64_t checkpoints = 0;
+    uint64_t rowsAt = 0;
+    uint64_t checkpointsAt = 0;
+    // of the dump, to catch an index used with another file
+    uint64_t sourceSize = 0;
+};
+
+struct DumpIndex_Output {
+    size_t rows = 0;
+    size_t checkpoints = 0;
+    // same as ReplyGraph_Output
+    size_t runs = 0;
+    size_t spilled = 0;
+    // lines without a key (see build)
+    size_t skipped = 0;
+};
+
+class DumpIndex {
+public:
+    struct Row {
+        int64_t key;
+        uint64_t offset;
+    };
+
+    struct Checkpoint {
+        uint64_t in;
+        uint64_t out;
+    };
+private:
+    struct _RowLess { bool operator()(const Row& a, const Row& b) const { return a.key != b.key ? a.key < b.key : a.offset < b.offset; } };
+
+    static int seek(FILE* f, uint64_t at) {
+#ifdef _WIN32
+        return _fseeki64(f, (int64_t) at, SEEK_SET);
+#else
+        return fseeko(f, (off_t) at, SEEK_SET);
+#endif
+    }
+
+    static ZSTD_DCtx* decoder() {
+        ZSTD_DCtx* d = ZSTD_createDCtx();
+        // the dumps are written with --long=31
+        ZSTD_DCtx_setParameter(d, ZSTD_d_windowLogMax, 31);
+        return d;
+    }
+
+    // forward only decompression from a checkpoint, at is the decompressed offset of out[pos]
+    struct _Cursor {
+        FILE* f;
+        ZSTD_DCtx* dctx;
+        std::vector<char> in;
+        std::vector<char> out;
+        ZSTD_inBuffer input{};
+        size_t pos = 0;
+        size_t size = 0;
+        uint64_t at = 0;
+
+        _Cursor(const std::string& file) : in(ZSTD_DStreamInSize()), out(ZSTD_DStreamOutSize()) {
+            f = fopen(file.c_str(), "rb");
+            if (!f) throw std::runtime_error("(dumpindex.hpp) Unable to open " + file);
+            dctx = decoder();
+        }
+
+        ~_Cursor() {
+            fclose(f);
+            ZSTD_freeDCtx(dctx);
+        }
+
+        bool fill() {
+            while (true) {
+                if (input.pos == input.size) {
+                    size_t r = fread(in.data(), 1, in.size(), f);
+                    if (!r) return false;
+                    input = {in.data(), r, 0};
+                }
+                ZSTD_outBuffer o = {out.data(), out.size(), 0};
+                size_t ret = ZSTD_decompressStream(dctx, &o, &input);
+                if (ZSTD_isError(ret)) throw std::runtime_error(std::string("(dumpindex.hpp) Unable to decompress: ") + ZSTD_getErrorName(ret));
+                if (o.pos) {
+                    pos = 0;
+                    size = o.pos;
+                    return true;
+                }
+            }
+        }
+
+        void restart(const Checkpoint& c) {
+            if (seek(f, c.in) != 0) throw std::runtime_error("(dumpindex.hpp) Unable to seek");
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+            input = {in.data(), 0, 0};
+            pos = size = 0;
+            at = c.out;
+        }
+
+        bool skipTo(uint64_t target) {
+            while (at + (size - pos) <= target) {
+                at += size - pos;
+                pos = size;
+                if (!fill()) return false;
+            }
+            pos += target - at;
+            at = target;
+            return true;
+        }
+
+        // the line starting here, without its newline
+        bool line(std::string& s) {
+            s.clear();
+            while (true) {
+                if (pos == size && !fill()) return !s.empty();
+                const char* b = out.data() + pos;
+                const char* nl = (const char*) memchr(b, '\n', size - pos);
+                size_t n = nl ? nl - b : size - pos;
+                s.append(b, n);
+                pos += n;
+                at += n;
+                if (nl) {
+                    pos++;
+                    at++;
+                    return true;
+                }
+            }
+        }
+    };
+
+    MappedFile file;
+    DumpIndexHeader h;
+    const Row* rows_ = nullptr;
+    const Checkpoint* checkpoints_ = nullptr;
+
+    DumpIndex(const DumpIndex&) = delete;
+    DumpIndex& operator=(const DumpIndex&) = delete;
+public:
+    // one pass over dump, key(line) is the key of a line (0 to leave it out), rows with the same key keep the first line
+    // memory stays around maxBytes, the rows are sorted through runs next to path past that
+    static DumpIndex_Output build(const std::string& dump, const std::string& path, const std::function<int64_t(std::string_view)>& key,
+        size_t maxBytes = (size_t) 256 << 20) {
+        DumpIndex_Output r{};
+        graph::SpillSort<Row, _RowLess> sorted(path, maxBytes);
+        std::vector<Checkpoint> checkpoints = {{0, 0}};
+
+        uint64_t size = std::filesystem::file_size(dump);
+        _Cursor c(dump);
+        uint64_t inBase = 0, outBase = 0, start = 0;
+        std::string buf;
+
+        auto push = [&](std::string_view line) {
+            int64_t k = key(line);
+            if (k) sorted.push({k, start});
+            else r.skipped++;
+        };
+
+        size_t read;
+        while ((read = fread(c.in.data(), 1, c.in.size(), c.f))) {
+            ZSTD_inBuffer input = {c.in.data(), read, 0};
+            while (input.pos < input.size) {
+                ZSTD_outBuffer o = {c.out.data(), c.out.size(), 0};
+                size_t ret = ZSTD_decompressStream(c.dctx, &o, &input);
+                if (ZSTD_isError(ret)) throw std::runtime_error(std::string("(dumpindex.hpp) Unable to decompress ") + dump + ": " + ZSTD_getErrorName(ret));
+
+                const char* out = c.out.data();
+                size_t base = 0;
+                for (const char* nl; base < o.pos && (nl = (const char*) memchr(out + base, '\n', o.pos - base));) {
+                    size_t i = nl - out;
+                    if (!buf.empty()) {
+                        buf.append(out + base, i - base);
+                        push(buf);
+                        buf.clear();
+                    } else push(std::string_view(out + base, i - base));
+                    base = i + 1;
+                    start = outBase + base;
+                }
+                buf.append(out + base, o.pos - base);
+                outBase += o.pos;
+
+                // a frame just ended, the next one (if any) starts right here
+                if (ret == 0 && inBase + input.pos < size) checkpoints.push_back({inBase + input.pos, outBase});
+            }
+            inBase += read;
+        }
+        if (!buf.empty()) push(buf);
+
+        // write the rows first, their count is only known after the merge
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!f) throw std::runtime_error("(dumpindex.hpp) Unable to open " + path);
+        DumpIndexHeader h;
+        h.sourceSize = size;
+        h.rowsAt = graph::align(sizeof(h));
+        f.seekp(h.rowsAt);
+
+        sorted.start();
+        std::vector<Row> out;
+        out.reserve(1 << 14);
+        Row row, prev{0, 0};
+        while (sorted.next(row)) {
+            if (h.rows && row.key == prev.key) continue;
+            prev = row;
+            h.rows++;
+            out.push_back(row);
+            if (out.size() == out.capacity()) {
+                f.write((const char*) out.data(), out.size() * sizeof(Row));
+                out.clear();
+            }
+        }
+        f.write((const char*) out.data(), out.size() * sizeof(Row));
+
+        h.checkpoints = checkpoints.size();
+        h.checkpointsAt = graph::align(h.rowsAt + h.rows * sizeof(Row));
+        f.seekp(h.checkpointsAt);
+        f.write((const char*) checkpoints.data(), checkpoints.size() * sizeof(Checkpoint));
+        f.seekp(0);
+        f.write((const char*) &h, sizeof(h));
+        if (!f) throw std::runtime_error("(dumpindex.hpp) Unable to write " + path);
+
+        r.rows = h.rows;
+        r.checkpoints = h.checkpoints;
+        r.runs = sorted.spilledRuns();
+        r.spilled = sorted.spilledBytes();
+        return r;
+    }
+
+    // copy of dump as independent frames of about frameBytes (cut at line ends), still a normal zstd file for Reader
+    // returns the number of frames
+    static size_t reencode(const std::string& dump, const std::string& out, size_t frameBytes = (size_t) 4 << 20, int level = 3) {
+        _Cursor c(dump);
+        std::ofstream f(out, std::ios::binary);
+        if (!f) throw std::runtime_error("(dumpindex.hpp) Unable to open " + out);
+
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+        std::string pending, packed;
+        size_t frames = 0;
+        auto frame = [&](size_t n) {
+            packed.resize(ZSTD_compressBound(n));
+            size_t w = ZSTD_compress2(cctx, packed.data(), packed.size(), pending.data(), n);
+            if (ZSTD_isError(w)) throw std::runtime_error(std::string("(dumpindex.hpp) Unable to compress: ") + ZSTD_getErrorName(w));
+            f.write(packed.data(), w);
+            pending.erase(0, n);
+            frames++;
+        };
+
+        while (c.fill()) {
+            pending.append(c.out.data(), c.size);
+            if (pending.size() < frameBytes) continue;
+            size_t end = pending.rfind('\n');
+            // one line longer than a frame just makes a bigger frame
+            if (end != std::string::npos) frame(end + 1);
+        }
+        if (!pending.empty()) frame(pending.size());
+
+        ZSTD_freeCCtx(cctx);
+        if (!f) throw std::runtime_error("(dumpindex.hpp) Unable to write " + out);
+        return frames;
+    }
+
+    DumpIndex(const std::string& path) : file(path, "dumpindex.hpp") {
+        if (file.size() < sizeof(h)) throw std::runtime_error("(dumpindex.hpp) Not a dump index: " + path);
+        memcpy(&h, file.data(), sizeof(h));
+        if (memcmp(h.magic, DumpIndexHeader().magic, sizeof(h.magic)) != 0 || file.size() < h.checkpointsAt + h.checkpoints * sizeof(Checkpoint))
+            throw std::runtime_error("(dumpindex.hpp) Not a dump index: " + path);
+
+        rows_ = (const Row*) (file.data() + h.rowsAt);
+        checkpoints_ = (const Checkpoint*) (file.data() + h.checkpointsAt);
+    }
+
+    size_t rows() const { return h.rows; }
+    size_t checkpoints() const { return h.checkpoints; }
+
+    // decompressed offset of the line of key, -1 if it is not in the dump
+    int64_t find(int64_t key) const {
+        const Row* it = std::lower_bound(rows_, rows_ + h.rows, key, [](const Row& r, int64_t k) { return r.key < k; });
+        return it != rows_ + h.rows && it->key == key ? (int64_t) it->offset : -1;
+    }
+
+    // fn(key, line) for every key found in dump (in file order, not the order of keys), returns how many were found
+    // lines are read in file order, restarting at the checkpoint before a line whenever that is past where the last one ended
+    size_t fetch(const std::string& dump, const std::vector<int64_t>& keys, const std::function<void(int64_t, std::string_view)>& fn) const {
+        if (std::filesystem::file_size(dump) != h.sourceSize) throw std::runtime_error("(dumpindex.hpp) " + dump + " is not the file this index was built from");
+
+        std::vector<Row> wanted;
+        for (int64_t k : keys) {
+            int64_t at = find(k);
+            if (at != -1) wanted.push_back({k, (uint64_t) at});
+        }
+        std::sort(wanted.begin(), wanted.end(), [](const Row& a, const Row& b) { return a.offset < b.offset; });
+        wanted.erase(std::unique(wanted.begin(), wanted.end(), [](const Row& a, const Row& b) { return a.offset == b.offset; }), wanted.end());
+
+        _Cursor c(dump);
+        bool started = false;
+        std::string line;
+        for (const Row& w : wanted) {
+            const Checkpoint* cp = std::upper_bound(checkpoints_, checkpoints_ + h.checkpoints, w.offset, [](uint64_t v, const Checkpoint& p) { return v < p.out; }) - 1;
+            if (!started || cp->out > c.at) {
+                c.restart(*cp);
+                started = true;
+            }
+            if (!c.skipTo(w.offset) || !c.line(line)) throw std::runtime_error("(dumpindex.hpp) " + dump + " ended before a row of its index");
+            fn(w.key, line);
+        }
+        return wanted.size();
+    }
+};
+
+#endif
@@ -0,0 +1,399 @@
+#ifndef CMSC_GRAPH_HPP
+#define CMSC_GRAPH_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <format>
+
+#include "timing.hpp"
+#include "mapped.hpp"
+
+// reply graph of a month as CSR (compressed sparse row), nodes are every id seen (as a row or as a parent) in packed id order
+// so node i is dense index i, and the children of i are children[offsets[i] .. offsets[i + 1]] (dense indices again)
+// flags are the distinguished value of the author (see DistinguishedEnum), 0 for ids that were only seen as a parent
+//
+// layout, every section is 64 byte aligned so a reader can mmap the file and use the sections as arrays directly
+// header | ids int64[nodes] | flags uint8[nodes] | offsets uint64[nodes + 1] | children uint32[edges]
+struct ReplyGraphHeader {
+    char magic[8] = {'C', 'M', 'S', 'C', 'R', 'G', 'R', '1'};
+    uint32_t version = 1;
+    uint32_t _pad = 0;
+    uint64_t nodes = 0;
+    uint64_t edges = 0;
+    uint64_t ids = 0;
+    uint64_t flags = 0;
+    uint64_t offsets = 0;
+    uint64_t children = 0;
+};
+
+struct ReplyGraph_Output {
+    size_t nodes = 0;
+    size_t edges = 0;
+    // sorted runs written to disk because the buffers were full (0 if everything fit in memory)
+    size_t runs = 0;
+    size_t spilled = 0;
+};
+
+namespace graph {
+    inline uint64_t align(uint64_t n) { return (n + 63) & ~(uint64_t) 63; }
+
+    // sorts everything pushed into it, buffers up to cap records and spills sorted runs next to prefix once full
+    // then merges the runs (and what is still buffered) back in order, memory is cap records + a small buffer per run
+    template <typename R, typename Less>
+    class SpillSort {
+    private:
+        struct _Run {
+            std::ifstream f;
+            std::vector<R> buf;
+            size_t at = 0;
+
+            bool fill() {
+                if (!f.is_open()) return false;
+                buf.resize(1 << 14);
+                f.read((char*) buf.data(), buf.size() * sizeof(R));
+                buf.resize(f.gcount() / sizeof(R));
+                at = 0;
+                return !buf.empty();
+            }
+        };
+
+        std::string prefix;
+        size_t cap;
+        std::vector<R> buf;
+        std::vector<std::string> runs;
+        size_t bytes = 0;
+
+        // the buffer is the last run, so it does not need to be written
+        std::vector<_Run> in;
+        std::vector<size_t> heap;
+
+        void spill() {
+            std::sort(buf.begin(), buf.end(), Less());
+            std::string file = std::format("{}.{}.run", prefix, runs.size());
+            std::ofstream f(file, std::ios::binary);
+            if (!f) throw std::runtime_error("(graph.hpp) Unable to open " + file);
+            f.write((const char*) buf.data(), buf.size() * sizeof(R));
+            if (!f) throw std::runtime_error("(graph.hpp) Unable to write " + file);
+
+            runs.push_back(file);
+            bytes += buf.size() * sizeof(R);
+            buf.clear();
+        }
+
+        const R& head(size_t i) const { return in[i].buf[in[i].at]; }
+        bool after(size_t a, size_t b) const { return Less()(head(b), head(a)); }
+    public:
+        SpillSort(const std::string& prefix, size_t maxBytes) : prefix(prefix), cap(std::max((size_t) 1024, maxBytes / sizeof(R))) {}
+
+        ~SpillSort() {
+            in.clear();
+            for (const auto& r : runs) std::filesystem::remove(r);
+        }
+
+        SpillSort(const SpillSort&) = delete;
+        SpillSort& operator=(const SpillSort&) = delete;
+
+        void push(const R& r) {
+            // reserved once, so the buffer never grows past cap by doubling (pages are only touched as it fills)
+            if (buf.capacity() < cap) buf.reserve(cap);
+            if (buf.size() == cap) spill();
+            buf.push_back(r);
+        }
+
+        size_t spilledRuns() const { return runs.size(); }
+        // held in memory right now, the buffer (which start() moves in as the last run) and the read buffers of the runs
+        size_t memoryBytes() const {
+            size_t n = buf.size();
+            for (const auto& r : in) n += r.buf.size();
+            return n * sizeof(R);
+        }
+        size_t spilledBytes() const { return bytes; }
+
+        // done pushing, next then gives back every record once in order
+        void start() {
+            // once there are runs the buffer is one more, so merging only holds the small read buffers
+            if (!runs.empty() && !buf.empty()) {
+                spill();
+                buf = {};
+            }
+            std::sort(buf.begin(), buf.end(), Less());
+            in = std::vector<_Run>(runs.size() + 1);
+            for (size_t i = 0; i < runs.size(); i++) {
+                in[i].f.open(runs[i], std::ios::binary);
+                if (!in[i].f) throw std::runtime_error("(graph.hpp) Unable to open " + runs[i]);
+                in[i].fill();
+            }
+            in.back().buf = std::move(buf);
+
+            auto cmp = [this](size_t a, size_t b) { return after(a, b); };
+            heap.clear();
+            for (size_t i = 0; i < in.size(); i++) if (!in[i].buf.empty()) heap.push_back(i);
+            std::make_heap(heap.begin(), heap.end(), cmp);
+        }
+
+        bool next(R& out) {
+            if (heap.empty()) return false;
+
+            auto cmp = [this](size_t a, size_t b) { return after(a, b); };
+            std::pop_heap(heap.begin(), heap.end(), cmp);
+            size_t i = heap.back();
+            out = head(i);
+
+            _Run& r = in[i];
+            if (++r.at < r.buf.size() || r.fill()) std::push_heap(heap.begin(), heap.end(), cmp);
+            else heap.pop_back();
+            return true;
+        }
+    };
+}
+
+// builds a reply graph file with bounded memory, push every row (comments with their parent, submissions without one)
+// ids are packed (see packId), anything pushed twice keeps its first parent and flags
+// all of it goes through sorted runs: rows by id (to number them), parents by id (parents that are not rows are nodes too)
+// and edges by parent (for the CSR), so 16M+ comments a month only need maxBytes of memory and sequential disk io
+class ReplyGraphWriter {
+private:
+    struct _Row {
+        int64_t id;
+        int64_t parent;
+        uint8_t flags;
+    };
+
+    struct _Edge {
+        int64_t parent;
+        uint32_t child;
+    };
+
+    struct _RowLess { bool operator()(const _Row& a, const _Row& b) const { return a.id < b.id; } };
+    struct _IdLess { bool operator()(int64_t a, int64_t b) const { return a < b; } };
+    struct _EdgeLess { bool operator()(const _Edge& a, const _Edge& b) const { return a.parent != b.parent ? a.parent < b.parent : a.child < b.child; } };
+
+    std::string path;
+    size_t maxBytes;
+
+    graph::SpillSort<_Row, _RowLess> rows;
+    graph::SpillSort<int64_t, _IdLess> parents;
+
+    ReplyGraph_Output stats{};
+
+    ReplyGraphWriter(const ReplyGraphWriter&) = delete;
+    ReplyGraphWriter& operator=(const ReplyGraphWriter&) = delete;
+
+    // buffered sequential writes to one section of the output file
+    struct _Section {
+        std::fstream& f;
+        uint64_t pos;
+        std::vector<char> buf;
+
+        _Section(std::fstream& f, uint64_t pos) : f(f), pos(pos) { buf.reserve(1 << 20); }
+
+        template <typename V>
+        void put(const V& v) {
+            if (buf.size() + sizeof(V) > buf.capacity()) flush();
+            buf.insert(buf.end(), (const char*) &v, (const char*) &v + sizeof(V));
+        }
+
+        void flush() {
+            if (buf.empty()) return;
+            f.seekp(pos);
+            f.write(buf.data(), buf.size());
+            if (!f) throw std::runtime_error("(graph.hpp) Unable to write reply graph");
+            pos += buf.size();
+            buf.clear();
+        }
+    };
+public:
+    // runs are written next to path and removed once it is done, the two row buffers share maxBytes
+    // the edge buffer gets what they leave of it (at least maxBytes / 8), since they stay in memory while it fills (see finish)
+    ReplyGraphWriter(const std::string& path, size_t maxBytes = (size_t) 256 << 20)
+        : path(path), maxBytes(maxBytes), rows(path + ".rows", maxBytes * 3 / 4), parents(path + ".parents", maxBytes / 4) {}
+
+    // parent is 0 for rows without one (submissions)
+    void push(int64_t id, int64_t parent, uint8_t flags) {
+        if (id == 0) return;
+        rows.push({id, parent, flags});
+        if (parent != 0) parents.push(parent);
+    }
+
+    const ReplyGraph_Output& finish() {
+#ifdef BENCHMARK_ENABLED
+        auto t_nodes = Benchmark::timestamp();
+#endif
+        std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+        if (!f) throw std::runtime_error("(graph.hpp) Unable to open " + path);
+
+        ReplyGraphHeader h;
+        h.ids = graph::align(sizeof(ReplyGraphHeader));
+
+        // number the nodes, union of rows and parents in id order, flags go to a temporary file until the node count is known
+        std::string flagFile = path + ".flags";
+        std::ofstream flagOut(flagFile, std::ios::binary);
+        if (!flagOut) throw std::runtime_error("(graph.hpp) Unable to open " + flagFile);
+
+        _Section ids(f, h.ids);
+        std::vector<uint8_t> flagBuf;
+        int64_t last = 0;
+        uint32_t n = 0;
+
+        // false if id is already a node (sorted, so that is only ever the last one)
+        auto node = [&](int64_t id, uint8_t flags) {
+            if (n != 0 && id == last) return false;
+            if (n == UINT32_MAX) throw std::runtime_error("(graph.hpp) Too many nodes for a reply graph");
+
+            ids.put(id);
+            flagBuf.push_back(flags);
+            if (flagBuf.size() == (1 << 20)) {
+                flagOut.write((const char*) flagBuf.data(), flagBuf.size());
+                flagBuf.clear();
+            }
+            last = id;
+            n++;
+            return true;
+        };
+
+        // rows and parents are both sorted by id, rows go first on a tie so a parent that is also a row keeps its flags
+        rows.start();
+        parents.start();
+        // rows and parents keep what they buffered until they are drained, so edges only gets the rest of maxBytes
+        // (at least an eighth of it, so the edges of a month that just fit in the row buffers are not spilled in tiny runs)
+        size_t used = rows.memoryBytes() + parents.memoryBytes();
+        graph::SpillSort<_Edge, _EdgeLess> edges(path + ".edges", std::max(maxBytes / 8, maxBytes > used ? maxBytes - used : 0));
+        _Row r;
+        int64_t p;
+        bool hasRow = rows.next(r), hasParent = parents.next(p);
+        while (hasRow || hasParent) {
+            if (hasParent && (!hasRow || p < r.id)) {
+                node(p, 0);
+                hasParent = parents.next(p);
+            } else {
+                if (node(r.id, r.flags) && r.parent != 0) {
+                    edges.push({r.parent, n - 1});
+                    stats.edges++;
+                }
+                hasRow = rows.next(r);
+            }
+        }
+
+        ids.flush();
+        f.flush();
+        flagOut.write((const char*) flagBuf.data(), flagBuf.size());
+        flagOut.close();
+
+        h.nodes = n;
+        h.edges = stats.edges;
+        h.flags = graph::align(h.ids + h.nodes * sizeof(int64_t));
+        h.offsets = graph::align(h.flags + h.nodes);
+        h.children = graph::align(h.offsets + (h.nodes + 1) * sizeof(uint64_t));
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Graph nodes", t_nodes);
+        auto t_edges = Benchmark::timestamp();
+#endif
+
+        // edges come out by parent, walk the ids (in the same order) next to them to find the parent index
+        std::ifstream idIn(path, std::ios::binary);
+        idIn.seekg(h.ids);
+        _Section offsets(f, h.offsets), children(f, h.children);
+        uint64_t at = 0, written = 0, k = 0;
+        int64_t curId;
+        idIn.read((char*) &curId, sizeof(curId));
+
+        edges.start();
+        _Edge e;
+        while (edges.next(e)) {
+            while (curId != e.parent) {
+                if (++k == h.nodes) throw std::runtime_error("(graph.hpp) Reply graph parent is not a node");
+                idIn.read((char*) &curId, sizeof(curId));
+            }
+            for (; written <= k; written++) offsets.put(at);
+            children.put(e.child);
+            at++;
+        }
+        for (; written <= h.nodes; written++) offsets.put(at);
+        offsets.flush();
+        children.flush();
+
+        std::ifstream flagIn(flagFile, std::ios::binary);
+        std::vector<char> tmp(1 << 20);
+        f.seekp(h.flags);
+        while (flagIn.read(tmp.data(), tmp.size()) || flagIn.gcount()) f.write(tmp.data(), flagIn.gcount());
+        flagIn.close();
+        std::filesystem::remove(flagFile);
+
+        // pad the end so the last section is whole
+        f.seekp(0, std::ios::end);
+        std::string pad(graph::align(f.tellp()) - (uint64_t) f.tellp(), '\0');
+        f.write(pad.data(), pad.size());
+        f.seekp(0);
+        f.write((const char*) &h, sizeof(h));
+        if (!f) throw std::runtime_error("(graph.hpp) Unable to write " + path);
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Graph edges", t_edges);
+#endif
+
+        stats.nodes = h.nodes;
+        stats.runs = rows.spilledRuns() + parents.spilledRuns() + edges.spilledRuns();
+        stats.spilled = rows.spilledBytes() + parents.spilledBytes() + edges.spilledBytes();
+        return stats;
+    }
+};
+
+// memory maps a file written by ReplyGraphWriter, everything is an array so queries are scans over them
+// i.e. mod replies to users: every node with flags D_USER, then its children with flags D_MOD (see count)
+class ReplyGraph {
+private:
+    MappedFile file;
+
+    ReplyGraphHeader h;
+    const int64_t* ids_ = nullptr;
+    const uint8_t* flags_ = nullptr;
+    const uint64_t* offsets_ = nullptr;
+    const uint32_t* children_ = nullptr;
+
+    ReplyGraph(const ReplyGraph&) = delete;
+    ReplyGraph& operator=(const ReplyGraph&) = delete;
+public:
+    ReplyGraph(const std::string& path) : file(path, "graph.hpp") {
+        const uint8_t* base = file.data();
+        if (file.size() < sizeof(h)) throw std::runtime_error("(graph.hpp) Not a reply graph: " + path);
+        memcpy(&h, base, sizeof(h));
+        if (memcmp(h.magic, ReplyGraphHeader().magic, sizeof(h.magic)) != 0 || file.size() < h.children + h.edges * sizeof(uint32_t))
+            throw std::runtime_error("(graph.hpp) Not a reply graph: " + path);
+
+        ids_ = (const int64_t*) (base + h.ids);
+        flags_ = base + h.flags;
+        offsets_ = (const uint64_t*) (base + h.offsets);
+        children_ = (const uint32_t*) (base + h.children);
+    }
+
+    size_t nodes() const { return h.nodes; }
+    size_t edges() const { return h.edges; }
+
+    int64_t id(uint32_t i) const { return ids_[i]; }
+    uint8_t flags(uint32_t i) const { return flags_[i]; }
+    std::span<const uint32_t> children(uint32_t i) const { return {children_ + offsets_[i], children_ + offsets_[i + 1]}; }
+
+    // dense index of a packed id, -1 if it is not in the graph
+    int64_t find(int64_t id) const {
+        const int64_t* it = std::lower_bound(ids_, ids_ + h.nodes, id);
+        return it != ids_ + h.nodes && *it == id ? it - ids_ : -1;
+    }
+
+    // replies by an author with child flags to a row by an author with parent flags (i.e. count(D_USER, D_MOD))
+    size_t count(uint8_t parent, uint8_t child) const {
+        size_t n = 0;
+        for (uint32_t i = 0; i < h.nodes; i++) {
+            if (flags_[i] != parent) continue;
+            for (uint64_t e = offsets_[i]; e < offsets_[i + 1]; e++) n += flags_[children_[e]] == child;
+        }
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef CMSC_JOIN_HPP
+#define CMSC_JOIN_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <format>
+
+#include "graph.hpp"
+#include "mapped.hpp"
+
+// which submission columns comments get (see SubmissionTable), or them together
+enum JoinField {
+    JF_SCORE = 1,
+    JF_AUTHOR = 2,
+    JF_OP = 4,
+    JF_CREATED = 8,
+    JF_DISTINGUISHED = 16,
+    JF_ALL = 31
+};
+
+// one submission as the comments of a month see it, fixed size so the whole table is one sorted array
+// reddit names are at most 20 characters, longer ones are cut (and then only compare equal to themselves cut)
+struct SubmissionInfo {
+    static constexpr size_t maxAuthor = 26;
+
+    int64_t id;
+    int64_t created_utc;
+    int32_t score;
+    uint8_t distinguished;
+    uint8_t authorLen;
+    char author_[maxAuthor];
+
+    std::string_view author() const { return {author_, authorLen}; }
+};
+
+struct SubmissionTable_Output {
+    size_t rows = 0;
+    size_t bytes = 0;
+    // same as ReplyGraph_Output, the table is then read from a file next to path instead of memory
+    size_t runs = 0;
+    size_t spilled = 0;
+};
+
+// the submissions of a month keyed on their packed id (see packId), so comments can be joined to theirs while they stream
+// push every submission, finish sorts them: if they fit in maxBytes the table stays in memory, otherwise the sorted runs are merged
+// into path and that is memory mapped (comments mostly reply to recent submissions, so the pages in use stay few)
+// lookups are a binary search, with the last hit remembered since the comments of a thread tend to come together
+class SubmissionTable {
+private:
+    struct _Less { bool operator()(const SubmissionInfo& a, const SubmissionInfo& b) const { return a.id < b.id; } };
+
+    std::string path;
+    int fields;
+    graph::SpillSort<SubmissionInfo, _Less>* sort;
+
+    std::vector<SubmissionInfo> rows;
+    MappedFile* mapped = nullptr;
+    const SubmissionInfo* base = nullptr;
+    size_t n = 0;
+
+    mutable const SubmissionInfo* last = nullptr;
+    SubmissionTable_Output stats{};
+
+    SubmissionTable(const SubmissionTable&) = delete;
+    SubmissionTable& operator=(const SubmissionTable&) = delete;
+public:
+    SubmissionTable(const std::string& path, int fields = JF_ALL, size_t maxBytes = (size_t) 256 << 20)
+        : path(path), fields(fields), sort(new graph::SpillSort<SubmissionInfo, _Less>(path, maxBytes)) {}
+
+    ~SubmissionTable() {
+        delete sort;
+        if (mapped) {
+            delete mapped;
+            std::filesystem::remove(path);
+        }
+    }
+
+    bool has(JoinField f) const { return fields & f; }
+
+    void push(int64_t id, std::string_view author, int32_t score, int64_t created_utc, uint8_t distinguished) {
+        SubmissionInfo s{};
+        s.id = id;
+        s.created_utc = created_utc;
+        s.score = score;
+        s.distinguished = distinguished;
+        s.authorLen = (uint8_t) std::min(author.size(), SubmissionInfo::maxAuthor);
+        memcpy(s.author_, author.data(), s.authorLen);
+        sort->push(s);
+        stats.rows++;
+    }
+
+    // done pushing, ids seen twice keep the first one
+    const SubmissionTable_Output& finish() {
+        stats.runs = sort->spilledRuns();
+        stats.spilled = sort->spilledBytes();
+        sort->start();
+
+        SubmissionInfo s;
+        if (stats.runs == 0) {
+            rows.reserve(stats.rows);
+            while (sort->next(s)) if (rows.empty() || rows.back().id != s.id) rows.push_back(s);
+            base = rows.data();
+            n = rows.size();
+        } else {
+            std::ofstream f(path, std::ios::binary);
+            if (!f) throw std::runtime_error("(join.hpp) Unable to open " + path);
+            std::vector<SubmissionInfo> buf;
+            buf.reserve(1 << 14);
+            int64_t prev = 0;
+            while (sort->next(s)) {
+                if (n && s.id == prev) continue;
+                prev = s.id;
+                n++;
+                buf.push_back(s);
+                if (buf.size() == buf.capacity()) {
+                    f.write((const char*) buf.data(), buf.size() * sizeof(SubmissionInfo));
+                    buf.clear();
+                }
+            }
+            f.write((const char*) buf.data(), buf.size() * sizeof(SubmissionInfo));
+            f.close();
+            if (!f) throw std::runtime_error("(join.hpp) Unable to write " + path);
+
+            // an empty file can not be mapped, but there is nothing to look up then either
+            if (n) {
+                mapped = new MappedFile(path, "join.hpp");
+                base = (const SubmissionInfo*) mapped->data();
+            }
+        }
+
+        delete sort;
+        sort = nullptr;
+        stats.rows = n;
+        stats.bytes = n * sizeof(SubmissionInfo);
+        return stats;
+    }
+
+    // the submission with this packed id, nullptr if it is not in the table (i.e. a comment on an older month)
+    const SubmissionInfo* find(int64_t id) const {
+        if (last && last->id == id) return last;
+        const SubmissionInfo* it = std::lower_bound(base, base + n, id, [](const SubmissionInfo& s, int64_t v) { return s.id < v; });
+        if (it == base + n || it->id != id) return nullptr;
+        return last = it;
+    }
+
+    size_t size() const { return n; }
+    const SubmissionTable_Output& status() const { return stats; }
+};
+
+#endif
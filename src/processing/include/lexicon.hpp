@@ -0,0 +1,166 @@
+#ifndef CMSC_LEXICON_HPP
+#define CMSC_LEXICON_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cctype>
+
+namespace fs = std::filesystem;
+
+// counts occurrences of lexicon terms per category with one aho-corasick pass over the text
+// https://cr.yp.to/bib/1975/aho.pdf
+// every category is a file in a directory (category name = file name without extension), one term per line, # for comments
+// matching is case insensitive and only counts whole words (so "ban" does not match "banana")
+class Lexicon {
+private:
+    struct _Out {
+        int category;
+        int len;
+    };
+
+    // the automaton is fully expanded into a dfa (no failure links at scan time), so a scan is one table lookup per byte
+    // bytes are mapped into classes first (only chars that appear in some term get their own class) to keep the table small
+    uint8_t cls[256] = {0};
+    int numCls = 1;
+    std::vector<int32_t> delta;
+
+    // outputs of state s are out[outStart[s] ... outStart[s + 1]] (already includes outputs of suffix states)
+    std::vector<uint32_t> outStart;
+    std::vector<_Out> out;
+
+    std::vector<std::string> names;
+    size_t numTerms = 0;
+
+    static bool word(unsigned char c) { return std::isalnum(c) || c == '_'; }
+
+    void build(const std::vector<std::pair<std::string, int>>& terms) {
+        for (const auto& [t, c] : terms) {
+            for (unsigned char ch : t) if (cls[ch] == 0) cls[ch] = numCls++;
+        }
+        // upper case text maps onto the lower case class
+        for (int c = 'A'; c <= 'Z'; c++) cls[c] = cls[c + 32];
+
+        // trie, -1 is no edge
+        std::vector<int32_t> go(numCls, -1);
+        std::vector<std::vector<_Out>> own(1);
+        for (const auto& [t, c] : terms) {
+            int s = 0;
+            for (unsigned char ch : t) {
+                size_t e = s * numCls + cls[ch];
+                if (go[e] == -1) {
+                    go[e] = own.size();
+                    own.emplace_back();
+                    go.resize(go.size() + numCls, -1);
+                }
+                s = go[e];
+            }
+            own[s].push_back({c, (int) t.size()});
+        }
+
+        // bfs, fill in missing edges with the edge of the failure state
+        size_t states = own.size();
+        std::vector<int32_t> fail(states, 0);
+        std::vector<std::vector<_Out>> all(states);
+        std::vector<int32_t> queue;
+        queue.reserve(states);
+
+        for (int k = 0; k < numCls; k++) {
+            int32_t& next = go[k];
+            if (next == -1) next = 0;
+            else queue.push_back(next);
+        }
+        all[0] = own[0];
+
+        for (size_t q = 0; q < queue.size(); q++) {
+            int32_t s = queue[q];
+            all[s] = own[s];
+            all[s].insert(all[s].end(), all[fail[s]].begin(), all[fail[s]].end());
+
+            for (int k = 0; k < numCls; k++) {
+                int32_t& next = go[s * numCls + k];
+                if (next == -1) next = go[fail[s] * numCls + k];
+                else {
+                    fail[next] = go[fail[s] * numCls + k];
+                    queue.push_back(next);
+                }
+            }
+        }
+
+        delta.swap(go);
+        outStart.resize(states + 1);
+        for (size_t s = 0; s < states; s++) {
+            outStart[s] = out.size();
+            out.insert(out.end(), all[s].begin(), all[s].end());
+        }
+        outStart[states] = out.size();
+    }
+public:
+    Lexicon(const std::string& dir) {
+        std::vector<fs::path> files;
+        for (const auto& e : fs::directory_iterator(dir)) if (e.is_regular_file()) files.push_back(e.path());
+        std::sort(files.begin(), files.end());
+
+        std::vector<std::pair<std::string, int>> terms;
+        for (const auto& p : files) {
+            std::string name = p.stem().string();
+            if (name.empty() || !std::all_of(name.begin(), name.end(), [](unsigned char c) { return word(c); }))
+                throw std::runtime_error("(lexicon.hpp) Lexicon name must only contain [A-Za-z0-9_]: " + p.string());
+
+            std::ifstream f(p);
+            if (!f) throw std::runtime_error("(lexicon.hpp) Unable to open lexicon " + p.string());
+
+            std::string line;
+            while (std::getline(f, line)) {
+                size_t a = line.find_first_not_of(" \t\r");
+                size_t b = line.find_last_not_of(" \t\r");
+                if (a == std::string::npos || line[a] == '#') continue;
+
+                std::string t = line.substr(a, b - a + 1);
+                std::transform(t.begin(), t.end(), t.begin(), [](unsigned char c) { return std::tolower(c); });
+                terms.push_back({t, (int) names.size()});
+            }
+
+            names.push_back(name);
+        }
+
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+        numTerms = terms.size();
+        build(terms);
+    }
+
+    // counts must have size() elements
+    void scan(std::string_view text, std::vector<int>& counts) const {
+        std::fill(counts.begin(), counts.end(), 0);
+
+        const unsigned char* p = (const unsigned char*) text.data();
+        size_t n = text.size();
+        int32_t s = 0;
+        for (size_t i = 0; i < n; i++) {
+            s = delta[s * numCls + cls[p[i]]];
+
+            uint32_t o = outStart[s], e = outStart[s + 1];
+            if (o == e) continue;
+            if (i + 1 < n && word(p[i]) && word(p[i + 1])) continue;
+
+            for (; o < e; o++) {
+                size_t start = i + 1 - out[o].len;
+                if (start == 0 || !word(p[start]) || !word(p[start - 1])) counts[out[o].category]++;
+            }
+        }
+    }
+
+    size_t size() const { return names.size(); }
+    size_t terms() const { return numTerms; }
+    size_t states() const { return outStart.size() - 1; }
+    const std::vector<std::string>& categories() const { return names; }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CMSC_MAPPED_HPP
+#define CMSC_MAPPED_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// read only memory map of a whole file, for the on disk tables that are used as arrays (see graph.hpp, join.hpp)
+class MappedFile {
+private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void unmap() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (base) munmap((void*) base, length);
+#endif
+        base = nullptr;
+    }
+public:
+    // who is asking goes into the error message (i.e. "graph.hpp")
+    MappedFile(const std::string& path, const char* from = "mapped.hpp") {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) throw std::runtime_error(std::string("(") + from + ") Unable to open " + path);
+        LARGE_INTEGER sz;
+        GetFileSizeEx(file, &sz);
+        length = sz.QuadPart;
+        mapping = length ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        base = mapping ? (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!base) {
+            unmap();
+            throw std::runtime_error(std::string("(") + from + ") Unable to map " + path);
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) throw std::runtime_error(std::string("(") + from + ") Unable to open " + path);
+        struct stat st;
+        fstat(fd, &st);
+        length = st.st_size;
+        void* p = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error(std::string("(") + from + ") Unable to map " + path);
+        base = (const uint8_t*) p;
+#endif
+    }
+
+    ~MappedFile() { unmap(); }
+
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+#endif
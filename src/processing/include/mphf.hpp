@@ -0,0 +1,131 @@
+#ifndef CMSC_MPHF_HPP
+#define CMSC_MPHF_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+#include <cstdint>
+#include <format>
+
+#include "dedup.hpp"
+
+// minimal perfect hash over a fixed set of strings (i.e. an author list), n keys go to 0..n-1 without collisions
+// https://arxiv.org/abs/2104.10402 (PTHash): keys are split into buckets of about 4, and every bucket gets the first pilot that puts
+// all of its keys on free slots of a table slightly bigger than n, slots past n are then mapped back onto the free ones below n
+// a lookup is one fingerprint of the key plus two array reads, the fingerprint (hi half) of every key is kept so a string that is
+// not in the set can be told apart (2^-64 chance of a false match)
+class PerfectHash {
+private:
+    static constexpr double keysPerBucket = 4;
+    static constexpr double load = 0.98;
+    static constexpr uint32_t maxPilot = 1 << 24;
+
+    uint64_t n = 0;
+    uint64_t m = 0;
+    uint64_t buckets = 0;
+    std::vector<uint32_t> pilots;
+    // slot - n -> free slot below n
+    std::vector<uint32_t> remap;
+    std::vector<uint64_t> checks;
+
+    // splitmix64 finalizer
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    uint64_t bucket(uint64_t h) const { return (uint64_t) (((_u128) mix(h) * buckets) >> 64); }
+    uint64_t position(uint64_t h, uint32_t pilot) const { return (uint64_t) (((_u128) mix(h ^ mix(pilot + 1)) * m) >> 64); }
+public:
+    PerfectHash() = default;
+
+    // duplicates in keys are kept once, size() is the number of distinct keys
+    explicit PerfectHash(const std::vector<std::string>& keys) {
+        std::vector<Fingerprint> fp;
+        fp.reserve(keys.size());
+        for (const auto& k : keys) fp.push_back(fingerprint(k));
+        std::sort(fp.begin(), fp.end(), [](const Fingerprint& a, const Fingerprint& b) { return a.lo != b.lo ? a.lo < b.lo : a.hi < b.hi; });
+        fp.erase(std::unique(fp.begin(), fp.end()), fp.end());
+
+        n = fp.size();
+        if (n == 0) return;
+        if (n > UINT32_MAX) throw std::runtime_error("(mphf.hpp) Too many keys");
+        m = std::max(n, (uint64_t) std::ceil(n / load));
+        buckets = std::max((uint64_t) 1, (uint64_t) std::ceil(n / keysPerBucket));
+
+        // keys grouped by bucket, biggest buckets placed first while the table is still empty
+        std::vector<uint64_t> of(n);
+        for (uint64_t i = 0; i < n; i++) of[i] = bucket(fp[i].lo);
+        std::vector<uint32_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return of[a] < of[b]; });
+
+        std::vector<std::pair<uint32_t, uint32_t>> groups; // first in order, size
+        for (uint32_t i = 0, j; i < n; i = j) {
+            for (j = i; j < n && of[order[j]] == of[order[i]]; j++) {}
+            groups.push_back({i, j - i});
+        }
+        std::stable_sort(groups.begin(), groups.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+        pilots.assign(buckets, 0);
+        std::vector<bool> taken(m, false);
+        std::vector<uint64_t> slot(n), at;
+        for (const auto& [first, size] : groups) {
+            uint32_t pilot = 0;
+            for (;; pilot++) {
+                if (pilot == maxPilot) throw std::runtime_error("(mphf.hpp) No pilot found, are two keys equal up to their fingerprint?");
+                at.clear();
+                bool ok = true;
+                for (uint32_t k = first; ok && k < first + size; k++) {
+                    uint64_t p = position(fp[order[k]].lo, pilot);
+                    ok = !taken[p] && std::find(at.begin(), at.end(), p) == at.end();
+                    at.push_back(p);
+                }
+                if (ok) break;
+            }
+
+            pilots[of[order[first]]] = pilot;
+            for (uint32_t k = 0; k < size; k++) {
+                taken[at[k]] = true;
+                slot[order[first + k]] = at[k];
+            }
+        }
+
+        // n keys on m slots, so exactly as many free slots below n as taken ones above it
+        remap.assign(m - n, 0);
+        for (uint64_t s = n, free = 0; s < m; s++) {
+            if (!taken[s]) continue;
+            while (taken[free]) free++;
+            remap[s - n] = (uint32_t) free++;
+        }
+
+        checks.assign(n, 0);
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t s = slot[i];
+            checks[s < n ? s : remap[s - n]] = fp[i].hi;
+        }
+    }
+
+    // 0..size()-1 for a key in the set, -1 otherwise
+    int64_t find(std::string_view key) const {
+        if (n == 0) return -1;
+        Fingerprint f = fingerprint(key);
+        uint64_t s = position(f.lo, pilots[bucket(f.lo)]);
+        if (s >= n) s = remap[s - n];
+        return checks[s] == f.hi ? (int64_t) s : -1;
+    }
+
+    bool contains(std::string_view key) const { return find(key) != -1; }
+
+    size_t size() const { return n; }
+    size_t bytes() const { return pilots.size() * sizeof(uint32_t) + remap.size() * sizeof(uint32_t) + checks.size() * sizeof(uint64_t); }
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef CMSC_PROXY_HPP
+#define CMSC_PROXY_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <format>
+
+#include "timing.hpp"
+
+namespace fs = std::filesystem;
+
+// minimal rfc 4180 reader, enough for the csvs pandas writes (quoted fields may contain commas, quotes and new lines)
+class CsvReader {
+private:
+    std::ifstream f;
+    std::vector<std::string> head;
+public:
+    CsvReader(const std::string& file) : f(file, std::ios::binary) {
+        if (!f) throw std::runtime_error("(proxy.hpp) Unable to open csv " + file);
+        next(head);
+    }
+
+    bool next(std::vector<std::string>& row) {
+        row.clear();
+        if (f.peek() == EOF) return false;
+
+        std::string* cell = &row.emplace_back();
+        bool quoted = false;
+        int c;
+        while ((c = f.get()) != EOF) {
+            if (quoted) {
+                if (c != '"') *cell += (char) c;
+                else if (f.peek() == '"') *cell += (char) f.get();
+                else quoted = false;
+            } else if (c == '"') quoted = true;
+            else if (c == ',') cell = &row.emplace_back();
+            else if (c == '\n') break;
+            else if (c != '\r') *cell += (char) c;
+        }
+
+        return true;
+    }
+
+    int column(const std::string& name) const {
+        auto it = std::find(head.begin(), head.end(), name);
+        return it == head.end() ? -1 : (int) (it - head.begin());
+    }
+};
+
+struct Proxy_Output {
+    size_t rows = 0;
+    double pearson = 0;
+    double spearman = 0;
+    double mae = 0;
+};
+
+// cheap stand in for the roberta classifier, logistic regression over hashed word 1-2 grams and char 3 grams
+// (https://arxiv.org/abs/0902.2206 for the hashing trick)
+// trained on the per text scores written by classifier/apply_classifier.py, predicts auth (1 - mean trigram score)
+// meant for triage, i.e. score everything and only send the interesting tail to the real classifier
+class ProxyModel {
+private:
+    struct _Header {
+        char magic[8] = {'C', 'M', 'S', 'C', 'P', 'R', 'X', '1'};
+        uint32_t bits = 0;
+        uint32_t _pad = 0;
+        float bias = 0;
+        float _pad2 = 0;
+    };
+
+    uint32_t bits;
+    std::vector<float> w;
+    float bias = 0;
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 33);
+    }
+
+    static double sigmoid(double z) { return 1.0 / (1.0 + std::exp(-z)); }
+
+    static double pearson(const std::vector<double>& x, const std::vector<double>& y) {
+        double n = x.size(), mx = 0, my = 0, sxy = 0, sxx = 0, syy = 0;
+        for (size_t i = 0; i < x.size(); i++) { mx += x[i]; my += y[i]; }
+        mx /= n; my /= n;
+        for (size_t i = 0; i < x.size(); i++) {
+            sxy += (x[i] - mx) * (y[i] - my);
+            sxx += (x[i] - mx) * (x[i] - mx);
+            syy += (y[i] - my) * (y[i] - my);
+        }
+        return (sxx == 0 || syy == 0) ? 0 : sxy / std::sqrt(sxx * syy);
+    }
+
+    // average rank for ties
+    static std::vector<double> ranks(const std::vector<double>& x) {
+        std::vector<size_t> idx(x.size());
+        std::iota(idx.begin(), idx.end(), 0);
+        std::sort(idx.begin(), idx.end(), [&](size_t a, size_t b) { return x[a] < x[b]; });
+
+        std::vector<double> r(x.size());
+        for (size_t i = 0; i < idx.size();) {
+            size_t j = i;
+            while (j < idx.size() && x[idx[j]] == x[idx[i]]) j++;
+            for (size_t k = i; k < j; k++) r[idx[k]] = (i + j - 1) / 2.0;
+            i = j;
+        }
+        return r;
+    }
+
+    // reads (text, score) pairs from per text csvs, rows without a score (no trigrams) are skipped
+    static void load(const std::vector<std::string>& files, const std::string& textCol, const std::string& scoreCol,
+                     std::vector<std::string>& texts, std::vector<double>& scores) {
+        std::vector<std::string> row;
+        for (const auto& file : files) {
+            CsvReader csv(file);
+            int t = csv.column(textCol), s = csv.column(scoreCol);
+            if (t == -1 || s == -1) throw std::runtime_error(std::format("(proxy.hpp) {} does not have columns {} and {}", file, textCol, scoreCol));
+
+            while (csv.next(row)) {
+                if ((int) row.size() <= std::max(t, s) || row[s].empty()) continue;
+                texts.push_back(std::move(row[t]));
+                scores.push_back(std::stod(row[s]));
+            }
+        }
+    }
+public:
+    // features are bits wide (see features), so 1 to 32
+    static constexpr uint32_t maxBits = 32;
+
+    ProxyModel(uint32_t bits = 20) : bits(bits) {
+        if (bits == 0 || bits > maxBits) throw std::runtime_error(std::format("(proxy.hpp) {} bits, has to be 1 to {}", bits, maxBits));
+        w.assign((size_t) 1 << bits, 0.0f);
+    }
+
+    ProxyModel(const std::string& file) {
+        std::ifstream f(file, std::ios::binary);
+        _Header h;
+        if (!f.read((char*) &h, sizeof(h)) || memcmp(h.magic, "CMSCPRX1", 8) != 0) throw std::runtime_error("(proxy.hpp) Not a proxy model: " + file);
+
+        // checked against the file before the weights are allocated
+        if (h.bits == 0 || h.bits > maxBits || fs::file_size(file) != sizeof(h) + ((size_t) 1 << h.bits) * sizeof(float))
+            throw std::runtime_error(std::format("(proxy.hpp) Corrupt proxy model: {} ({} bits)", file, h.bits));
+
+        bits = h.bits;
+        bias = h.bias;
+        w.resize((size_t) 1 << bits);
+        if (!f.read((char*) w.data(), w.size() * sizeof(float))) throw std::runtime_error("(proxy.hpp) Truncated proxy model: " + file);
+    }
+
+    void save(const std::string& file) const {
+        std::ofstream f(file, std::ios::binary);
+        if (!f) throw std::runtime_error("(proxy.hpp) Unable to write proxy model " + file);
+
+        _Header h;
+        h.bits = bits;
+        h.bias = bias;
+        f.write((const char*) &h, sizeof(h));
+        f.write((const char*) w.data(), w.size() * sizeof(float));
+    }
+
+    // calls emit(index) for every feature, words are lower cased runs of [a-z0-9']
+    template <typename F>
+    void features(std::string_view text, F&& emit) const {
+        const uint32_t shift = 64 - bits;
+        uint64_t prev = 0;
+        size_t n = text.size(), i = 0;
+
+        while (i < n) {
+            while (i < n && !(std::isalnum((unsigned char) text[i]) || text[i] == '\'')) i++;
+            if (i == n) break;
+
+            // char trigrams over " word " so that prefixes and suffixes are their own features
+            uint32_t c0 = ' ', c1 = std::tolower((unsigned char) text[i++]);
+            uint64_t h = (0xcbf29ce484222325ull ^ c1) * 0x100000001b3ull;
+            for (;; i++) {
+                bool end = i == n || !(std::isalnum((unsigned char) text[i]) || text[i] == '\'');
+                uint32_t c2 = end ? ' ' : std::tolower((unsigned char) text[i]);
+                emit(mix(0x9e3779b97f4a7c15ull ^ ((uint64_t) c0 << 16 | c1 << 8 | c2)) >> shift);
+                if (end) break;
+
+                h = (h ^ c2) * 0x100000001b3ull;
+                c0 = c1; c1 = c2;
+            }
+
+            h = mix(h);
+            emit(h >> shift);
+            if (prev) emit(mix(prev * 31 + h) >> shift);
+            prev = h;
+        }
+    }
+
+    double predict(std::string_view text) const {
+        double z = 0;
+        size_t k = 0;
+        features(text, [&](uint32_t i) { z += w[i]; k++; });
+        return sigmoid(bias + (k ? z / std::sqrt((double) k) : 0));
+    }
+
+    // logistic loss against the (soft) scores with adagrad, every 10th row (by position) is held out for the printed correlation
+    Proxy_Output train(const std::vector<std::string>& files, int epochs = 5, const std::string& textCol = "body", const std::string& scoreCol = "auth", double lr = 0.1) {
+        std::vector<std::string> texts;
+        std::vector<double> scores;
+        load(files, textCol, scoreCol, texts, scores);
+        if (texts.empty()) throw std::runtime_error("(proxy.hpp) No rows to train on");
+
+        std::vector<size_t> order;
+        for (size_t i = 0; i < texts.size(); i++) if (i % 10 != 0) order.push_back(i);
+        // row 0 is always held out
+        if (order.size() < 2) throw std::runtime_error(std::format("(proxy.hpp) {} rows is too few to train on", texts.size()));
+
+        std::vector<float> g2(w.size(), 1e-6f);
+        float bg2 = 1e-6f;
+        std::vector<uint32_t> feats;
+        uint64_t rng = 0x2545f4914f6cdd1dull;
+
+#ifdef BENCHMARK_ENABLED
+        auto t_train = Benchmark::timestamp();
+#endif
+        for (int e = 0; e < epochs; e++) {
+            for (size_t i = order.size() - 1; i > 0; i--) {
+                rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+                std::swap(order[i], order[rng % (i + 1)]);
+            }
+
+            for (size_t r : order) {
+                feats.clear();
+                features(texts[r], [&](uint32_t i) { feats.push_back(i); });
+                double scale = feats.empty() ? 0 : 1.0 / std::sqrt((double) feats.size());
+
+                double z = bias;
+                for (uint32_t i : feats) z += w[i] * scale;
+                double g = sigmoid(z) - scores[r];
+
+                for (uint32_t i : feats) {
+                    double gi = g * scale;
+                    g2[i] += gi * gi;
+                    w[i] -= lr * gi / std::sqrt(g2[i]);
+                }
+                bg2 += g * g;
+                bias -= lr * g / std::sqrt(bg2);
+            }
+        }
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Proxy train", t_train);
+#endif
+
+        std::vector<std::string> held;
+        std::vector<double> heldScores;
+        for (size_t i = 0; i < texts.size(); i += 10) {
+            held.push_back(std::move(texts[i]));
+            heldScores.push_back(scores[i]);
+        }
+
+        Proxy_Output out = evaluate(held, heldScores);
+        std::cout << std::format("proxy: trained on {} rows, held out {} (pearson {:.3f}, spearman {:.3f}, mae {:.3f})\n",
+            order.size(), out.rows, out.pearson, out.spearman, out.mae);
+        return out;
+    }
+
+    Proxy_Output evaluate(const std::vector<std::string>& texts, const std::vector<double>& scores) const {
+        Proxy_Output out{};
+        out.rows = texts.size();
+        if (texts.empty()) return out;
+
+        std::vector<double> pred(texts.size());
+        for (size_t i = 0; i < texts.size(); i++) {
+            pred[i] = predict(texts[i]);
+            out.mae += std::abs(pred[i] - scores[i]);
+        }
+
+        out.mae /= texts.size();
+        out.pearson = pearson(pred, scores);
+        out.spearman = pearson(ranks(pred), ranks(scores));
+        return out;
+    }
+
+    // compare against the real classifier scores
+    Proxy_Output evaluate(const std::vector<std::string>& files, const std::string& textCol = "body", const std::string& scoreCol = "auth") const {
+        std::vector<std::string> texts;
+        std::vector<double> scores;
+        load(files, textCol, scoreCol, texts, scores);
+
+        auto t = Benchmark::timestamp();
+        Proxy_Output out = evaluate(texts, scores);
+        double s = std::max(1.0, (double) Benchmark::elapsed_ms(t)) / 1000.0;
+
+        std::cout << std::format("proxy: {} rows, pearson {:.3f}, spearman {:.3f}, mae {:.3f} ({:.0f} rows/s)\n",
+            out.rows, out.pearson, out.spearman, out.mae, out.rows / s);
+        return out;
+    }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef CMSC_QUEUE_HPP
+#define CMSC_QUEUE_HPP
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// blocking fifo with a fixed capacity, used to hand work between threads
+// close() wakes everyone up, push fails afterwards and pop fails once the queue is empty
+template <typename T>
+class BoundedQueue {
+private:
+    std::mutex m;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> q;
+    size_t cap;
+    bool closed = false;
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+public:
+    BoundedQueue(size_t cap) : cap(cap) {}
+
+    bool push(T v) {
+        std::unique_lock l(m);
+        notFull.wait(l, [&] { return closed || q.size() < cap; });
+        if (closed) return false;
+
+        q.push_back(std::move(v));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& v) {
+        std::unique_lock l(m);
+        notEmpty.wait(l, [&] { return closed || !q.empty(); });
+        if (q.empty()) return false;
+
+        v = std::move(q.front());
+        q.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard l(m);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+#endif
@@ -7,12 +7,14 @@
 #include <generator>
 #include <filesystem>
 #include <exception>
+#include <functional>
 
 #include <zstd.h>
 #include <glaze/glaze.hpp>
 
 #include "types.hpp"
 #include "timing.hpp"
+#include "dedup.hpp"
 
 namespace fs = std::filesystem;
 using time_point = std::chrono::system_clock::time_point;
@@ -28,6 +30,12 @@ struct Reader_Output {
     size_t readLinesTotal = 0;
     size_t readLinesInvalid = 0;
     size_t readLinesFiltered = 0;
+    size_t readLinesDuplicate = 0;
+    // already in the database, nothing was read (see Database::processed)
+    bool skipped = false;
+
+    size_t readLinesValid() const { return readLinesTotal - readLinesFiltered - readLinesInvalid; }
+    double duplicateRatio() const { return readLinesValid() == 0 ? 0 : (double) readLinesDuplicate / (double) readLinesValid(); }
 };
 
 class Reader {
@@ -46,6 +54,14 @@ private:
 
     Reader_Output stats{};
 
+    // lines it returns false for are counted as filtered without being parsed
+    std::function<bool(std::string_view)> keep;
+
+    // see hashInput
+    bool hashing = false;
+    bool complete = false;
+    ChainedFingerprint hash;
+
     const std::string p_sizes[4] = {"B", "KiB", "MiB", "GiB"};
     void bFmt(const size_t bytes, std::string& out) const {
         int s = 0;
@@ -61,7 +77,7 @@ public:
             exit(1);
         }
 
-        in_sz = ZSTD_DStreamInSize();
+        in_sz = inputChunk();
         out_sz = ZSTD_DStreamOutSize();
 
         in = new char[in_sz];
@@ -86,12 +102,14 @@ public:
         ZSTD_freeDCtx(dctx);
     }
 
+    // if given, records are parsed into the ring (which the caller owns) instead of a local, so records the caller keeps
+    // stay valid after the reader moves on or finishes (i.e. for binding text without copying)
     template <TRedditData T>
-    std::generator<const T&> decompress(const int update_rate, const size_t count, bool exitOnErr = true) {
+    std::generator<const T&> decompress(const int update_rate, const size_t count, bool exitOnErr = true, RecordRing<T>* ring = nullptr) {
         std::string buf = "";
         size_t read, str_i, str_base;
         glz::error_ctx err;
-        T data{};
+        T local{};
 
         ZSTD_inBuffer input = { in, read, 0 };
         ZSTD_outBuffer output = { out, out_sz, 0 };
@@ -103,6 +121,7 @@ public:
         while ((read = fread(in, 1, in_sz, handle))) {
             if (!read) break;
             stats.readSize += read;
+            if (hashing) hash.add(std::string_view(in, read));
 
             input.pos = 0;
             input.size = read;
@@ -114,25 +133,31 @@ public:
 #endif
                 str_i = 0;
                 str_base = 0;
-                for (; str_i < output.size; str_i++) {
+                for (; str_i < output.pos; str_i++) {
                     if (out[str_i] == '\n') {
 #ifdef BENCHMARK_ENABLED
                         auto t_json = Benchmark::timestamp();
 #endif
                         // TODO: bug -> if last line is empty (new line) we fail
                         // happens in subreddit dumps
+                        T& data = ring ? ring->current() : local;
                         data.reset();
+                        bool skip;
                         if (str_base == 0 && buf.size() != 0) {
                             if (str_i != 0) buf += std::string(out, str_i);
-                            err = glz::read<glz::opts{ .error_on_unknown_keys = false }>(data, buf);
+                            if (!(skip = keep && !keep(buf))) {
+                                err = glz::read<glz::opts{ .error_on_unknown_keys = false }>(data, buf);
 
-                            if (exitOnErr && err) std::cout << std::endl << "Buffer error:" << std::endl << buf << std::endl;
+                                if (exitOnErr && err) std::cout << std::endl << "Buffer error:" << std::endl << buf << std::endl;
+                            }
                             buf.clear();
                         } else {
                             std::string_view str(out + str_base, str_i - str_base);
-                            err = glz::read<glz::opts{ .error_on_unknown_keys = false }>(data, str);
+                            if (!(skip = keep && !keep(str))) {
+                                err = glz::read<glz::opts{ .error_on_unknown_keys = false }>(data, str);
 
-                            if (exitOnErr && err) std::cout << std::endl << str << std::endl;
+                                if (exitOnErr && err) std::cout << std::endl << str << std::endl;
+                            }
                         }
 
                         str_base = str_i + 1;
@@ -140,7 +165,8 @@ public:
                         Benchmark::sum("JSON", t_json);
 #endif
 
-                        if (err) {
+                        if (skip) stats.readLinesFiltered++;
+                        else if (err) {
                             if (exitOnErr) throw std::runtime_error(
                                 std::format("(reader.hpp) Unable to read json! Glaze error code: {}", (uint32_t) err.ec));
                             stats.readLinesInvalid++;
@@ -158,9 +184,10 @@ public:
 #endif
                 // chunks will have last entry cut off (without new line), so store and append to next
                 // += because occasionally an entry will be so long that it spans multiple chunks
-                buf += std::string(out + str_base, output.size - str_base);
+                buf += std::string(out + str_base, output.pos - str_base);
             }
         }
+        complete = true;
 end:
     }
 
@@ -182,9 +209,9 @@ end:
         else if (percent == 0) eta = "Unknown";
         else Benchmark::tFmt((1.0 / percent - 1.0) * (double) Benchmark::elapsed(stats.startTime), eta);
 
-        std::string s = std::format("{} -- ({}/{}/{} = {}/{}) -- [{}{}] {:.2f}% -- {}",
+        std::string s = std::format("{} -- ({}/{}/{}/{} = {}/{}) -- [{}{}] {:.2f}% -- {}",
             stats.fileName,
-            stats.readLinesTotal, stats.readLinesFiltered, stats.readLinesInvalid,
+            stats.readLinesTotal, stats.readLinesFiltered, stats.readLinesInvalid, stats.readLinesDuplicate,
             r, stats.fileSizeStr,
             std::string((int) std::floor(percent * barLen), '='), std::string((int) std::ceil(barLen - percent * barLen), ' '),
             100.0 * percent,
@@ -206,9 +233,28 @@ end:
 
         print();
         std::cout << std::format("\nSize read: {}\nTime elapsed: {}\nLines/s: {:.0f}\n", size, time, l);
+        if (stats.readLinesDuplicate != 0) std::cout << std::format("Duplicates: {} ({:.2f}% of valid)\n", stats.readLinesDuplicate, 100.0 * stats.duplicateRatio());
         Benchmark::print();
     }
 
+    // cheap check on the raw line before it is parsed (i.e. does it contain a value we are looking for at all)
+    void prefilter(const std::function<bool(std::string_view)>& f) { keep = f; }
+
+    // lines the consumer threw away after parsing them (see Database::setFilter)
+    void filtered() { stats.readLinesFiltered++; }
+
+    // content hash of the compressed file as it is read, in inputChunk() byte chunks (see fileFingerprint), so a file that is
+    // hashed does not have to be read twice
+    void hashInput() { hashing = true; }
+
+    // empty unless hashInput was on and the whole file was read (not cut short by count)
+    Fingerprint inputHash() const { return hashing && complete ? hash.value() : Fingerprint{}; }
+
+    static size_t inputChunk() { return ZSTD_DStreamInSize(); }
+
+    // valid lines that were seen before (see dedup.hpp), counted by the consumer since the reader doesnt know about them
+    void duplicate() { stats.readLinesDuplicate++; }
+
     const Reader_Output& status() const { return stats; }
 };
 
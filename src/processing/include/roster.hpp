@@ -0,0 +1,89 @@
+#ifndef CMSC_ROSTER_HPP
+#define CMSC_ROSTER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <format>
+
+#include "sqlite3.h"
+
+// (author, subreddit) pairs, i.e. who moderates where
+// every distinct name is kept once and numbered, a pair is then both numbers in one 64 bit key
+// lookups take string views (no allocation), so checking every row of a month is two small hash lookups
+class ModRoster {
+private:
+    struct _Hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+    using _Names = std::unordered_map<std::string_view, uint32_t, _Hash, std::equal_to<>>;
+
+    // views in the maps point into here, deque so they stay put
+    std::deque<std::string> storage;
+    _Names authors;
+    _Names subreddits;
+    std::unordered_set<uint64_t> pairs;
+
+    uint32_t intern(_Names& names, std::string_view s) {
+        auto it = names.find(s);
+        if (it != names.end()) return it->second;
+        std::string_view kept = storage.emplace_back(s);
+        return names.emplace(kept, (uint32_t) names.size()).first->second;
+    }
+public:
+    static constexpr const char* table = "mods";
+
+    void add(std::string_view author, std::string_view subreddit) {
+        pairs.insert((uint64_t) intern(authors, author) << 32 | intern(subreddits, subreddit));
+    }
+
+    bool contains(std::string_view author, std::string_view subreddit) const {
+        auto a = authors.find(author);
+        if (a == authors.end()) return false;
+        auto s = subreddits.find(subreddit);
+        return s != subreddits.end() && pairs.contains((uint64_t) a->second << 32 | s->second);
+    }
+
+    size_t size() const { return pairs.size(); }
+    size_t numAuthors() const { return authors.size(); }
+
+    // replaces the mods table of db (author, subreddit) with this
+    void save(sqlite3* db) const {
+        std::vector<std::string_view> a(authors.size()), s(subreddits.size());
+        for (const auto& [k, v] : authors) a[v] = k;
+        for (const auto& [k, v] : subreddits) s[v] = k;
+
+        std::string cmd = std::format("DROP TABLE IF EXISTS {0}; CREATE TABLE {0} (author TEXT, subreddit TEXT) STRICT;", table);
+        char* err = nullptr;
+        if (sqlite3_exec(db, cmd.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+            std::string msg = err ? err : "";
+            sqlite3_free(err);
+            throw std::runtime_error("(roster.hpp) Unable to create roster table: " + msg);
+        }
+
+        sqlite3_stmt* stmt;
+        cmd = std::format("INSERT INTO {} VALUES (?, ?)", table);
+        if (sqlite3_prepare_v2(db, cmd.c_str(), cmd.size() + 1, &stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(roster.hpp) Could not create prepared statement: " + std::string(sqlite3_errmsg(db)));
+
+        sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+        for (uint64_t p : pairs) {
+            std::string_view author = a[p >> 32], subreddit = s[(uint32_t) p];
+            sqlite3_bind_text(stmt, 1, author.data(), author.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 2, subreddit.data(), subreddit.size(), SQLITE_STATIC);
+            sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+        }
+        sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, nullptr);
+        sqlite3_finalize(stmt);
+    }
+};
+
+#endif
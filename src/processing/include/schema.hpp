@@ -0,0 +1,179 @@
+#ifndef CMSC_SCHEMA_HPP
+#define CMSC_SCHEMA_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "types.hpp"
+
+// compile time alternative to Schema, columns are a tuple of descriptors so filling a row is a chain of inlined calls
+// instead of one std::function call per column
+
+// string literal usable as a template argument (column keys)
+template <size_t N>
+struct FixedString {
+    char str[N]{};
+
+    constexpr FixedString(const char (&s)[N]) { std::copy_n(s, N, str); }
+    constexpr std::string_view view() const { return {str, N - 1}; }
+};
+
+// single column, fn(record, out)
+// raw columns are a field of the record copied as is (so the value also appears verbatim in the json line, see vtab.hpp)
+template <FixedString Key, SchemaType Type, typename F, bool Raw = false>
+struct Column {
+    static constexpr std::string_view key = Key.view();
+    static constexpr SchemaType type = Type;
+    static constexpr bool fixed = true;
+
+    F fn;
+
+    size_t size() const { return 1; }
+    void keys(SchemaColumns& out) const { out.push_back({std::string(key), type}); }
+    void raws(std::vector<bool>& out) const { out.push_back(Raw); }
+
+    template <typename T>
+    SchemaValue* fill(const T& j, SchemaValue* out) const {
+        fn(j, *out);
+        return out + 1;
+    }
+
+    template <typename B>
+    const SchemaValue* bind(const SchemaValue* v, B& one) const {
+        one(*v);
+        return v + 1;
+    }
+};
+
+// columns that are only known at run time (i.e. one per lexicon category, or optional ones), all filled by one call
+// fn(record, out) writes names.size() values, no names means the group is skipped
+template <SchemaType Type, typename F>
+struct ColumnGroup {
+    static constexpr SchemaType type = Type;
+    static constexpr bool fixed = false;
+
+    std::vector<std::string> names;
+    F fn;
+
+    size_t size() const { return names.size(); }
+    void keys(SchemaColumns& out) const { for (const auto& n : names) out.push_back({n, type}); }
+    void raws(std::vector<bool>& out) const { out.insert(out.end(), names.size(), false); }
+
+    template <typename T>
+    SchemaValue* fill(const T& j, SchemaValue* out) const {
+        if (names.empty()) return out;
+        fn(j, out);
+        return out + names.size();
+    }
+
+    template <typename B>
+    const SchemaValue* bind(const SchemaValue* v, B& one) const {
+        for (const SchemaValue* end = v + names.size(); v != end; v++) one(*v);
+        return v;
+    }
+};
+
+template <FixedString Key, SchemaType Type, bool Raw = false, typename F>
+Column<Key, Type, F, Raw> column(F fn) { return {fn}; }
+
+template <SchemaType Type, typename F>
+ColumnGroup<Type, F> columns(std::vector<std::string> names, F fn) { return {std::move(names), fn}; }
+
+#define C_TEXT(FIELD) column<#FIELD, ST_TEXT, true>([](const auto& json, SchemaValue& out) { out.text(json.FIELD); })
+#define C_INT(FIELD) column<#FIELD, ST_INT>([](const auto& json, SchemaValue& out) { out.integer((int64_t) json.FIELD); })
+#define C_BOOL(FIELD) column<#FIELD, ST_BOOL>([](const auto& json, SchemaValue& out) { out.integer(json.FIELD ? 1 : 0); })
+
+template <TRedditData T, typename... Cols>
+struct CompiledSchema {
+private:
+    std::tuple<Cols...> def;
+    SchemaColumns keys;
+    std::vector<bool> verbatim;
+
+    // same as Schema
+    std::string cols;
+    std::string head;
+public:
+    // number of columns if there are no groups (so rows are a constant stride apart), 0 otherwise
+    static constexpr size_t width = (Cols::fixed && ...) ? sizeof...(Cols) : 0;
+
+    const std::string name;
+
+    CompiledSchema(const std::string& table, Cols... c) : def(c...), name(table) {
+        std::apply([&](const auto&... d) { (d.keys(keys), ...); }, def);
+        std::apply([&](const auto&... d) { (d.raws(verbatim), ...); }, def);
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (i != 0) {
+                cols += ",";
+                head += ",";
+            }
+            cols += columnDecl(keys[i].first, keys[i].second);
+            head += keys[i].first;
+        }
+    }
+
+    const std::string& columns() const { return cols; }
+    const std::string& columns_ins() const { return head; }
+    size_t size() const { return keys.size(); }
+    const SchemaColumns& fields() const { return keys; }
+    bool raw(size_t i) const { return verbatim[i]; }
+
+    // out must have size() elements
+    void fill(const T& j, SchemaValue* out) const {
+        std::apply([&](const auto&... d) { ((out = d.fill(j, out)), ...); }, def);
+    }
+
+    // one(value) for every value of a filled row in column order, the fixed columns are one inlined call each and only groups
+    // loop (over however many names they have, none for an empty group), lets Database bind a row without a per column loop
+    template <typename B>
+    void bindRow(const SchemaValue* v, B&& one) const {
+        std::apply([&](const auto&... d) { ((v = d.bind(v, one)), ...); }, def);
+    }
+
+    // only fills columns in used (bit i for column i, columns past 63 all share bit 63 like sqlite colUsed), the rest are left as is
+    void fill(const T& j, SchemaValue* out, uint64_t used) const {
+        size_t i = 0;
+        auto one = [&](const auto& d) {
+            size_t n = d.size();
+            uint64_t bits = 0;
+            for (size_t c = i; c < i + n && c <= 63; c++) bits |= 1ull << c;
+            if (i + n > 63) bits |= 1ull << 63;
+
+            if (used & bits) d.fill(j, out + i);
+            i += n;
+        };
+        std::apply([&](const auto&... d) { (one(d), ...); }, def);
+    }
+
+    // same columns as a runtime Schema (one std::function per column), only meant for comparing the two
+    Schema<T> runtime() const {
+        std::vector<SchemaDef<T>> out;
+        auto add = [&](const auto& d) {
+            if constexpr (std::decay_t<decltype(d)>::fixed) out.push_back({keys[out.size()].first, d.type, [d](const T& j, SchemaValue& v) { d.fill(j, &v); }});
+            else {
+                // first column of a group fills all of them, the rest are copied out
+                auto buf = std::make_shared<std::vector<SchemaValue>>(d.size());
+                for (size_t c = 0; c < d.size(); c++) {
+                    out.push_back({keys[out.size()].first, d.type, [d, buf, c](const T& j, SchemaValue& v) {
+                        if (c == 0) d.fill(j, buf->data());
+                        v = (*buf)[c];
+                    }});
+                }
+            }
+        };
+        std::apply([&](const auto&... d) { (add(d), ...); }, def);
+
+        return Schema<T>(name, out);
+    }
+};
+
+template <TRedditData T, typename... Cols>
+CompiledSchema<T, Cols...> compileSchema(const std::string& table, Cols... c) { return CompiledSchema<T, Cols...>(table, c...); }
+
+#endif
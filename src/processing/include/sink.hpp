@@ -0,0 +1,195 @@
+#ifndef CMSC_SINK_HPP
+#define CMSC_SINK_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <charconv>
+#include <format>
+
+#include <zstd.h>
+#include <glaze/glaze.hpp>
+
+#include "types.hpp"
+
+enum SinkType { SK_SQLITE, SK_CSV, SK_NDJSON, SK_NULL, SK_COLUMNAR };
+
+// where Database::read sends rows instead of sqlite (see Database::setSink), sqlite itself stays the built in path
+// open is called at the start of every read (possibly more than once for the same table, i.e. comments then submissions)
+// values are row major with columns.size() values per row, text only lives until write returns
+// flush is called wherever sqlite would commit
+class Sink {
+public:
+    virtual ~Sink() = default;
+
+    virtual void open(const std::string& table, const SchemaColumns& columns) = 0;
+    virtual void write(const SchemaValue* values, size_t rows) = 0;
+    virtual void flush() {}
+
+    size_t rows = 0;
+    size_t bytes = 0;
+protected:
+    SchemaColumns cols;
+    std::string table;
+
+    // same table may be opened again (next read), anything else is an error since the file only has one layout
+    // blobs (compressed bodies, see zdict.hpp) only go to sqlite
+    bool reopen(const std::string& t, const SchemaColumns& c) {
+        for (const auto& [k, type] : c) if (type == ST_BLOB) throw std::runtime_error("(sink.hpp) Blob column " + k + " can only be written to sqlite");
+        if (table.empty()) {
+            table = t;
+            cols = c;
+            return false;
+        }
+        if (t != table || c != cols) throw std::runtime_error("(sink.hpp) Sink was already opened with a different table " + table);
+        return true;
+    }
+};
+
+// drops everything, for measuring the reader (and filling rows) on its own
+class NullSink : public Sink {
+public:
+    void open(const std::string&, const SchemaColumns&) override {}
+    void write(const SchemaValue* values, size_t rows) override { this->rows += rows; }
+};
+
+// shared by the text sinks, buffers output and writes it to a file (zstd compressed if asked for) once it gets large
+class _FileSink : public Sink {
+private:
+    std::ofstream f;
+    ZSTD_CCtx* cctx = nullptr;
+    std::string zbuf;
+
+    void put(ZSTD_EndDirective mode) {
+        if (!cctx) {
+            f.write(buf.data(), buf.size());
+            bytes += buf.size();
+            buf.clear();
+            return;
+        }
+
+        ZSTD_inBuffer in = { buf.data(), buf.size(), 0 };
+        bool done = false;
+        while (!done) {
+            ZSTD_outBuffer out = { zbuf.data(), zbuf.size(), 0 };
+            size_t left = ZSTD_compressStream2(cctx, &out, &in, mode);
+            if (ZSTD_isError(left)) throw std::runtime_error(std::format("(sink.hpp) zstd error: {}", ZSTD_getErrorName(left)));
+
+            f.write(zbuf.data(), out.pos);
+            bytes += out.pos;
+            done = mode == ZSTD_e_continue ? in.pos == in.size : left == 0;
+        }
+        buf.clear();
+    }
+protected:
+    std::string buf;
+
+    void maybeFlush() { if (buf.size() > ((size_t) 1 << 20)) put(ZSTD_e_continue); }
+
+    static void number(std::string& out, const SchemaValue& v) {
+        char tmp[32];
+        auto r = v.kind == SchemaValue::SV_INT ? std::to_chars(tmp, tmp + sizeof(tmp), v.i) : std::to_chars(tmp, tmp + sizeof(tmp), v.d);
+        out.append(tmp, r.ptr);
+    }
+public:
+    _FileSink(const std::string& file, bool zstd = false, int level = 3) : f(file, std::ios::binary) {
+        if (!f) throw std::runtime_error("(sink.hpp) Unable to open " + file);
+        if (zstd) {
+            cctx = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+            zbuf.resize(ZSTD_CStreamOutSize());
+        }
+    }
+
+    ~_FileSink() {
+        try { put(ZSTD_e_end); } catch (...) {}
+        ZSTD_freeCCtx(cctx);
+    }
+
+    void flush() override {
+        put(ZSTD_e_flush);
+        f.flush();
+    }
+};
+
+// rfc 4180 csv with a header, same columns as db_to_csv.py writes but the ids stay packed integers (see packId)
+// classifier/apply_classifier.py decodes those itself (reddit_ids.py), so it can still go there as is
+// nulls are empty fields, quoting is done by glaze
+class CsvSink : public _FileSink {
+private:
+    void field(std::string_view s) {
+        size_t ix = buf.size();
+        glz::dump_csv_string(s, buf, ix);
+        buf.resize(ix);
+    }
+public:
+    CsvSink(const std::string& file, bool zstd = false) : _FileSink(file, zstd) {}
+
+    void open(const std::string& t, const SchemaColumns& c) override {
+        if (reopen(t, c)) return;
+        for (size_t i = 0; i < cols.size(); i++) {
+            if (i != 0) buf += ',';
+            field(cols[i].first);
+        }
+        buf += '\n';
+    }
+
+    void write(const SchemaValue* values, size_t n) override {
+        for (size_t r = 0; r < n; r++) {
+            for (size_t i = 0; i < cols.size(); i++) {
+                const SchemaValue& v = *values++;
+                if (i != 0) buf += ',';
+                if (v.kind == SchemaValue::SV_TEXT) field(v.s);
+                else if (v.kind != SchemaValue::SV_NULL) number(buf, v);
+            }
+            buf += '\n';
+        }
+        rows += n;
+        maybeFlush();
+    }
+};
+
+// one json object per row, keys are the column names (string escaping is done by glaze)
+class NdjsonSink : public _FileSink {
+private:
+    std::vector<std::string> keys;
+    std::string tmp;
+
+    // quoted and escaped into tmp
+    void quote(std::string_view s) {
+        if (glz::write_json(s, tmp)) throw std::runtime_error("(sink.hpp) Unable to write json string");
+    }
+public:
+    NdjsonSink(const std::string& file, bool zstd = false) : _FileSink(file, zstd) {}
+
+    void open(const std::string& t, const SchemaColumns& c) override {
+        if (reopen(t, c)) return;
+        for (const auto& [k, type] : cols) {
+            quote(k);
+            keys.push_back(tmp + ":");
+        }
+    }
+
+    void write(const SchemaValue* values, size_t n) override {
+        for (size_t r = 0; r < n; r++) {
+            buf += '{';
+            for (size_t i = 0; i < keys.size(); i++) {
+                const SchemaValue& v = *values++;
+                if (i != 0) buf += ',';
+                buf += keys[i];
+                switch (v.kind) {
+                    case SchemaValue::SV_NULL: buf += "null"; break;
+                    case SchemaValue::SV_TEXT: quote(v.s); buf += tmp; break;
+                    default: number(buf, v); break;
+                }
+            }
+            buf += "}\n";
+        }
+        rows += n;
+        maybeFlush();
+    }
+};
+
+#endif
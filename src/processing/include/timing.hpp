@@ -5,12 +5,16 @@
 #include <string>
 #include <chrono>
 #include <iostream>
+#include <mutex>
 
 using time_point = std::chrono::system_clock::time_point;
 
 class Benchmark {
 private:
+    // microseconds, most stages are summed per row so seconds (or even milliseconds) would always round down to 0
     static inline std::unordered_map<std::string, int64_t> time{};
+    // stages are summed from the reader and writer threads (see Database::read)
+    static inline std::mutex lock{};
     static const inline std::pair<std::string, int64_t> p_times[3] = {{"hour", 3600}, {"min", 60}, {"sec", 1}};
 public:
     static void tFmt(int64_t sec, std::string& out) {
@@ -30,22 +34,28 @@ public:
         }
     }
 
-    static time_point timestamp() { return floor<std::chrono::milliseconds>(std::chrono::system_clock::now()); }
+    static time_point timestamp() { return std::chrono::system_clock::now(); }
     static int64_t elapsed(const time_point& t) { return floor<std::chrono::seconds>(std::chrono::system_clock::now() - t).count(); }
     static int64_t elapsed_ms(const time_point& t) { return floor<std::chrono::milliseconds>(std::chrono::system_clock::now() - t).count(); }
+    static int64_t elapsed_us(const time_point& t) { return floor<std::chrono::microseconds>(std::chrono::system_clock::now() - t).count(); }
 
     static void sum(const std::string& key, int64_t t) {
+        std::lock_guard l(lock);
         if (!time.count(key)) time[key] = t;
         else time[key] += t;
     }
 
-    static void sum(const std::string& key, const time_point& t) { sum(key, elapsed(t)); }
+    static void sum(const std::string& key, const time_point& t) { sum(key, elapsed_us(t)); }
 
     static void total(const std::string& key, std::string& out) {
         if (!time.count(key)) out = "NA";
-        else tFmt(time[key], out);
+        else tFmt(time[key] / 1000000, out);
     }
 
+    // in ms, 0 if never summed
+    static double get(const std::string& key) { return time.count(key) ? (double) time[key] / 1000.0 : 0; }
+    static void reset() { time.clear(); }
+
     static void print() {
         int64_t t = 0;
         for (const auto& pair : time) t += pair.second;
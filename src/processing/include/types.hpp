@@ -1,7 +1,7 @@
 #ifndef CMSC_TYPES_HPP
 #define CMSC_TYPES_HPP
 
-enum SchemaType { ST_TEXT, ST_INT, ST_BOOL };
+enum SchemaType { ST_TEXT, ST_INT, ST_BOOL, ST_REAL, ST_BLOB };
 
 template <typename T>
 concept TRedditData = requires(T t) {
@@ -11,8 +11,45 @@ concept TRedditData = requires(T t) {
     { t.valid() } -> std::convertible_to<bool>;
 };
 
+// data with a main body of text (comment body, submission selftext), used by stages that look at the text itself
+template <typename T>
+concept TRedditText = TRedditData<T> && requires(const T t) {
+    { t.text() } -> std::convertible_to<std::string_view>;
+};
+
+// records owned by the caller of Reader::decompress, the reader always parses into current() and the caller calls keep()
+// for records it still needs (and may seek() to manage which parts of the ring are in use)
 template <TRedditData T>
-using SchemaCallback = std::function<void(const T&, std::string&)>;
+struct RecordRing {
+    std::vector<T> records;
+    size_t slot = 0;
+
+    RecordRing(size_t size) : records(std::max(size, (size_t) 1)) {}
+
+    T& current() { return records[slot]; }
+    void keep() { slot = (slot + 1) % records.size(); }
+    void seek(size_t s) { slot = s % records.size(); }
+};
+
+// typed output of a column callback, bound as is (no conversion to and from strings)
+// text is a view, so it must point into the record itself (or something that lives at least as long)
+struct SchemaValue {
+    enum Kind { SV_NULL, SV_INT, SV_REAL, SV_TEXT, SV_BLOB };
+
+    Kind kind = SV_NULL;
+    int64_t i = 0;
+    double d = 0;
+    std::string_view s;
+
+    void null() { kind = SV_NULL; }
+    void integer(int64_t v) { kind = SV_INT; i = v; }
+    void real(double v) { kind = SV_REAL; d = v; }
+    void text(std::string_view v) { kind = SV_TEXT; s = v; }
+    void blob(std::string_view v) { kind = SV_BLOB; s = v; }
+};
+
+template <TRedditData T>
+using SchemaCallback = std::function<void(const T&, SchemaValue&)>;
 
 template <TRedditData T>
 struct SchemaDef {
@@ -25,6 +62,35 @@ struct SchemaDef {
     SchemaDef() {}
 };
 
+// name and type of every column, in order
+using SchemaColumns = std::vector<std::pair<std::string, SchemaType>>;
+
+// column definition for CREATE TABLE
+inline std::string columnDecl(std::string_view key, SchemaType type) {
+    std::string k(key);
+    switch (type) {
+        case ST_TEXT: return k + " TEXT";
+        case ST_INT: return k + " INTEGER";
+        case ST_BOOL: return k + " INTEGER CHECK (" + k + " IN (0,1))";
+        case ST_REAL: return k + " REAL";
+        case ST_BLOB: return k + " BLOB";
+    }
+    return k;
+}
+
+// what Database needs from a schema, either this one (runtime, one std::function per column) or CompiledSchema (schema.hpp)
+// width is the number of columns if known at compile time (0 otherwise)
+template <typename S, typename T>
+concept TSchema = requires(const S s, const T& t, SchemaValue* out) {
+    { s.name } -> std::convertible_to<std::string>;
+    { s.columns() } -> std::convertible_to<std::string>;
+    { s.columns_ins() } -> std::convertible_to<std::string>;
+    { s.size() } -> std::convertible_to<size_t>;
+    { s.fields() } -> std::convertible_to<SchemaColumns>;
+    s.fill(t, out);
+    { S::width } -> std::convertible_to<size_t>;
+};
+
 template <TRedditData T>
 struct Schema {
 private:
@@ -32,6 +98,7 @@ private:
     // will be in same order
     std::string cols;
     std::string head;
+    SchemaColumns keys;
 
     void init() {
         std::stringstream _cols;
@@ -40,19 +107,9 @@ private:
         int i = 0;
         int m = def.size() - 1;
         for (const auto& s : def) {
-            switch (s.type) {
-                case ST_TEXT:
-                    _cols << s.key + " TEXT";
-                    break;
-                case ST_INT:
-                    _cols << s.key + " INTEGER";
-                    break;
-                case ST_BOOL:
-                    _cols << s.key + " INTEGER CHECK (" << s.key << " IN (0,1))";
-                    break;
-            }
-
+            _cols << columnDecl(s.key, s.type);
             _head << s.key;
+            keys.push_back({s.key, s.type});
 
             if (i++ != m) {
                 _head << ",";
@@ -72,8 +129,15 @@ public:
     Schema(const Schema& a) : name(a.name), def(a.def) { init(); }
     Schema() {}
 
+    static constexpr size_t width = 0;
+
     const std::string& columns() const { return cols; }
     const std::string& columns_ins() const { return head; }
+    size_t size() const { return def.size(); }
+    const SchemaColumns& fields() const { return keys; }
+
+    // out must have size() elements
+    void fill(const T& j, SchemaValue* out) const { for (const auto& d : def) d.callback(j, *out++); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,530 @@
+#ifndef CMSC_VFS_HPP
+#define CMSC_VFS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <format>
+
+#include <zstd.h>
+
+#include "sqlite3.h"
+#include "timing.hpp"
+
+// sqlite vfs that keeps the main database file zstd compressed, everything else (journals, temp files) goes to the default vfs as is
+// the file is cut into groups of groupBytes (8 of Database's 8 KiB pages by default), every group is one zstd frame
+//
+// layout: 64 byte header, then frames and the index anywhere after it (the header says where the index is)
+//   header  "CMSCZPG1", u32 group bytes, u32 groups, u64 logical size, u64 generation, u64 index offset, u64 index bytes
+//   index   u64 offset, u32 compressed size, u32 raw size per group (size 0 is a group that was never written, all zeros)
+//
+// writes stay in memory until sqlite syncs or lets go of its write lock, then the changed groups are compressed into free
+// space (or the end of the file), a new index is written and the header is switched over last, so the previous state is intact
+// until then. space freed by a commit is only reused by the next one. another connection notices the new generation when it takes
+// its next shared lock. wal needs shared memory which this does not provide (sqlite keeps the old journal mode)
+// files that already are plain sqlite databases are opened as they are
+class ZstdVfs {
+private:
+    static constexpr char magic[8] = {'C', 'M', 'S', 'C', 'Z', 'P', 'G', '1'};
+    static constexpr size_t headerSize = 64;
+    static constexpr size_t entrySize = 16;
+    // decompressed groups kept around for reads
+    static constexpr size_t cacheGroups = 32;
+    // dirty groups written out (without committing) once there are this many bytes of them
+    static constexpr size_t dirtyMax = (size_t) 64 << 20;
+
+    struct _Entry {
+        uint64_t off = 0;
+        uint32_t size = 0;
+        uint32_t raw = 0;
+    };
+
+    static_assert(sizeof(_Entry) == entrySize);
+
+    struct _State {
+        sqlite3_file* real;
+        ZstdVfs* vfs;
+
+        uint32_t groupBytes;
+        uint64_t size = 0;
+        uint64_t gen = 0;
+        _Entry index{};
+        std::vector<_Entry> groups;
+
+        // free space (offset -> length) and the end of everything in use, pending is freed by the commit in progress
+        std::map<uint64_t, uint64_t> free;
+        std::vector<std::pair<uint64_t, uint64_t>> pending;
+        uint64_t tail = headerSize;
+
+        std::unordered_map<uint64_t, std::string> cache;
+        std::map<uint64_t, std::string> dirty;
+        bool changed = false;
+        int lock = SQLITE_LOCK_NONE;
+
+        ZSTD_CCtx* cctx = nullptr;
+        ZSTD_DCtx* dctx = nullptr;
+        std::string zbuf;
+
+        ~_State() {
+            ZSTD_freeCCtx(cctx);
+            ZSTD_freeDCtx(dctx);
+        }
+    };
+
+    struct _File {
+        sqlite3_file base;
+        _State* st;
+    };
+
+    sqlite3_vfs vfs{};
+    sqlite3_vfs* root;
+    std::string name;
+    int level;
+    uint32_t groupBytes;
+
+    static sqlite3_vfs* rootOf(sqlite3_vfs* v) { return ((ZstdVfs*) v->pAppData)->root; }
+    static _State* state(sqlite3_file* f) { return ((_File*) f)->st; }
+
+    static int readAt(_State* s, void* out, size_t n, uint64_t off) { return s->real->pMethods->xRead(s->real, out, (int) n, (sqlite3_int64) off); }
+    static int writeAt(_State* s, const void* in, size_t n, uint64_t off) { return s->real->pMethods->xWrite(s->real, in, (int) n, (sqlite3_int64) off); }
+
+    // (re)reads header and index, empty file is a new database
+    static int load(_State* s) {
+        char h[headerSize];
+        int rc = readAt(s, h, headerSize, 0);
+        if (rc == SQLITE_IOERR_SHORT_READ) {
+            s->size = 0;
+            s->gen = 0;
+            s->groups.clear();
+            s->index = {};
+        } else if (rc != SQLITE_OK) return rc;
+        else {
+            if (std::memcmp(h, magic, sizeof(magic)) != 0) return SQLITE_NOTADB;
+            uint32_t count;
+            std::memcpy(&s->groupBytes, h + 8, 4);
+            std::memcpy(&count, h + 12, 4);
+            std::memcpy(&s->size, h + 16, 8);
+            std::memcpy(&s->gen, h + 24, 8);
+            std::memcpy(&s->index.off, h + 32, 8);
+            uint64_t len;
+            std::memcpy(&len, h + 40, 8);
+            s->index.size = (uint32_t) len;
+
+            s->groups.assign(count, _Entry{});
+            if (count != 0 && (rc = readAt(s, s->groups.data(), (size_t) count * entrySize, s->index.off)) != SQLITE_OK) return rc;
+        }
+
+        // free space is whatever the index does not point at
+        std::vector<std::pair<uint64_t, uint64_t>> used;
+        for (const auto& g : s->groups) if (g.size != 0) used.push_back({g.off, g.size});
+        if (s->index.size != 0) used.push_back({s->index.off, s->index.size});
+        std::sort(used.begin(), used.end());
+
+        s->free.clear();
+        s->pending.clear();
+        s->tail = headerSize;
+        for (const auto& [off, len] : used) {
+            if (off > s->tail) s->free[s->tail] = off - s->tail;
+            s->tail = std::max(s->tail, off + len);
+        }
+
+        s->cache.clear();
+        s->dirty.clear();
+        s->changed = false;
+        return SQLITE_OK;
+    }
+
+    // first free space that fits and starts before below, otherwise the end of the file (or 0 if below is given)
+    static uint64_t alloc(_State* s, uint64_t n, uint64_t below = UINT64_MAX) {
+        for (auto it = s->free.begin(); it != s->free.end() && it->first < below; it++) {
+            if (it->second < n) continue;
+            uint64_t off = it->first, left = it->second - n;
+            s->free.erase(it);
+            if (left != 0) s->free[off + n] = left;
+            return off;
+        }
+        if (below != UINT64_MAX) return 0;
+
+        uint64_t off = s->tail;
+        s->tail += n;
+        return off;
+    }
+
+    static void release(_State* s, uint64_t off, uint64_t n) {
+        auto it = s->free.emplace(off, n).first;
+        auto next = std::next(it);
+        if (next != s->free.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            s->free.erase(next);
+        }
+        if (it != s->free.begin()) {
+            auto prev = std::prev(it);
+            if (prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                s->free.erase(it);
+            }
+        }
+    }
+
+    // decompressed group g (missing groups are empty), for reading
+    static int group(_State* s, uint64_t g, const std::string** out) {
+        if (auto d = s->dirty.find(g); d != s->dirty.end()) {
+            *out = &d->second;
+            return SQLITE_OK;
+        }
+        if (auto c = s->cache.find(g); c != s->cache.end()) {
+            *out = &c->second;
+            return SQLITE_OK;
+        }
+
+        if (s->cache.size() >= cacheGroups) s->cache.clear();
+        std::string& data = s->cache[g];
+        if (g < s->groups.size() && s->groups[g].size != 0) {
+            const _Entry& e = s->groups[g];
+            s->zbuf.resize(e.size);
+            int rc = readAt(s, s->zbuf.data(), e.size, e.off);
+            if (rc != SQLITE_OK) {
+                s->cache.erase(g);
+                return rc;
+            }
+#ifdef BENCHMARK_ENABLED
+            auto t = Benchmark::timestamp();
+#endif
+            data.resize(e.raw);
+            size_t r = ZSTD_decompressDCtx(s->dctx, data.data(), data.size(), s->zbuf.data(), e.size);
+#ifdef BENCHMARK_ENABLED
+            Benchmark::sum("VFS decompress", t);
+#endif
+            if (ZSTD_isError(r) || r != e.raw) {
+                s->cache.erase(g);
+                return SQLITE_CORRUPT;
+            }
+        }
+        *out = &data;
+        return SQLITE_OK;
+    }
+
+    // compresses every dirty group into the file, the index only changes in memory
+    static int spill(_State* s) {
+        for (auto& [g, data] : s->dirty) {
+#ifdef BENCHMARK_ENABLED
+            auto t = Benchmark::timestamp();
+#endif
+            s->zbuf.resize(ZSTD_compressBound(data.size()));
+            size_t n = ZSTD_compressCCtx(s->cctx, s->zbuf.data(), s->zbuf.size(), data.data(), data.size(), s->vfs->level);
+#ifdef BENCHMARK_ENABLED
+            Benchmark::sum("VFS compress", t);
+#endif
+            if (ZSTD_isError(n)) return SQLITE_IOERR_WRITE;
+
+            if (g >= s->groups.size()) s->groups.resize(g + 1);
+            _Entry& e = s->groups[g];
+            if (e.size != 0) s->pending.push_back({e.off, e.size});
+
+            e.off = alloc(s, n);
+            e.size = (uint32_t) n;
+            e.raw = (uint32_t) data.size();
+            int rc = writeAt(s, s->zbuf.data(), n, e.off);
+            if (rc != SQLITE_OK) return rc;
+
+            // still good for reading
+            if (s->cache.size() >= cacheGroups) s->cache.clear();
+            s->cache[g] = std::move(data);
+        }
+        s->dirty.clear();
+        return SQLITE_OK;
+    }
+
+    // moves groups from the end of the file into free space further up (as is, no recompressing), only worth it once a good part
+    // of the file is free, i.e. after a vacuum rewrote everything (the old copy is only free once the new one is committed)
+    static bool compact(_State* s) {
+        uint64_t freed = 0;
+        for (const auto& [off, n] : s->free) freed += n;
+        if (freed < s->tail / 4) return false;
+
+        std::vector<size_t> order;
+        for (size_t g = 0; g < s->groups.size(); g++) if (s->groups[g].size != 0) order.push_back(g);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return s->groups[a].off > s->groups[b].off; });
+
+        bool moved = false;
+        for (size_t g : order) {
+            _Entry& e = s->groups[g];
+            uint64_t to = alloc(s, e.size, e.off);
+            if (to == 0) continue;
+
+            s->zbuf.resize(e.size);
+            if (readAt(s, s->zbuf.data(), e.size, e.off) != SQLITE_OK || writeAt(s, s->zbuf.data(), e.size, to) != SQLITE_OK) {
+                release(s, to, e.size);
+                break;
+            }
+            s->pending.push_back({e.off, e.size});
+            e.off = to;
+            moved = true;
+        }
+        return moved;
+    }
+
+    // writes out everything and switches the header over
+    static int commit(_State* s, bool sync, int flags = 0, bool compacting = false) {
+        if (!s->changed) return SQLITE_OK;
+
+        int rc = spill(s);
+        if (rc != SQLITE_OK) return rc;
+
+        if (s->index.size != 0) s->pending.push_back({s->index.off, s->index.size});
+        s->index.size = (uint32_t) (s->groups.size() * entrySize);
+        s->index.off = s->index.size == 0 ? 0 : alloc(s, s->index.size);
+        if (s->index.size != 0 && (rc = writeAt(s, s->groups.data(), s->index.size, s->index.off)) != SQLITE_OK) return rc;
+        if (sync && (rc = s->real->pMethods->xSync(s->real, flags)) != SQLITE_OK) return rc;
+
+        char h[headerSize]{};
+        uint32_t groups = (uint32_t) s->groups.size();
+        uint64_t len = s->index.size;
+        s->gen++;
+        std::memcpy(h, magic, sizeof(magic));
+        std::memcpy(h + 8, &s->groupBytes, 4);
+        std::memcpy(h + 12, &groups, 4);
+        std::memcpy(h + 16, &s->size, 8);
+        std::memcpy(h + 24, &s->gen, 8);
+        std::memcpy(h + 32, &s->index.off, 8);
+        std::memcpy(h + 40, &len, 8);
+        if ((rc = writeAt(s, h, headerSize, 0)) != SQLITE_OK) return rc;
+        if (sync && (rc = s->real->pMethods->xSync(s->real, flags)) != SQLITE_OK) return rc;
+
+        for (const auto& [off, n] : s->pending) release(s, off, n);
+        s->pending.clear();
+
+        // give back free space at the end
+        if (!s->free.empty()) {
+            auto last = std::prev(s->free.end());
+            if (last->first + last->second >= s->tail) {
+                s->tail = last->first;
+                s->free.erase(last);
+                if ((rc = s->real->pMethods->xTruncate(s->real, (sqlite3_int64) s->tail)) != SQLITE_OK) return rc;
+            }
+        }
+
+        s->changed = false;
+        if (!compacting && compact(s)) {
+            s->changed = true;
+            return commit(s, sync, flags, true);
+        }
+        return SQLITE_OK;
+    }
+
+    static int xClose(sqlite3_file* f) {
+        _State* s = state(f);
+        int rc = commit(s, false);
+        int rc2 = s->real->pMethods->xClose(s->real);
+        delete s;
+        return rc != SQLITE_OK ? rc : rc2;
+    }
+
+    static int xRead(sqlite3_file* f, void* out, int amt, sqlite3_int64 off) {
+        _State* s = state(f);
+        char* p = (char*) out;
+        uint64_t at = (uint64_t) off, end = at + amt;
+
+        while (at < end) {
+            uint64_t g = at / s->groupBytes, start = at - g * s->groupBytes;
+            uint64_t n = std::min(end - at, (uint64_t) s->groupBytes - start);
+
+            const std::string* data;
+            int rc = group(s, g, &data);
+            if (rc != SQLITE_OK) return rc;
+
+            uint64_t have = data->size() > start ? std::min(n, data->size() - start) : 0;
+            have = std::min(have, s->size > at ? s->size - at : 0);
+            if (have != 0) std::memcpy(p, data->data() + start, have);
+            if (have < n) std::memset(p + have, 0, n - have);
+
+            p += n;
+            at += n;
+        }
+        return (uint64_t) off + amt > s->size ? SQLITE_IOERR_SHORT_READ : SQLITE_OK;
+    }
+
+    static int xWrite(sqlite3_file* f, const void* in, int amt, sqlite3_int64 off) {
+        _State* s = state(f);
+        const char* p = (const char*) in;
+        uint64_t at = (uint64_t) off, end = at + amt;
+
+        while (at < end) {
+            uint64_t g = at / s->groupBytes, start = at - g * s->groupBytes;
+            uint64_t n = std::min(end - at, (uint64_t) s->groupBytes - start);
+
+            auto d = s->dirty.find(g);
+            if (d == s->dirty.end()) {
+                const std::string* data;
+                int rc = group(s, g, &data);
+                if (rc != SQLITE_OK) return rc;
+                d = s->dirty.emplace(g, std::move(s->cache[g])).first;
+                s->cache.erase(g);
+            }
+
+            std::string& data = d->second;
+            if (data.size() < start + n) data.resize(start + n);
+            std::memcpy(data.data() + start, p, n);
+
+            p += n;
+            at += n;
+        }
+        s->size = std::max(s->size, end);
+        s->changed = true;
+
+        if (s->dirty.size() * s->groupBytes > dirtyMax) return spill(s);
+        return SQLITE_OK;
+    }
+
+    static int xTruncate(sqlite3_file* f, sqlite3_int64 size) {
+        _State* s = state(f);
+        uint64_t n = (uint64_t) size;
+        if (n >= s->size) return SQLITE_OK;
+
+        // the group holding the new end keeps its start, the rest are dropped (their space is free after the next commit)
+        uint64_t g = n / s->groupBytes, keep = n - g * s->groupBytes, count = g + (keep != 0);
+        for (auto it = s->dirty.lower_bound(count); it != s->dirty.end();) it = s->dirty.erase(it);
+        std::erase_if(s->cache, [&](const auto& c) { return c.first >= count; });
+        for (size_t i = count; i < s->groups.size(); i++) if (s->groups[i].size != 0) s->pending.push_back({s->groups[i].off, s->groups[i].size});
+        if (s->groups.size() > count) s->groups.resize(count);
+
+        if (keep != 0) {
+            const std::string* data;
+            int rc = group(s, g, &data);
+            if (rc != SQLITE_OK) return rc;
+            auto d = s->dirty.find(g);
+            if (d == s->dirty.end()) {
+                d = s->dirty.emplace(g, std::move(s->cache[g])).first;
+                s->cache.erase(g);
+            }
+            if (d->second.size() > keep) d->second.resize(keep);
+        }
+
+        s->size = n;
+        s->changed = true;
+        return SQLITE_OK;
+    }
+
+    static int xSync(sqlite3_file* f, int flags) { return commit(state(f), true, flags); }
+
+    static int xFileSize(sqlite3_file* f, sqlite3_int64* out) {
+        *out = (sqlite3_int64) state(f)->size;
+        return SQLITE_OK;
+    }
+
+    // another connection may have committed while we did not hold a lock
+    static int xLock(sqlite3_file* f, int level) {
+        _State* s = state(f);
+        int rc = s->real->pMethods->xLock(s->real, level);
+        if (rc != SQLITE_OK) return rc;
+
+        if (s->lock == SQLITE_LOCK_NONE) {
+            char h[headerSize];
+            uint64_t gen = 0;
+            if (readAt(s, h, headerSize, 0) == SQLITE_OK) std::memcpy(&gen, h + 24, 8);
+            if (gen != s->gen && (rc = load(s)) != SQLITE_OK) return rc;
+        }
+        s->lock = level;
+        return SQLITE_OK;
+    }
+
+    // sqlite does not sync at all with synchronous = off, so this is where those commits happen
+    static int xUnlock(sqlite3_file* f, int level) {
+        _State* s = state(f);
+        if (level < SQLITE_LOCK_RESERVED) {
+            int rc = commit(s, false);
+            if (rc != SQLITE_OK) return rc;
+        }
+        s->lock = level;
+        return s->real->pMethods->xUnlock(s->real, level);
+    }
+
+    static int xCheckReservedLock(sqlite3_file* f, int* out) { return state(f)->real->pMethods->xCheckReservedLock(state(f)->real, out); }
+    static int xFileControl(sqlite3_file*, int, void*) { return SQLITE_NOTFOUND; }
+    static int xSectorSize(sqlite3_file* f) { return state(f)->real->pMethods->xSectorSize(state(f)->real); }
+    static int xDeviceCharacteristics(sqlite3_file*) { return SQLITE_IOCAP_POWERSAFE_OVERWRITE; }
+
+    static constexpr sqlite3_io_methods methods = {
+        1, xClose, xRead, xWrite, xTruncate, xSync, xFileSize, xLock, xUnlock, xCheckReservedLock, xFileControl, xSectorSize, xDeviceCharacteristics,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr
+    };
+
+    static int xOpen(sqlite3_vfs* v, sqlite3_filename name, sqlite3_file* f, int flags, int* outFlags) {
+        ZstdVfs* self = (ZstdVfs*) v->pAppData;
+        sqlite3_vfs* root = self->root;
+        if (!(flags & SQLITE_OPEN_MAIN_DB)) return root->xOpen(root, name, f, flags, outFlags);
+
+        sqlite3_file* real = (sqlite3_file*) ((_File*) f + 1);
+        int rc = root->xOpen(root, name, real, flags, outFlags);
+        if (rc != SQLITE_OK) return rc;
+
+        // existing plain database, reopened directly so it is the default vfs file
+        char h[16];
+        if (real->pMethods->xRead(real, h, sizeof(h), 0) == SQLITE_OK && std::memcmp(h, "SQLite format 3", 16) == 0) {
+            real->pMethods->xClose(real);
+            return root->xOpen(root, name, f, flags, outFlags);
+        }
+
+        _State* s = new _State();
+        s->real = real;
+        s->vfs = self;
+        s->groupBytes = self->groupBytes;
+        s->cctx = ZSTD_createCCtx();
+        s->dctx = ZSTD_createDCtx();
+        if ((rc = load(s)) != SQLITE_OK) {
+            real->pMethods->xClose(real);
+            delete s;
+            f->pMethods = nullptr;
+            return rc;
+        }
+
+        ((_File*) f)->st = s;
+        f->pMethods = &methods;
+        return SQLITE_OK;
+    }
+public:
+    // registers the vfs under name (not as the default), level is the zstd level, groupBytes how much is compressed together
+    // (more compresses better but every page read or written has to go through its whole group)
+    ZstdVfs(const std::string& name = "zstd", int level = 3, uint32_t groupBytes = 1 << 16) : name(name), level(level), groupBytes(groupBytes) {
+        root = sqlite3_vfs_find(nullptr);
+        if (!root) throw std::runtime_error("(vfs.hpp) No default sqlite vfs");
+
+        vfs.iVersion = 2;
+        vfs.szOsFile = (int) sizeof(_File) + root->szOsFile;
+        vfs.mxPathname = root->mxPathname;
+        vfs.zName = this->name.c_str();
+        vfs.pAppData = this;
+        vfs.xOpen = xOpen;
+        vfs.xDelete = [](sqlite3_vfs* v, const char* n, int sync) { return rootOf(v)->xDelete(rootOf(v), n, sync); };
+        vfs.xAccess = [](sqlite3_vfs* v, const char* n, int flags, int* out) { return rootOf(v)->xAccess(rootOf(v), n, flags, out); };
+        vfs.xFullPathname = [](sqlite3_vfs* v, const char* n, int len, char* out) { return rootOf(v)->xFullPathname(rootOf(v), n, len, out); };
+        vfs.xDlOpen = [](sqlite3_vfs* v, const char* n) { return rootOf(v)->xDlOpen(rootOf(v), n); };
+        vfs.xDlError = [](sqlite3_vfs* v, int len, char* out) { rootOf(v)->xDlError(rootOf(v), len, out); };
+        vfs.xDlSym = [](sqlite3_vfs* v, void* h, const char* n) { return rootOf(v)->xDlSym(rootOf(v), h, n); };
+        vfs.xDlClose = [](sqlite3_vfs* v, void* h) { rootOf(v)->xDlClose(rootOf(v), h); };
+        vfs.xRandomness = [](sqlite3_vfs* v, int len, char* out) { return rootOf(v)->xRandomness(rootOf(v), len, out); };
+        vfs.xSleep = [](sqlite3_vfs* v, int us) { return rootOf(v)->xSleep(rootOf(v), us); };
+        vfs.xCurrentTime = [](sqlite3_vfs* v, double* out) { return rootOf(v)->xCurrentTime(rootOf(v), out); };
+        vfs.xGetLastError = [](sqlite3_vfs* v, int len, char* out) { return rootOf(v)->xGetLastError(rootOf(v), len, out); };
+        vfs.xCurrentTimeInt64 = [](sqlite3_vfs* v, sqlite3_int64* out) { return rootOf(v)->xCurrentTimeInt64(rootOf(v), out); };
+
+        int rc = sqlite3_vfs_register(&vfs, 0);
+        if (rc != SQLITE_OK) throw std::runtime_error(std::format("(vfs.hpp) Unable to register vfs {}: {}", name, sqlite3_errstr(rc)));
+    }
+
+    // every connection using it has to be closed first
+    ~ZstdVfs() { sqlite3_vfs_unregister(&vfs); }
+
+    ZstdVfs(const ZstdVfs&) = delete;
+    ZstdVfs& operator=(const ZstdVfs&) = delete;
+
+    const char* id() const { return name.c_str(); }
+};
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef CMSC_VTAB_HPP
+#define CMSC_VTAB_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <filesystem>
+#include <generator>
+#include <ranges>
+#include <cstdlib>
+#include <format>
+
+#include "sqlite3.h"
+#include "types.hpp"
+#include "reader.hpp"
+
+// read only sqlite virtual table straight over a dump, one row per valid record with the columns of a schema
+// (the same rows read() would have inserted), so an ad hoc query is one streaming pass and nothing is written to disk
+//
+//     registerDump<Comment>(db, "dump_comments", schema);
+//     CREATE VIRTUAL TABLE temp.rc USING dump_comments('/path/RC_2024-10.zst');
+//     SELECT count(*) FROM rc WHERE subreddit = 'AskReddit' AND distinguished = 2;
+//
+// xBestIndex hands every =, <, <=, >, >= constraint down, those are checked right after a record is parsed and only
+// the columns the query uses (plus the constrained ones) are filled, i.e. lexicon counts are not computed unless asked for
+// equality on a raw text column (see schema.hpp) also skips lines that do not contain the quoted value before parsing them
+// sqlite still checks every constraint itself afterwards, the ones here only have to never drop a row it would keep
+// rowid is the line number in the file
+template <TRedditData T, TSchema<T> S>
+class DumpModule {
+private:
+    struct _Table {
+        sqlite3_vtab base{};
+        const S* schema;
+        std::string file;
+    };
+
+    struct _Constraint {
+        size_t col;
+        int op;
+        SchemaValue v;
+        std::string text;
+    };
+
+    struct _Cursor {
+        sqlite3_vtab_cursor base{};
+
+        // generator is declared after the reader so it is destroyed first
+        std::unique_ptr<Reader> reader;
+        std::optional<std::generator<const T&>> gen;
+        std::ranges::iterator_t<std::generator<const T&>> it;
+
+        std::vector<_Constraint> cons;
+        std::vector<SchemaValue> row;
+        uint64_t used = 0;
+
+        sqlite3_int64 rowid = 0;
+        bool eof = true;
+    };
+
+    static bool plain(std::string_view s) {
+        if (s.empty()) return false;
+        for (char c : s) {
+            if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) return false;
+        }
+        return true;
+    }
+
+    static bool numeric(const SchemaValue& v) { return v.kind == SchemaValue::SV_INT || v.kind == SchemaValue::SV_REAL; }
+
+    // false only if sqlite would also say false, mixed types (i.e. parent_id is sometimes an int) are left to sqlite
+    static bool test(const SchemaValue& a, const _Constraint& c) {
+        if (a.kind == SchemaValue::SV_NULL) return false;
+
+        int cmp;
+        if (numeric(a) && numeric(c.v)) {
+            if (a.kind == SchemaValue::SV_INT && c.v.kind == SchemaValue::SV_INT) cmp = a.i < c.v.i ? -1 : a.i > c.v.i;
+            else {
+                double x = a.kind == SchemaValue::SV_INT ? (double) a.i : a.d;
+                double y = c.v.kind == SchemaValue::SV_INT ? (double) c.v.i : c.v.d;
+                cmp = x < y ? -1 : x > y;
+            }
+        } else if (a.kind == SchemaValue::SV_TEXT && c.v.kind == SchemaValue::SV_TEXT) {
+            int r = a.s.compare(c.v.s);
+            cmp = r < 0 ? -1 : r > 0;
+        } else return true;
+
+        switch (c.op) {
+            case SQLITE_INDEX_CONSTRAINT_EQ: return cmp == 0;
+            case SQLITE_INDEX_CONSTRAINT_GT: return cmp > 0;
+            case SQLITE_INDEX_CONSTRAINT_GE: return cmp >= 0;
+            case SQLITE_INDEX_CONSTRAINT_LT: return cmp < 0;
+            case SQLITE_INDEX_CONSTRAINT_LE: return cmp <= 0;
+        }
+        return true;
+    }
+
+    static int connect(sqlite3* db, void* aux, int argc, const char* const* argv, sqlite3_vtab** out, char** err) {
+        // argv is module, database, table, then the arguments
+        if (argc != 4) {
+            *err = sqlite3_mprintf("(vtab.hpp) Expected a single file argument");
+            return SQLITE_ERROR;
+        }
+
+        std::string file = argv[3];
+        if (file.size() >= 2 && (file.front() == '\'' || file.front() == '"') && file.back() == file.front()) file = file.substr(1, file.size() - 2);
+        if (!std::filesystem::exists(file)) {
+            *err = sqlite3_mprintf("(vtab.hpp) Unknown file %s", file.c_str());
+            return SQLITE_ERROR;
+        }
+
+        const S* schema = (const S*) aux;
+        std::string decl = "CREATE TABLE x(";
+        for (size_t i = 0; i < schema->fields().size(); i++) {
+            const auto& [k, type] = schema->fields()[i];
+            if (i != 0) decl += ",";
+            decl += k + (type == ST_TEXT ? " TEXT" : type == ST_REAL ? " REAL" : type == ST_BLOB ? " BLOB" : " INTEGER");
+        }
+        decl += ")";
+
+        int rc = sqlite3_declare_vtab(db, decl.c_str());
+        if (rc != SQLITE_OK) return rc;
+
+        _Table* t = new _Table();
+        t->schema = schema;
+        t->file = file;
+        *out = &t->base;
+        return SQLITE_OK;
+    }
+
+    static int disconnect(sqlite3_vtab* v) {
+        delete (_Table*) v;
+        return SQLITE_OK;
+    }
+
+    // idxStr is the used column mask followed by column:op for each argument, in order
+    static int bestIndex(sqlite3_vtab*, sqlite3_index_info* info) {
+        std::string idx = std::format("{:x}", (uint64_t) info->colUsed);
+        int n = 0;
+        for (int i = 0; i < info->nConstraint; i++) {
+            const auto& c = info->aConstraint[i];
+            if (!c.usable || c.iColumn < 0) continue;
+            if (c.op != SQLITE_INDEX_CONSTRAINT_EQ && c.op != SQLITE_INDEX_CONSTRAINT_GT && c.op != SQLITE_INDEX_CONSTRAINT_GE &&
+                c.op != SQLITE_INDEX_CONSTRAINT_LT && c.op != SQLITE_INDEX_CONSTRAINT_LE) continue;
+            // text is compared byte wise
+            if (sqlite3_stricmp(sqlite3_vtab_collation(info, i), "BINARY") != 0) continue;
+
+            info->aConstraintUsage[i].argvIndex = ++n;
+            info->aConstraintUsage[i].omit = 0;
+            idx += std::format(",{}:{}", c.iColumn, c.op);
+        }
+
+        info->idxStr = sqlite3_mprintf("%s", idx.c_str());
+        info->needToFreeIdxStr = 1;
+        // always one pass over the file, constraints only make it cheaper
+        info->estimatedCost = 1e9 / (1 + n);
+        info->estimatedRows = 1000000;
+        return SQLITE_OK;
+    }
+
+    static int open(sqlite3_vtab*, sqlite3_vtab_cursor** out) {
+        _Cursor* c = new _Cursor();
+        *out = &c->base;
+        return SQLITE_OK;
+    }
+
+    static int close(sqlite3_vtab_cursor* cur) {
+        delete (_Cursor*) cur;
+        return SQLITE_OK;
+    }
+
+    // moves to the next record that passes every constraint
+    static void advance(_Cursor* c, const S* schema) {
+        for (; c->it != c->gen->end(); ++c->it) {
+            const T& j = *c->it;
+            c->rowid = c->reader->status().readLinesTotal + 1;
+
+            if constexpr (requires { schema->fill(j, c->row.data(), c->used); }) schema->fill(j, c->row.data(), c->used);
+            else schema->fill(j, c->row.data());
+
+            bool ok = true;
+            for (const auto& con : c->cons) {
+                if (!test(c->row[con.col], con)) {
+                    ok = false;
+                    break;
+                }
+            }
+            if (ok) {
+                c->eof = false;
+                return;
+            }
+        }
+        c->eof = true;
+    }
+
+    static int filter(sqlite3_vtab_cursor* cur, int, const char* idxStr, int argc, sqlite3_value** argv) {
+        _Cursor* c = (_Cursor*) cur;
+        _Table* t = (_Table*) cur->pVtab;
+        const S* schema = t->schema;
+
+        c->gen.reset();
+        c->reader = std::make_unique<Reader>(t->file, 0);
+        c->cons.clear();
+        c->row.assign(schema->size(), SchemaValue{});
+
+        char* p;
+        c->used = std::strtoull(idxStr, &p, 16);
+        for (int a = 0; a < argc && *p == ','; a++) {
+            size_t col = std::strtoull(p + 1, &p, 10);
+            int op = (int) std::strtol(p + 1, &p, 10);
+
+            // constraints whose value does not match the column type are left to sqlite
+            _Constraint con{col, op, {}, {}};
+            SchemaType type = schema->fields()[col].second;
+            switch (sqlite3_value_type(argv[a])) {
+                case SQLITE_INTEGER: if (type != ST_TEXT) con.v.integer(sqlite3_value_int64(argv[a])); break;
+                case SQLITE_FLOAT: if (type != ST_TEXT) con.v.real(sqlite3_value_double(argv[a])); break;
+                case SQLITE_TEXT:
+                    if (type != ST_TEXT) break;
+                    con.text.assign((const char*) sqlite3_value_text(argv[a]), sqlite3_value_bytes(argv[a]));
+                    con.v.kind = SchemaValue::SV_TEXT;
+                    break;
+            }
+            if (con.v.kind == SchemaValue::SV_NULL) continue;
+
+            c->used |= 1ull << std::min(col, (size_t) 63);
+            c->cons.push_back(std::move(con));
+        }
+        // text only points into cons once it stops moving
+        for (auto& con : c->cons) if (con.v.kind == SchemaValue::SV_TEXT) con.v.s = con.text;
+
+        std::vector<std::string> needles;
+        if constexpr (requires { schema->raw(0); }) {
+            for (const auto& con : c->cons) {
+                if (con.op == SQLITE_INDEX_CONSTRAINT_EQ && con.v.kind == SchemaValue::SV_TEXT && schema->raw(con.col) && plain(con.text))
+                    needles.push_back("\"" + con.text + "\"");
+            }
+        }
+        if (!needles.empty()) {
+            c->reader->prefilter([needles](std::string_view line) {
+                for (const auto& n : needles) if (line.find(n) == std::string_view::npos) return false;
+                return true;
+            });
+        }
+
+        c->gen.emplace(c->reader->template decompress<T>(1000000, 0, false));
+        c->it = c->gen->begin();
+        advance(c, schema);
+        return SQLITE_OK;
+    }
+
+    static int next(sqlite3_vtab_cursor* cur) {
+        _Cursor* c = (_Cursor*) cur;
+        ++c->it;
+        advance(c, ((_Table*) cur->pVtab)->schema);
+        return SQLITE_OK;
+    }
+
+    static int eof(sqlite3_vtab_cursor* cur) { return ((_Cursor*) cur)->eof; }
+
+    static int column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int i) {
+        const SchemaValue& v = ((_Cursor*) cur)->row[i];
+        switch (v.kind) {
+            case SchemaValue::SV_NULL: sqlite3_result_null(ctx); break;
+            case SchemaValue::SV_INT: sqlite3_result_int64(ctx, v.i); break;
+            case SchemaValue::SV_REAL: sqlite3_result_double(ctx, v.d); break;
+            case SchemaValue::SV_TEXT: sqlite3_result_text(ctx, v.s.data(), (int) v.s.size(), SQLITE_TRANSIENT); break;
+            case SchemaValue::SV_BLOB: sqlite3_result_blob(ctx, v.s.data(), (int) v.s.size(), SQLITE_TRANSIENT); break;
+        }
+        return SQLITE_OK;
+    }
+
+    static int rowid(sqlite3_vtab_cursor* cur, sqlite3_int64* out) {
+        *out = ((_Cursor*) cur)->rowid;
+        return SQLITE_OK;
+    }
+public:
+    static const sqlite3_module* module() {
+        static sqlite3_module m = [] {
+            sqlite3_module m{};
+            m.xCreate = connect;
+            m.xConnect = connect;
+            m.xBestIndex = bestIndex;
+            m.xDisconnect = disconnect;
+            m.xDestroy = disconnect;
+            m.xOpen = open;
+            m.xClose = close;
+            m.xFilter = filter;
+            m.xNext = next;
+            m.xEof = eof;
+            m.xColumn = column;
+            m.xRowid = rowid;
+            return m;
+        }();
+        return &m;
+    }
+};
+
+// makes module available on db (schema is copied and lives as long as the connection)
+template <TRedditData T, TSchema<T> S>
+void registerDump(sqlite3* db, const std::string& module, const S& schema) {
+    S* copy = new S(schema);
+    int rc = sqlite3_create_module_v2(db, module.c_str(), DumpModule<T, S>::module(), copy, [](void* p) { delete (S*) p; });
+    if (rc != SQLITE_OK) throw std::runtime_error(std::format("(vtab.hpp) Unable to register module {}: {}", module, sqlite3_errmsg(db)));
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef CMSC_ZDICT_HPP
+#define CMSC_ZDICT_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+#include <format>
+
+#include <zstd.h>
+#include <zdict.h>
+
+#include "sqlite3.h"
+
+// zstd dictionary for texts that are too short to compress well on their own (bodies), trained on a sample of them
+// every frame keeps the id of its dictionary, so reading back only needs the dictionaries table (see ZstdDicts and zbody)
+// not thread safe, there is one compression and one decompression context
+class ZstdDict {
+private:
+    std::string dict;
+    unsigned id;
+
+    ZSTD_CDict* cdict = nullptr;
+    ZSTD_DDict* ddict = nullptr;
+    ZSTD_CCtx* cctx = nullptr;
+    ZSTD_DCtx* dctx = nullptr;
+public:
+    static constexpr const char* table = "dictionaries";
+
+    // bytes that went in and came out of compress
+    size_t raw = 0;
+    size_t packed = 0;
+
+    ZstdDict(std::string bytes, int level = 3) : dict(std::move(bytes)) {
+        id = ZDICT_getDictID(dict.data(), dict.size());
+        if (id == 0) throw std::runtime_error("(zdict.hpp) Not a zstd dictionary");
+
+        cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+        ddict = ZSTD_createDDict(dict.data(), dict.size());
+        cctx = ZSTD_createCCtx();
+        dctx = ZSTD_createDCtx();
+    }
+
+    ~ZstdDict() {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+
+    ZstdDict(const ZstdDict&) = delete;
+    ZstdDict& operator=(const ZstdDict&) = delete;
+
+    // dictionary is at most bytes long, zstd wants around 100x that in samples
+    static std::string train(const std::vector<std::string>& samples, size_t bytes = 112640) {
+        std::string all;
+        std::vector<size_t> sizes;
+        for (const auto& s : samples) {
+            all += s;
+            sizes.push_back(s.size());
+        }
+
+        std::string out(bytes, '\0');
+        size_t n = ZDICT_trainFromBuffer(out.data(), out.size(), all.data(), sizes.data(), (unsigned) sizes.size());
+        if (ZDICT_isError(n)) throw std::runtime_error(std::format("(zdict.hpp) Unable to train dictionary: {}", ZDICT_getErrorName(n)));
+        out.resize(n);
+        return out;
+    }
+
+    unsigned dictId() const { return id; }
+    const std::string& bytes() const { return dict; }
+
+    // into out, returns a view of it
+    std::string_view compress(std::string_view in, std::string& out) {
+        out.resize(ZSTD_compressBound(in.size()));
+        size_t n = ZSTD_compress_usingCDict(cctx, out.data(), out.size(), in.data(), in.size(), cdict);
+        if (ZSTD_isError(n)) throw std::runtime_error(std::format("(zdict.hpp) zstd error: {}", ZSTD_getErrorName(n)));
+        out.resize(n);
+
+        raw += in.size();
+        packed += n;
+        return out;
+    }
+
+    std::string_view decompress(std::string_view in, std::string& out) {
+        unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) throw std::runtime_error("(zdict.hpp) Not a compressed body");
+
+        out.resize(size);
+        size_t n = ZSTD_decompress_usingDDict(dctx, out.data(), out.size(), in.data(), in.size(), ddict);
+        if (ZSTD_isError(n)) throw std::runtime_error(std::format("(zdict.hpp) zstd error: {}", ZSTD_getErrorName(n)));
+        out.resize(n);
+        return out;
+    }
+
+    // 0 if the frame does not name a dictionary (or is not a frame at all)
+    static unsigned frameId(std::string_view frame) { return ZSTD_getDictID_fromFrame(frame.data(), frame.size()); }
+
+    // into the dictionaries table of db (if it is already there it only becomes the newest again)
+    // added is the order they were saved in, id is the zstd dictionary id (and so the rowid), which says nothing about age
+    void save(sqlite3* db) const {
+        auto run = [db](const std::string& cmd) {
+            if (sqlite3_exec(db, cmd.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) throw std::runtime_error(std::format("(zdict.hpp) Unable to save dictionary: {}", sqlite3_errmsg(db)));
+        };
+        run(std::format("CREATE TABLE IF NOT EXISTS {} (id INTEGER PRIMARY KEY, dict BLOB, added INTEGER)", table));
+        // tables from before added was a column, the dictionaries already in them are older than any saved from now on
+        if (sqlite3_exec(db, std::format("SELECT added FROM {} LIMIT 0", table).c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+            run(std::format("ALTER TABLE {} ADD COLUMN added INTEGER", table));
+
+        std::string cmd = std::format("INSERT INTO {0} VALUES (?, ?, (SELECT coalesce(max(added), 0) + 1 FROM {0})) ON CONFLICT (id) DO UPDATE SET added = excluded.added", table);
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, cmd.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error(std::format("(zdict.hpp) Unable to save dictionary: {}", sqlite3_errmsg(db)));
+        sqlite3_bind_int64(stmt, 1, id);
+        sqlite3_bind_blob(stmt, 2, dict.data(), dict.size(), SQLITE_STATIC);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) throw std::runtime_error(std::format("(zdict.hpp) Unable to save dictionary: {}", sqlite3_errmsg(db)));
+    }
+
+    // newest dictionary stored in db (the last one saved), empty if there is none
+    // a table from before added has no order to go by, so its dictionaries are never the newest and a new one is trained
+    static std::string latest(sqlite3* db) {
+        std::string out;
+        std::string cmd = std::format("SELECT dict FROM {} WHERE added IS NOT NULL ORDER BY added DESC LIMIT 1", table);
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, cmd.c_str(), -1, &stmt, nullptr) != SQLITE_OK) return out;
+        if (sqlite3_step(stmt) == SQLITE_ROW) out.assign((const char*) sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+        sqlite3_finalize(stmt);
+        return out;
+    }
+};
+
+// dictionaries of a database by id, loaded from its dictionaries table on first use
+class ZstdDicts {
+private:
+    sqlite3* db;
+    std::unordered_map<unsigned, std::unique_ptr<ZstdDict>> dicts;
+public:
+    ZstdDicts(sqlite3* db) : db(db) {}
+
+    // compressed bodies go through the dictionary they were compressed with, anything else is returned as is
+    std::string_view decode(std::string_view v, std::string& out) {
+        unsigned id = ZstdDict::frameId(v);
+        if (id == 0) return v;
+
+        auto it = dicts.find(id);
+        if (it == dicts.end()) {
+            std::string cmd = std::format("SELECT dict FROM {} WHERE id = {}", ZstdDict::table, id);
+            sqlite3_stmt* stmt;
+            if (sqlite3_prepare_v2(db, cmd.c_str(), -1, &stmt, nullptr) != SQLITE_OK) throw std::runtime_error(std::format("(zdict.hpp) No dictionaries: {}", sqlite3_errmsg(db)));
+            std::string bytes;
+            if (sqlite3_step(stmt) == SQLITE_ROW) bytes.assign((const char*) sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+            sqlite3_finalize(stmt);
+            if (bytes.empty()) throw std::runtime_error(std::format("(zdict.hpp) Missing dictionary {}", id));
+
+            it = dicts.emplace(id, std::make_unique<ZstdDict>(std::move(bytes))).first;
+        }
+        return it->second->decompress(v, out);
+    }
+};
+
+// zbody(x) is x decompressed if it is a compressed body (blob), otherwise x as is, so queries read the same either way
+// i.e. SELECT zbody(body) FROM r_users
+inline void registerZbody(sqlite3* db) {
+    auto fn = [](sqlite3_context* ctx, int, sqlite3_value** argv) {
+        if (sqlite3_value_type(argv[0]) != SQLITE_BLOB) {
+            sqlite3_result_value(ctx, argv[0]);
+            return;
+        }
+
+        std::string_view v((const char*) sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]));
+        std::string out;
+        try {
+            std::string_view r = ((ZstdDicts*) sqlite3_user_data(ctx))->decode(v, out);
+            sqlite3_result_text(ctx, r.data(), (int) r.size(), SQLITE_TRANSIENT);
+        } catch (const std::exception& e) {
+            sqlite3_result_error(ctx, e.what(), -1);
+        }
+    };
+
+    int rc = sqlite3_create_function_v2(db, "zbody", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, new ZstdDicts(db), fn, nullptr, nullptr,
+        [](void* p) { delete (ZstdDicts*) p; });
+    if (rc != SQLITE_OK) throw std::runtime_error(std::format("(zdict.hpp) Unable to register zbody: {}", sqlite3_errmsg(db)));
+}
+
+#endif
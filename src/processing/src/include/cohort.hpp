@@ -0,0 +1,225 @@
+#ifndef CMSC_COHORT_HPP
+#define CMSC_COHORT_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+#include "wrapper.hpp"
+#include "mphf.hpp"
+
+// columns of a cohort table, every post of the author as it is in the dump (see CommentRecord, Context)
+template <TRedditText T>
+auto cohortSchema(const std::string& table) {
+    return compileSchema<T>(table,
+        C_TEXT(author),
+        C_TEXT(subreddit),
+        // packed, same as main
+        column<"id", ST_INT>([](const T& j, SchemaValue& out) {
+            int64_t v = packId(j.id, TReply<T> ? ID_COMMENT : ID_SUBMISSION);
+            if (v) out.integer(v);
+            else out.null();
+        }),
+        column<"parent_id", ST_INT>([](const T& j, SchemaValue& out) {
+            if constexpr (TReply<T>) {
+                int64_t v = packId(j.parent_id);
+                if (v) out.integer(v);
+                else out.null();
+            } else out.null();
+        }),
+        column<"created_utc", ST_INT>([](const T& j, SchemaValue& out) { out.integer(toInt(j.created_utc)); }),
+        C_INT(score),
+        C_INT(num_sentences),
+        column<"distinguished", ST_INT>([](const T& j, SchemaValue& out) { out.integer(getDistinguished(j.distinguished)); }),
+        column<"body", ST_TEXT>([](const T& j, SchemaValue& out) { out.text(j.text()); })
+    );
+}
+
+template <TRedditText T>
+using CohortSchema = decltype(cohortSchema<T>(""));
+
+struct Cohort_Output {
+    std::string month;
+    size_t rows = 0;
+    size_t lines = 0;
+    // lines thrown away on their raw author alone
+    size_t rejected = 0;
+    int64_t ms = 0;
+};
+
+// full posting histories of a fixed list of authors over many months of dumps, i.e. everyone that was sampled into r_mods
+// the names go into a minimal perfect hash (see mphf.hpp) and every raw line is checked on its "author" before it is parsed, so only
+// the cohort's own lines ever get to glaze
+// months are read in parallel (one thread each, up to threads at a time) into scratch files next to out, which are then moved into
+// out as one table per month (cohort_2024_10 for 2024-10) with a cohort view over all of them (month, then the cohort columns)
+// a month that is read again replaces its table, the others are kept
+class Cohort {
+private:
+    struct _Month {
+        std::string month;
+        std::string cmt;
+        std::string sub;
+    };
+
+    PerfectHash authors;
+    std::vector<_Month> months;
+
+    static std::string tableName(const std::string& month) {
+        std::string out = "cohort_";
+        for (char c : month) out += std::isalnum((unsigned char) c) ? c : '_';
+        return out;
+    }
+
+    static void exec(sqlite3* db, const std::string& cmd) {
+        char* err = nullptr;
+        if (sqlite3_exec(db, cmd.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+            std::string msg = err ? err : sqlite3_errmsg(db);
+            sqlite3_free(err);
+            throw std::runtime_error("(cohort.hpp) Could not run " + cmd + "\n  " + msg);
+        }
+    }
+
+    // one month into its own scratch file, comments and submissions share the table
+    Cohort_Output read(const _Month& m, const std::string& scratch) {
+        Cohort_Output r{};
+        r.month = m.month;
+        auto start = Benchmark::timestamp();
+        if (fs::exists(scratch)) fs::remove(scratch);
+
+        // nested objects can have an author too (crossposts), so any match lets the line through and the filter checks the real one
+        auto keep = [&](std::string_view line) {
+            r.lines++;
+            size_t at = 0;
+            std::string_view name;
+            while (rawString(line, "\"author\":", at, name)) if (authors.contains(name)) return true;
+            r.rejected++;
+            return false;
+        };
+
+        std::string table = tableName(m.month);
+        {
+            Database<ContextComment, CohortSchema<ContextComment>> db(scratch, cohortSchema<ContextComment>(table));
+            db.setPrefilter(keep);
+            db.setFilter([&](const ContextComment& j) { return authors.contains(j.author); });
+            r.rows += db.read(m.cmt).readLinesValid();
+        }
+        {
+            Database<ContextSubmission, CohortSchema<ContextSubmission>> db(scratch, cohortSchema<ContextSubmission>(table));
+            db.setPrefilter(keep);
+            db.setFilter([&](const ContextSubmission& j) { return authors.contains(j.author); });
+            r.rows += db.read(m.sub).readLinesValid();
+        }
+
+        r.ms = Benchmark::elapsed_ms(start);
+        return r;
+    }
+public:
+    static constexpr const char* view = "cohort";
+    static constexpr const char* manifest = "cohort_months";
+
+    explicit Cohort(const std::vector<std::string>& names) : authors(names) {
+        initSentenceEnds();
+        std::cout << std::format("cohort: {} authors, {} KiB\n", authors.size(), authors.bytes() / 1024);
+    }
+
+    // one name per line
+    static std::vector<std::string> load(const std::string& file) {
+        std::ifstream f(file);
+        if (!f) throw std::runtime_error("(cohort.hpp) Unable to open " + file);
+
+        std::vector<std::string> out;
+        for (std::string line; std::getline(f, line);) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) out.push_back(line);
+        }
+        return out;
+    }
+
+    void add(const std::string& month, const std::string& comments, const std::string& submissions) {
+        months.push_back({month, comments, submissions});
+    }
+
+    std::vector<Cohort_Output> run(const std::string& out, int threads = std::max(1, (int) std::thread::hardware_concurrency() / 2)) {
+        std::vector<Cohort_Output> r(months.size());
+        std::atomic<size_t> next = 0;
+        std::exception_ptr err;
+        std::mutex errLock;
+
+        auto scratch = [&](size_t i) { return std::format("{}.{}.cohort", out, tableName(months[i].month)); };
+        {
+            std::vector<std::jthread> pool;
+            for (int t = 0; t < std::min(threads, (int) months.size()); t++) {
+                pool.emplace_back([&]() {
+                    for (size_t i; (i = next++) < months.size();) {
+                        try {
+                            r[i] = read(months[i], scratch(i));
+                        } catch (...) {
+                            std::lock_guard l(errLock);
+                            if (!err) err = std::current_exception();
+                            next = months.size();
+                        }
+                    }
+                });
+            }
+        }
+        if (err) std::rethrow_exception(err);
+
+        sqlite3* db;
+        if (sqlite3_open_v2(out.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+            sqlite3_close(db);
+            throw std::runtime_error("(cohort.hpp) Could not open " + out);
+        }
+
+        try {
+            std::string columns = cohortSchema<ContextComment>("").columns();
+            exec(db, std::format("CREATE TABLE IF NOT EXISTS {} (month TEXT PRIMARY KEY, tbl TEXT, rows INTEGER, authors INTEGER)", manifest));
+            for (size_t i = 0; i < months.size(); i++) {
+                std::string table = tableName(months[i].month);
+                // unqualified names would find the table in part too
+                exec(db, std::format("ATTACH DATABASE '{}' AS part", scratch(i)));
+                exec(db, std::format(
+                    "BEGIN TRANSACTION; \
+                    DROP TABLE IF EXISTS main.{0}; \
+                    CREATE TABLE main.{0} ({1}) STRICT; \
+                    INSERT INTO main.{0} SELECT * FROM part.{0}; \
+                    CREATE INDEX main.{0}_author ON {0} (author, created_utc); \
+                    INSERT OR REPLACE INTO {2} VALUES ('{3}', '{0}', {4}, {5}); \
+                    END TRANSACTION;",
+                    table, columns, manifest, months[i].month, r[i].rows, authors.size()));
+                exec(db, "DETACH DATABASE part");
+                fs::remove(scratch(i));
+
+                std::cout << std::format("cohort {}: {} rows from {} lines, {} ({:.2f}%) rejected on the raw author, {} ms\n",
+                    r[i].month, r[i].rows, r[i].lines, r[i].rejected, r[i].lines ? 100.0 * r[i].rejected / r[i].lines : 0.0, r[i].ms);
+            }
+
+            // over every month in out, not just the ones of this run
+            std::string sel;
+            sqlite3_stmt* stmt;
+            std::string cmd = std::format("SELECT month, tbl FROM {} ORDER BY month", manifest);
+            sqlite3_prepare_v2(db, cmd.c_str(), -1, &stmt, nullptr);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                if (!sel.empty()) sel += " UNION ALL ";
+                sel += std::format("SELECT '{}' AS month, * FROM {}", (const char*) sqlite3_column_text(stmt, 0), (const char*) sqlite3_column_text(stmt, 1));
+            }
+            sqlite3_finalize(stmt);
+            exec(db, std::format("DROP VIEW IF EXISTS {}", view));
+            if (!sel.empty()) exec(db, std::format("CREATE VIEW {} AS {}", view, sel));
+        } catch (...) {
+            sqlite3_close(db);
+            throw;
+        }
+
+        sqlite3_close(db);
+        return r;
+    }
+};
+
+#endif
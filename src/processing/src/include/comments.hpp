@@ -8,11 +8,15 @@
 #include "common.hpp"
 #include "glaze/glaze.hpp"
 
-struct Comment {
+// Context keeps every record (see Wrapper::context), the body is then left as it is in the dump and only its sentences are counted
+template <bool Context = false>
+struct CommentRecord {
     std::string body;
     std::string subreddit;
     std::string id;
     std::variant<std::string, double> parent_id;
+    // the submission of the thread, for joining (see Wrapper::joinSubmissions)
+    std::string link_id;
     std::variant<std::string, double> created_utc;
     int score;
     std::optional<std::string> distinguished;
@@ -20,18 +24,51 @@ struct Comment {
     std::string author;
     int num_sentences;
 
+    // body compressed against the body dictionary (see zdict.hpp), only filled when main stores compressed bodies
+    mutable std::string packed;
+
     // because we just write to the same struct we need to reset the optional ones
     void reset() { distinguished.reset(); }
 
     bool valid() {
-        if (author == "AutoModerator") return false;
-        return sanitize(body, num_sentences);
+        if constexpr (Context) {
+            num_sentences = std::max(0, countSentences(body));
+            return true;
+        } else {
+            if (author == "AutoModerator") return false;
+            return sanitize(body, num_sentences);
+        }
     }
+
+    const std::string& text() const { return body; }
+};
+
+using Comment = CommentRecord<>;
+using ContextComment = CommentRecord<true>;
+
+// just what the reply graph needs (see Wrapper::replyGraph), every comment is valid since mods mostly write short replies
+struct CommentLink {
+    std::string id;
+    std::variant<std::string, double> parent_id;
+    std::optional<std::string> distinguished;
+
+    void reset() { distinguished.reset(); }
+    bool valid() { return true; }
+};
+
+// for the moderator roster (see Wrapper::modRoster), submissions have the same keys
+struct ModLink {
+    std::string author;
+    std::string subreddit;
+    std::optional<std::string> distinguished;
+
+    void reset() { distinguished.reset(); }
+    bool valid() { return distinguished && *distinguished == "moderator" && author != "[deleted]"; }
 };
 
-template <> struct glz::meta<Comment> {
+template <bool Context> struct glz::meta<CommentRecord<Context>> {
     static constexpr bool skip(const std::string_view key, const meta_context&) {
-        return key == "num_sentences";
+        return key == "num_sentences" || key == "packed";
     }
 };
 
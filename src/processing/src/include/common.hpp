@@ -3,54 +3,113 @@
 
 #include <string>
 #include <optional>
+#include <string_view>
+#include <vector>
+#include <cctype>
+#include <variant>
+#include <charconv>
+#include <cstdint>
+#include <algorithm>
 #include "database.hpp"
+#include "zdict.hpp"
 #include "ctre.hpp"
 
 // https://stackoverflow.com/questions/70857562/is-this-good-enough-to-check-an-ascii-string
 bool isAscii(const unsigned char& c) { return (c & 0x80) == 0; }
 
-// this is set in wrapper.hpp
+// this is set by initSentenceEnds (wrapper.hpp and the sql functions call it)
 bool s1_first[256] = {false};
 bool s1_second[256] = {false};
 bool s2_first[256];
 bool s2_second[256] = {false};
 
+void initSentenceEnds() {
+    s1_first['.'] = true;
+    s1_first['?'] = true;
+    s1_first['!'] = true;
+    s1_second['\0'] = true;
+    s1_second['\r'] = true;
+    s1_second['\n'] = true;
+    s1_second['\t'] = true;
+    s1_second['\f'] = true;
+    s1_second['\v'] = true;
+    s1_second[' '] = true;
+
+    std::fill_n(s2_first, 256, true);
+    s2_first['\r'] = false;
+    s2_first['\n'] = false;
+    s2_first['\t'] = false;
+    s2_first['\f'] = false;
+    s2_first['\v'] = false;
+    s2_second['\n'] = true;
+    s2_second['\0'] = true;
+}
+
 // https://support.reddithelp.com/hc/en-us/articles/360043033952-Formatting-Guide
 // markdown link, raw link (http:// or https://), # (headers), ^ or >
 // note that we dont match for stuff like _ * since those cant be done with regex
 // though a brief search shows that only a small percentage of text has them (maybe like 7%?)
 auto markdown = ctre::search_all<"\\[(.*?)\\]\\(.*?\\)|https?:\\/\\/\\S*|(^|\\n)[#>]+ *|([^\\\\])\\^">;
 
+// ((\.|\?|!)\s)|(\S| )(\n|$)
+// its not a perfect sentence matcher but generally close enough
+bool sentenceEnd(unsigned char c, unsigned char cc) { return (s1_first[c] && s1_second[cc]) || (s2_first[c] && s2_second[cc]); }
+
+// same boundaries as sanitize uses to count sentences, but keeps the (whitespace trimmed) sentences themselves
+// views point into body
+void splitSentences(std::string_view body, std::vector<std::string_view>& out) {
+    auto push = [&](size_t start, size_t end) {
+        while (start < end && std::isspace((unsigned char) body[start])) start++;
+        while (end > start && std::isspace((unsigned char) body[end - 1])) end--;
+        if (start != end) out.push_back(body.substr(start, end - start));
+    };
+
+    size_t len = body.size(), start = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char cc = i + 1 < len ? body[i + 1] : '\0';
+        if (sentenceEnd(body[i], cc)) {
+            push(start, i + 1);
+            start = ++i + 1;
+        }
+    }
+
+    if (start < len) push(start, len);
+}
+
 struct _Replacement {
     int pos; int len;
     std::string str;
 };
 
-bool sanitize(std::string& body, int& num_sentences) {
-    if (body.size() == 0 || body == "[deleted]") return false;
-
-    // you can get much better performance with re2 or hyperscan but those are a bit of a nightmare to install
-
-    // filter by ascii and num sentences, which removes ~95% of text (so below regex doesnt need to be run on everything)
-    num_sentences = 0;
-    int len = body.size(); // we have i + 1 which will get \0
-    for (int i = 0; i < len; i++) {
+// number of sentences the way sanitize counts them, -1 if body is not ascii
+int countSentences(std::string_view body) {
+    int num_sentences = 0;
+    size_t len = body.size();
+    for (size_t i = 0; i < len; i++) {
         unsigned char c = body[i];
-        unsigned char cc = body[i + 1];
+        unsigned char cc = i + 1 < len ? body[i + 1] : '\0';
 
-        if (!isAscii(c)) return false;
+        if (!isAscii(c)) return -1;
 
-        // ((\.|\?|!)\s)|(\S| )(\n|$)
-        // its not a perfect sentence matcher but generally close enough
-        if ((s1_first[c] && s1_second[cc]) || (s2_first[c] && s2_second[cc])) {
+        if (sentenceEnd(c, cc)) {
             num_sentences++;
             i++;
             // before we skip we also need to make sure the skipped char is ascii
-            if (!isAscii(cc)) return false;
+            if (!isAscii(cc)) return -1;
         }
     }
 
-    if (num_sentences < 5) return false;
+    return num_sentences;
+}
+
+bool sanitize(std::string& body, int& num_sentences, int minSentences = 5) {
+    if (body.size() == 0 || body == "[deleted]") return false;
+
+    // you can get much better performance with re2 or hyperscan but those are a bit of a nightmare to install
+
+    // filter by ascii and num sentences, which removes ~95% of text (so below regex doesnt need to be run on everything)
+    num_sentences = countSentences(body);
+    if (num_sentences < minSentences) return false;
 
     // remove disruptive markdown
     int offset = 0;
@@ -92,7 +151,7 @@ enum DistinguishedEnum {
     D_ADMIN
 };
 
-void getDistinguished(const std::optional<std::string>& in, std::string& out) {
+DistinguishedEnum getDistinguished(const std::optional<std::string>& in) {
     DistinguishedEnum d = D_ERROR;
     if (in.has_value()) {
         int ss = in->size();
@@ -100,7 +159,163 @@ void getDistinguished(const std::optional<std::string>& in, std::string& out) {
         else if (ss == 5) d = D_ADMIN;
     } else d = D_USER;
 
-    out = 48 + (char) d;
+    return d;
+}
+
+// dumps have timestamps (and sometimes ids) as either strings or numbers, parse once into an integer
+int64_t toInt(const std::variant<std::string, double>& in) {
+    const std::string* val = std::get_if<std::string>(&in);
+    if (!val) return (int64_t) std::get<double>(in);
+
+    int64_t out = 0;
+    std::from_chars(val->data(), val->data() + val->size(), out);
+    return out;
+}
+
+// reddit ids are base36 with a type prefix (t1_ comment, t3_ submission, ...), packed into one integer as id << 3 | type
+// type goes in the low bits so sqlite stores a 7 digit id in 6 bytes (text is ~10 and a header), and id and parent_id join as integers
+// type is used when id has no prefix (main.id does not), reddit_id(x) in sql turns it back into t1_abc123
+// 0 if id is empty, too long (60 bits is 11 digits, ids are 7 now) or not base36
+constexpr int ID_TYPE_BITS = 3;
+constexpr int ID_COMMENT = 1;
+constexpr int ID_SUBMISSION = 3;
+
+int64_t packId(std::string_view id, int type = 0) {
+    if (id.size() > 3 && id[0] == 't' && id[1] >= '1' && id[1] <= '7' && id[2] == '_') {
+        type = id[1] - '0';
+        id.remove_prefix(3);
+    }
+    if (id.empty() || id.size() > 11 || type < 0 || type >= (1 << ID_TYPE_BITS)) return 0;
+
+    int64_t v = 0;
+    for (unsigned char c : id) {
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'z') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'Z') d = c - 'A' + 10;
+        else return 0;
+        v = v * 36 + d;
+    }
+    return (v << ID_TYPE_BITS) | type;
+}
+
+std::string unpackId(int64_t packed) {
+    int type = (int) (packed & ((1 << ID_TYPE_BITS) - 1));
+    uint64_t v = (uint64_t) packed >> ID_TYPE_BITS;
+
+    char tmp[16];
+    int n = 0;
+    do {
+        int d = v % 36;
+        tmp[n++] = d < 10 ? '0' + d : 'a' + d - 10;
+        v /= 36;
+    } while (v);
+
+    std::string out = type ? std::format("t{}_", type) : "";
+    while (n) out += tmp[--n];
+    return out;
+}
+
+// next string value of key (i.e. "\"author\":") in a raw dump line starting at at (moved past it), without parsing the line
+// the value is as it is in the line (escapes are left in), which is fine for ids and names
+bool rawString(std::string_view line, std::string_view key, size_t& at, std::string_view& out) {
+    while ((at = line.find(key, at)) != std::string_view::npos) {
+        at += key.size();
+        while (at < line.size() && line[at] == ' ') at++;
+        if (at >= line.size() || line[at] != '"') continue;
+
+        size_t end = line.find('"', ++at);
+        if (end == std::string_view::npos) return false;
+        out = line.substr(at, end - at);
+        at = end + 1;
+        return true;
+    }
+    return false;
+}
+
+// next "id" string value of a raw dump line
+// other keys ending in id ("parent_id", "link_id") do not match since the quote has to come right before it, but nested objects
+// can have an "id" too (i.e. awards), so callers looking for the row id should look at all of them
+bool rawId(std::string_view line, size_t& at, std::string_view& out) { return rawString(line, "\"id\":", at, out); }
+
+int64_t packId(const char* id, int type = 0) { return packId(std::string_view(id), type); }
+
+// packed top level id of a raw dump line (0 if it has none), parsed so the ids of nested objects are skipped unlike with rawId
+struct _RowId { std::string id; };
+int64_t lineId(std::string_view line, int type) {
+    _RowId r;
+    if (glz::read<glz::opts{ .error_on_unknown_keys = false }>(r, line)) return 0;
+    return packId(std::string_view(r.id), type);
+}
+
+// parent ids are sometimes numbers in old dumps, which do not say whether the parent is a comment or a submission, so those are
+// 0 (null in the table) rather than an id that matches nothing
+int64_t packId(const std::variant<std::string, double>& in) {
+    const std::string* val = std::get_if<std::string>(&in);
+    return val ? packId(std::string_view(*val)) : 0;
+}
+
+// sanitize and the sentence count in sql, so a different cutoff or markdown rule can be tried on a database without reading the dump again
+// num_sentences(x) counts like sanitize does (NULL if x is not ascii), sanitize_body(x [, min_sentences]) is x sanitized or NULL if sanitize drops it
+// note that main.body is already sanitized, so num_sentences(body) can be off from the num_sentences column where markdown was removed
+// reddit_id(x) is a packed id as t1_abc123 (see packId), pack_id(x [, type]) goes the other way (NULL if it is not an id)
+// all are deterministic so they work in generated columns and indexes, though anything writing to those then needs them registered too
+// i.e. CREATE INDEX long_bodies ON main (num_sentences(zbody(body))) or SELECT * FROM main WHERE parent_id = pack_id('t3_1g3mfxb')
+int textFunctions(sqlite3* db, char** err, const sqlite3_api_routines*) {
+    auto numSentences = [](sqlite3_context* ctx, int, sqlite3_value** argv) {
+        if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+
+        int n = countSentences(std::string_view((const char*) sqlite3_value_text(argv[0]), sqlite3_value_bytes(argv[0])));
+        if (n >= 0) sqlite3_result_int(ctx, n);
+    };
+
+    auto sanitizeBody = [](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+        if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+
+        std::string body((const char*) sqlite3_value_text(argv[0]), sqlite3_value_bytes(argv[0]));
+        int num_sentences;
+        if (sanitize(body, num_sentences, argc > 1 ? sqlite3_value_int(argv[1]) : 5)) sqlite3_result_text(ctx, body.data(), body.size(), SQLITE_TRANSIENT);
+    };
+
+    auto redditId = [](sqlite3_context* ctx, int, sqlite3_value** argv) {
+        if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER) return;
+
+        std::string id = unpackId(sqlite3_value_int64(argv[0]));
+        sqlite3_result_text(ctx, id.data(), id.size(), SQLITE_TRANSIENT);
+    };
+
+    auto packIdFn = [](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+        if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+
+        int64_t v = packId(std::string_view((const char*) sqlite3_value_text(argv[0]), sqlite3_value_bytes(argv[0])), argc > 1 ? sqlite3_value_int(argv[1]) : 0);
+        if (v) sqlite3_result_int64(ctx, v);
+    };
+
+    int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+    int rc = sqlite3_create_function_v2(db, "num_sentences", 1, flags, nullptr, numSentences, nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK) rc = sqlite3_create_function_v2(db, "sanitize_body", 1, flags, nullptr, sanitizeBody, nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK) rc = sqlite3_create_function_v2(db, "sanitize_body", 2, flags, nullptr, sanitizeBody, nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK) rc = sqlite3_create_function_v2(db, "reddit_id", 1, flags, nullptr, redditId, nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK) rc = sqlite3_create_function_v2(db, "pack_id", 1, flags, nullptr, packIdFn, nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK) rc = sqlite3_create_function_v2(db, "pack_id", 2, flags, nullptr, packIdFn, nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK) {
+        *err = sqlite3_mprintf("(common.hpp) Unable to register text functions: %s", sqlite3_errmsg(db));
+        return rc;
+    }
+
+    try {
+        registerZbody(db);
+    } catch (const std::exception& e) {
+        *err = sqlite3_mprintf("%s", e.what());
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+// every connection opened after this gets the functions above (and zbody, see zdict.hpp), calling it again does nothing
+void registerTextFunctions() {
+    initSentenceEnds();
+    if (sqlite3_auto_extension((void (*)()) textFunctions) != SQLITE_OK) throw std::runtime_error("(common.hpp) Unable to register text functions");
 }
 
 #endif
\ No newline at end of file
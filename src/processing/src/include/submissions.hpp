@@ -6,7 +6,9 @@
 #include "common.hpp"
 #include "glaze/glaze.hpp"
 
-struct Submission {
+// see CommentRecord
+template <bool Context = false>
+struct SubmissionRecord {
     std::string selftext;
     std::string subreddit;
     std::string id;
@@ -14,17 +16,52 @@ struct Submission {
     int score;
     std::optional<std::string> distinguished;
 
+    std::string author;
     int num_sentences;
 
+    // same as Comment
+    mutable std::string packed;
+
     void reset() { distinguished.reset(); }
 
     // do not need to remove automoderator from here
-    bool valid() { return sanitize(selftext, num_sentences); }
+    bool valid() {
+        if constexpr (Context) {
+            num_sentences = std::max(0, countSentences(selftext));
+            return true;
+        } else return sanitize(selftext, num_sentences);
+    }
+
+    const std::string& text() const { return selftext; }
+};
+
+using Submission = SubmissionRecord<>;
+using ContextSubmission = SubmissionRecord<true>;
+
+// same as CommentLink
+struct SubmissionLink {
+    std::string id;
+    std::optional<std::string> distinguished;
+
+    void reset() { distinguished.reset(); }
+    bool valid() { return true; }
+};
+
+// what comments are joined to (see Wrapper::joinSubmissions), every submission counts since link posts get comments too
+struct SubmissionJoin {
+    std::string id;
+    std::string author;
+    int score;
+    std::variant<std::string, double> created_utc;
+    std::optional<std::string> distinguished;
+
+    void reset() { distinguished.reset(); }
+    bool valid() { return true; }
 };
 
-template <> struct glz::meta<Submission> {
+template <bool Context> struct glz::meta<SubmissionRecord<Context>> {
     static constexpr bool skip(const std::string_view key, const meta_context&) {
-        return key == "num_sentences";
+        return key == "num_sentences" || key == "packed";
     }
 };
 
@@ -0,0 +1,124 @@
+#ifndef CMSC_TRIGRAMS_HPP
+#define CMSC_TRIGRAMS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include <algorithm>
+
+#include "sqlite3.h"
+#include "common.hpp"
+#include "timing.hpp"
+
+// sentence trigrams, same as create_ngram in classifier/apply_classifier.py
+// < 3 sentences becomes a single "trigram" of everything
+void sentenceTrigrams(std::string_view body, std::vector<std::string_view>& sentences, std::vector<std::string>& out) {
+    sentences.clear();
+    out.clear();
+    splitSentences(body, sentences);
+
+    auto join = [&](size_t start, size_t end) {
+        std::string& s = out.emplace_back();
+        for (size_t i = start; i < end; i++) {
+            if (i != start) s += ' ';
+            s += sentences[i];
+        }
+    };
+
+    if (sentences.size() < 3) join(0, sentences.size());
+    else for (size_t i = 0; i + 2 < sentences.size(); i++) join(i, i + 3);
+}
+
+struct _TrigramDoc {
+    int64_t id;
+    std::string body;
+    std::vector<std::string> trigrams;
+};
+
+// writes trigrams(id, trigram_id, sent_trigram) through the connection of the database that is currently being read
+// rows are buffered and split across threads in batches, then inserted on flush (which must be inside a transaction)
+class Trigrams {
+private:
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+
+    std::vector<_TrigramDoc> batch;
+    size_t used = 0;
+    int threads;
+
+    Trigrams(const Trigrams&) = delete;
+    Trigrams& operator=(const Trigrams&) = delete;
+
+    void split(size_t start, size_t end) {
+        std::vector<std::string_view> sentences;
+        for (size_t i = start; i < end; i++) sentenceTrigrams(batch[i].body, sentences, batch[i].trigrams);
+    }
+public:
+    static constexpr const char* table = "trigrams";
+
+    Trigrams(sqlite3* db, int threads = 0, size_t batchSize = 8192) : db(db), batch(batchSize), threads(threads) {
+        if (this->threads <= 0) this->threads = std::max(1u, std::thread::hardware_concurrency());
+
+        char* err = nullptr;
+        std::string cmd = std::format("CREATE TABLE IF NOT EXISTS {} (id INTEGER, trigram_id INTEGER, sent_trigram TEXT) STRICT;", table);
+        if (sqlite3_exec(db, cmd.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+            std::string msg = err ? err : "";
+            sqlite3_free(err);
+            throw std::runtime_error("(trigrams.hpp) Unable to create trigram table: " + msg);
+        }
+
+        std::string ins = std::format("INSERT INTO {} (id, trigram_id, sent_trigram) VALUES (?, ?, ?)", table);
+        if (sqlite3_prepare_v3(db, ins.c_str(), ins.size() + 1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(trigrams.hpp) Could not create prepared statement: " + std::string(sqlite3_errmsg(db)));
+    }
+
+    ~Trigrams() { sqlite3_finalize(stmt); }
+
+    // id is packed (see packId)
+    void push(int64_t id, std::string_view body) {
+        _TrigramDoc& d = batch[used++];
+        d.id = id;
+        d.body = body;
+
+        if (used == batch.size()) flush();
+    }
+
+    void flush() {
+        if (used == 0) return;
+#ifdef BENCHMARK_ENABLED
+        auto t_split = Benchmark::timestamp();
+#endif
+        // records are independent, so just give each thread a contiguous slice
+        int n = std::min((size_t) threads, used);
+        size_t per = (used + n - 1) / n;
+        std::vector<std::jthread> workers;
+        for (int t = 1; t < n; t++) workers.emplace_back(&Trigrams::split, this, t * per, std::min(used, (t + 1) * per));
+        split(0, std::min(used, per));
+        workers.clear();
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("Trigrams", t_split);
+        auto t_sql = Benchmark::timestamp();
+#endif
+
+        for (size_t i = 0; i < used; i++) {
+            const _TrigramDoc& d = batch[i];
+            for (size_t j = 0; j < d.trigrams.size(); j++) {
+                sqlite3_bind_int64(stmt, 1, d.id);
+                sqlite3_bind_int64(stmt, 2, j + 1);
+                sqlite3_bind_text(stmt, 3, d.trigrams[j].c_str(), d.trigrams[j].size(), SQLITE_STATIC);
+
+                if (sqlite3_step(stmt) != SQLITE_DONE) throw std::runtime_error("(trigrams.hpp) Could not step prepared statement: " + std::string(sqlite3_errmsg(db)));
+                sqlite3_reset(stmt);
+            }
+        }
+
+        used = 0;
+#ifdef BENCHMARK_ENABLED
+        Benchmark::sum("SQL", t_sql);
+#endif
+    }
+};
+
+#endif
@@ -6,128 +6,1020 @@
 #include <variant>
 #include <chrono>
 #include <cstdlib>
+#include <unordered_set>
+#include <map>
 
 namespace fs = std::filesystem;
 
 #include "database.hpp"
+#include "schema.hpp"
+#include "columnar.hpp"
+#include "vtab.hpp"
+#include "vfs.hpp"
+#include "graph.hpp"
+#include "bloom.hpp"
+#include "roster.hpp"
+#include "join.hpp"
+#include "dumpindex.hpp"
+#include "zdict.hpp"
 #include "common.hpp"
 #include "comments.hpp"
 #include "submissions.hpp"
+#include "trigrams.hpp"
+#include "bpe.hpp"
+#include "lexicon.hpp"
+#include "proxy.hpp"
+
+// comments have a parent, submissions do not
+template <typename T>
+concept TReply = requires(const T& t) { t.parent_id; };
+
+// submission a comment was made under (see SubmissionTable)
+template <TRedditText T>
+const SubmissionInfo* submissionOf(const SubmissionTable* join, const T& j) {
+    if constexpr (TReply<T>) return join->find(packId(std::string_view(j.link_id)));
+    else return nullptr;
+}
+
+// columns of main (see schema.hpp), comments and submissions share the same layout (so does context, see Wrapper::context)
+// the lexicon (one lex_{category} INTEGER per category) and proxy (proxy_auth REAL) columns only exist if those are given
+// body is a BLOB compressed against dict if given (see zdict.hpp), is_mod_author only exists if roster is given
+// and the sub_ columns (the fields of join) only if join is given
+template <TRedditText T>
+auto mainSchema(size_t& last, const Lexicon* lexicon, std::vector<int>& lex_counts, const ProxyModel* proxy, ZstdDict* dict = nullptr,
+    const ModRoster* roster = nullptr, const SubmissionTable* join = nullptr, const std::string& table = "main") {
+    std::vector<std::string> lex_names, proxy_names;
+    if (lexicon) {
+        for (const auto& c : lexicon->categories()) lex_names.push_back("lex_" + c);
+        lex_counts.resize(lexicon->size());
+    }
+    if (proxy) proxy_names.push_back("proxy_auth");
+    std::vector<std::string> text_names, packed_names, mod_names;
+    (dict ? packed_names : text_names).push_back("body");
+    if (roster) mod_names.push_back("is_mod_author");
+    std::vector<std::string> join_ints, join_authors, join_ops;
+    if (join) {
+        if (join->has(JF_SCORE)) join_ints.push_back("sub_score");
+        if (join->has(JF_CREATED)) join_ints.push_back("sub_created_utc");
+        if (join->has(JF_DISTINGUISHED)) join_ints.push_back("sub_distinguished");
+        if (join->has(JF_AUTHOR)) join_authors.push_back("sub_author");
+        if (join->has(JF_OP)) join_ops.push_back("is_op");
+    }
+
+    return compileSchema<T>(table,
+        // notice that we dont need to sanitize string since we write as a prepared statement
+        // submissions call body selftext, text() handles the rename
+        columns<ST_TEXT>(text_names, [](const T& j, SchemaValue* out) { out->text(j.text()); }),
+        // compressed into the record so it lives as long as the text would
+        columns<ST_BLOB>(packed_names, [dict](const T& j, SchemaValue* out) { out->blob(dict->compress(j.text(), j.packed)); }),
+        C_TEXT(subreddit),
+        // packed (see packId), parent_id and link_id are null for submissions (and parent_id for the numeric ones of old dumps)
+        column<"id", ST_INT>([](const T& j, SchemaValue& out) {
+            int64_t v = packId(j.id, TReply<T> ? ID_COMMENT : ID_SUBMISSION);
+            if (v) out.integer(v);
+            else out.null();
+        }),
+        column<"parent_id", ST_INT>([](const T& j, SchemaValue& out) {
+            if constexpr (TReply<T>) {
+                int64_t v = packId(j.parent_id);
+                if (v) out.integer(v);
+                else out.null();
+            } else out.null();
+        }),
+        column<"link_id", ST_INT>([](const T& j, SchemaValue& out) {
+            if constexpr (TReply<T>) {
+                int64_t v = packId(std::string_view(j.link_id));
+                if (v) out.integer(v);
+                else out.null();
+            } else out.null();
+        }),
+        column<"created_utc", ST_INT>([&last](const T& j, SchemaValue& out) {
+            int64_t t = toInt(j.created_utc);
+            out.integer(t);
+
+            if ((size_t) t > last) last = t;
+        }),
+        C_INT(score),
+        C_INT(num_sentences),
+        column<"distinguished", ST_INT>([](const T& j, SchemaValue& out) { out.integer(getDistinguished(j.distinguished)); }),
+        // author distinguished as a moderator of this subreddit somewhere in the files, so also their plain posts (see Wrapper::modRoster)
+        columns<ST_BOOL>(mod_names, [roster](const T& j, SchemaValue* out) { out->integer(roster->contains(j.author, j.subreddit)); }),
+        // the submission of a comment, null for submissions and for comments on submissions from other months
+        columns<ST_INT>(join_ints, [join](const T& j, SchemaValue* out) {
+            const SubmissionInfo* s = submissionOf(join, j);
+            auto put = [&](int64_t v) {
+                if (s) out->integer(v);
+                else out->null();
+                out++;
+            };
+            if (join->has(JF_SCORE)) put(s ? s->score : 0);
+            if (join->has(JF_CREATED)) put(s ? s->created_utc : 0);
+            if (join->has(JF_DISTINGUISHED)) put(s ? s->distinguished : 0);
+        }),
+        columns<ST_TEXT>(join_authors, [join](const T& j, SchemaValue* out) {
+            const SubmissionInfo* s = submissionOf(join, j);
+            if (s) out->text(s->author());
+            else out->null();
+        }),
+        // deleted authors are all the same name
+        columns<ST_BOOL>(join_ops, [join](const T& j, SchemaValue* out) {
+            const SubmissionInfo* s = submissionOf(join, j);
+            if (s) out->integer(s->author() == j.author && j.author != "[deleted]");
+            else out->null();
+        }),
+        columns<ST_INT>(lex_names, [lexicon, &lex_counts](const T& j, SchemaValue* out) {
+            lexicon->scan(j.text(), lex_counts);
+            for (size_t c = 0; c < lex_counts.size(); c++) out[c].integer(lex_counts[c]);
+        }),
+        // estimated classifier score, see proxy.hpp
+        columns<ST_REAL>(proxy_names, [proxy](const T& j, SchemaValue* out) { out->real(proxy->predict(j.text())); })
+    );
+}
+
+template <TRedditText T>
+using MainSchema = decltype(mainSchema<T>(std::declval<size_t&>(), nullptr, std::declval<std::vector<int>&>(), nullptr));
+
+struct Context_Output {
+    size_t wanted = 0;
+    size_t found = 0;
+    // lines thrown away on their id alone (bloom filter), and ones that got past it but were not in the set (or only had a wanted
+    // id in a nested object)
+    size_t rejected = 0;
+    size_t falsePositives = 0;
+};
 
 class Wrapper {
-    Database<Comment>* cmt;
-    Database<Submission>* sub;
+    Database<Comment, MainSchema<Comment>>* cmt;
+    Database<Submission, MainSchema<Submission>>* sub;
+
+    FingerprintSet* seen = nullptr;
+    Sink* output = nullptr;
+
+    // one per connection since the trigrams are written in the same transaction as main
+    Trigrams* tri_cmt = nullptr;
+    Trigrams* tri_sub = nullptr;
 
     size_t last = 0;
 
     std::string in_cmt;
     std::string in_sub;
+    std::string out_db;
+
+    const Lexicon* lexicon;
+    std::vector<int> lex_counts;
+
+    const ProxyModel* proxy;
+
+    bool append;
+    const char* vfs;
+    ZstdDict* dict = nullptr;
+    ModRoster* roster = nullptr;
+    SubmissionTable* join = nullptr;
+    // see partition
+    size_t partitionBytes = 0;
+    bool partitioned = false;
+    static constexpr const char* partitionTable = "partitions";
+
+    static constexpr std::pair<const char*, JoinField> joinColumns[] = {
+        {"sub_score", JF_SCORE}, {"sub_created_utc", JF_CREATED}, {"sub_distinguished", JF_DISTINGUISHED}, {"sub_author", JF_AUTHOR}, {"is_op", JF_OP}};
+
+    // main again with the current options (dict, roster, join), clear drops it first (i.e. it is empty but was created without them)
+    void reopen(bool clear) {
+        delete cmt;
+        delete sub;
+        cmt = new Database<Comment, MainSchema<Comment>>(out_db, mainSchema<Comment>(last, lexicon, lex_counts, proxy, dict, roster, join), clear, vfs);
+        sub = new Database<Submission, MainSchema<Submission>>(out_db, mainSchema<Submission>(last, lexicon, lex_counts, proxy, dict, roster, join), false, vfs);
+        cmt->setAppend(append);
+        sub->setAppend(append);
+    }
+
+    // declared type of a column of main (empty if there is no such column) and whether main has rows
+    std::pair<std::string, bool> mainColumn(const std::string& name) {
+        std::pair<std::string, bool> out;
+        sqlite3_stmt* stmt;
+        std::string cmd = std::format("SELECT (SELECT type FROM pragma_table_info('main') WHERE name = '{}'), EXISTS (SELECT 1 FROM main)", name);
+        sqlite3_prepare_v2(sub->handle(), cmd.c_str(), -1, &stmt, nullptr);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* type = (const char*) sqlite3_column_text(stmt, 0);
+            out = {type ? type : "", sqlite3_column_int(stmt, 1) != 0};
+        }
+        sqlite3_finalize(stmt);
+        return out;
+    }
+
+    // names of the partitions of main whose row in the partitions table matches where (see partition)
+    std::vector<std::string> partitionsWhere(const std::string& where) {
+        std::vector<std::string> out;
+        sqlite3_stmt* stmt;
+        std::string cmd = std::format("SELECT tbl FROM {} WHERE {} ORDER BY month, distinguished", partitionTable, where);
+        if (sqlite3_prepare_v2(sub->handle(), cmd.c_str(), cmd.size() + 1, &stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + cmd);
+        while (sqlite3_step(stmt) == SQLITE_ROW) out.emplace_back((const char*) sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+        return out;
+    }
+
+    // terms (SELECTs with the same columns) as one UNION ALL, nested in groups since sqlite caps the terms of one compound select
+    // (500 by default)
+    static std::string unionAll(const std::vector<std::string>& terms) {
+        constexpr size_t group = 250;
+
+        std::vector<std::string> parts;
+        for (size_t i = 0; i < terms.size(); i += group) {
+            std::string part;
+            for (size_t k = i; k < std::min(terms.size(), i + group); k++) part += (k == i ? "" : " UNION ALL ") + terms[k];
+            parts.push_back(std::move(part));
+        }
+        if (parts.size() == 1) return parts[0];
+
+        std::string out;
+        for (size_t i = 0; i < parts.size(); i++) out += std::format("{}SELECT * FROM ({})", i ? " UNION ALL " : "", parts[i]);
+        return out;
+    }
+
+    // SELECT over every row of tables
+    static std::string unionOf(const std::vector<std::string>& tables) {
+        if (tables.empty()) return "SELECT * FROM main WHERE 0";
+        std::vector<std::string> terms;
+        for (const auto& t : tables) terms.push_back("SELECT * FROM " + t);
+        return unionAll(terms);
+    }
+
+    // count random rows where filter holds out of the partitions whose partitions row matches where, appended to table
+    // same as sampling main by rowid: only (partition, rowid) pairs go through the sort, the picked rows are then read by rowid
+    void samplePartitions(const std::string& table, const std::string& where, const std::string& filter, unsigned int count) {
+        std::vector<std::string> tables = partitionsWhere(where), keys;
+        if (tables.empty()) return;
+        for (size_t i = 0; i < tables.size(); i++) keys.push_back(std::format("SELECT {} AS part, rowid AS rid FROM {} WHERE {}", i, tables[i], filter));
+
+        std::string cmd = std::format(
+            "DROP TABLE IF EXISTS temp.picked; \
+            CREATE TEMP TABLE picked AS SELECT * FROM ({}) ORDER BY RANDOM() LIMIT {};",
+            unionAll(keys), count);
+        for (size_t i = 0; i < tables.size(); i++) {
+            cmd += std::format(" INSERT INTO {} SELECT * FROM {} WHERE rowid IN (SELECT rid FROM temp.picked WHERE part = {});", table, tables[i], i);
+        }
+        cmd += " DROP TABLE temp.picked;";
+        sub->exec(cmd);
+    }
+
+    // sampling with drop, main is a view over the partitions once they exist
+    void dropMain() {
+        if (partitioned) {
+            std::string cmd = "BEGIN TRANSACTION; DROP VIEW main;";
+            for (const auto& t : partitionsWhere("1")) cmd += std::format(" DROP TABLE {};", t);
+            cmd += std::format(" DROP TABLE {}; END TRANSACTION;", partitionTable);
+            sub->exec(cmd);
+            partitioned = false;
+        } else sub->exec("DROP TABLE main");
+        sub->exec("VACUUM");
+    }
+
+    // see partition
+    void splitMain() {
+        sqlite3* db = sub->handle();
+        auto start = Benchmark::timestamp();
+
+        // the sorter keeps at most the page cache in memory and spills the rest to temp files, unless temp files are in memory too
+        // (which is what bulkLoad asks for)
+        auto pragma = [&](const char* name) {
+            std::string v;
+            sqlite3_stmt* stmt;
+            std::string cmd = std::format("PRAGMA {}", name);
+            sqlite3_prepare_v2(db, cmd.c_str(), -1, &stmt, nullptr);
+            if (sqlite3_step(stmt) == SQLITE_ROW) v = (const char*) sqlite3_column_text(stmt, 0);
+            sqlite3_finalize(stmt);
+            return v;
+        };
+        std::string store = pragma("temp_store"), cache = pragma("cache_size");
+        sub->exec(std::format("PRAGMA temp_store = FILE; PRAGMA cache_size = -{};", std::max((size_t) 1, partitionBytes / 1024)));
+
+        sqlite3_stmt* sel;
+        std::string cmd = "SELECT * FROM main ORDER BY created_utc, rowid";
+        if (sqlite3_prepare_v2(db, cmd.c_str(), cmd.size() + 1, &sel, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + cmd);
+
+        int n = sqlite3_column_count(sel), utc = -1, cls = -1;
+        for (int i = 0; i < n; i++) {
+            std::string_view c = sqlite3_column_name(sel, i);
+            if (c == "created_utc") utc = i;
+            else if (c == "distinguished") cls = i;
+        }
+        std::string params = "?";
+        for (int i = 1; i < n; i++) params += ",?";
+
+        struct _Part {
+            std::string table;
+            std::string month;
+            int distinguished;
+            sqlite3_stmt* ins;
+            size_t rows = 0;
+            int64_t first = 0;
+            int64_t last = 0;
+        };
+        // (months since year 0, distinguished) so the map is in the same order as the view
+        std::map<std::pair<int, int>, _Part> parts;
+
+        sub->exec("BEGIN TRANSACTION");
+        while (sqlite3_step(sel) == SQLITE_ROW) {
+            int64_t t = sqlite3_column_int64(sel, utc);
+            int d = sqlite3_column_int(sel, cls);
+            std::chrono::year_month_day ymd{std::chrono::floor<std::chrono::days>(std::chrono::sys_seconds{std::chrono::seconds{t}})};
+            int year = (int) ymd.year(), month = (int) (unsigned) ymd.month();
+
+            auto it = parts.find({year * 12 + month, d});
+            if (it == parts.end()) {
+                _Part p{std::format("main_{:04}_{:02}_d{}", year, month, d), std::format("{:04}-{:02}", year, month), d, nullptr};
+                sub->exec(std::format("DROP TABLE IF EXISTS {0}; CREATE TABLE {0} ({1}) STRICT;", p.table, cmt->getSchema()));
+                std::string ins = std::format("INSERT INTO {} VALUES ({})", p.table, params);
+                if (sqlite3_prepare_v2(db, ins.c_str(), ins.size() + 1, &p.ins, nullptr) != SQLITE_OK)
+                    throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + ins);
+                p.first = t;
+                it = parts.emplace(std::pair{year * 12 + month, d}, std::move(p)).first;
+            }
+
+            _Part& p = it->second;
+            for (int i = 0; i < n; i++) sqlite3_bind_value(p.ins, i + 1, sqlite3_column_value(sel, i));
+            if (sqlite3_step(p.ins) != SQLITE_DONE) throw std::runtime_error(std::format("(wrapper.hpp) Could not insert into {}: {}", p.table, sqlite3_errmsg(db)));
+            sqlite3_reset(p.ins);
+            p.rows++;
+            p.last = t;
+        }
+        sqlite3_finalize(sel);
+
+        size_t rows = 0;
+        sub->exec(std::format("DROP TABLE IF EXISTS {0}; CREATE TABLE {0} (tbl TEXT, month TEXT, distinguished INTEGER, rows INTEGER, first_utc INTEGER, last_utc INTEGER)", partitionTable));
+        for (auto& [k, p] : parts) {
+            sqlite3_finalize(p.ins);
+            sub->exec(std::format("INSERT INTO {} VALUES ('{}', '{}', {}, {}, {}, {})", partitionTable, p.table, p.month, p.distinguished, p.rows, p.first, p.last));
+            rows += p.rows;
+        }
+
+        // an empty main has nothing to split
+        if (!parts.empty()) {
+            std::vector<std::string> tables;
+            for (const auto& [k, p] : parts) tables.push_back(p.table);
+            std::string cmd = "DROP TABLE main;";
+            for (const auto& t : tables) cmd += std::format(" CREATE INDEX {0}_id ON {0} (id);", t);
+            sub->exec(cmd + std::format(" CREATE VIEW main AS {};", unionOf(tables)));
+            partitioned = true;
+        }
+        sub->exec("END TRANSACTION");
+        sub->exec(std::format("PRAGMA temp_store = {}; PRAGMA cache_size = {};", store, cache));
+
+        std::cout << std::format("partition: {} rows into {} tables in {} ms\n", rows, parts.size(), Benchmark::elapsed_ms(start));
+    }
+
+    // first count bodies (after sanitizing) of a file
+    template <TRedditText T>
+    static void sampleBodies(const std::string& file, size_t count, std::vector<std::string>& out) {
+        Reader reader(file);
+        size_t n = 0;
+        for (const T& j : reader.decompress<T>(1000000, 0, false)) {
+            out.emplace_back(j.text());
+            if (++n == count) break;
+        }
+    }
+
+    // comments are checked first since that is the order read goes in (a changed comment file also drops the submissions)
+    // afterwards picks up what a fresh run would have built up while reading the rows that are left (newest timestamp, dedup set)
+    void resume() {
+        cmt->processed(in_cmt);
+        sub->processed(in_sub);
+
+        auto each = [&](const std::string& cmd, const std::function<void(sqlite3_stmt*)>& fn) {
+            sqlite3_stmt* stmt;
+            if (sqlite3_prepare_v2(sub->handle(), cmd.c_str(), cmd.size() + 1, &stmt, nullptr) != SQLITE_OK)
+                throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + cmd);
+            while (sqlite3_step(stmt) == SQLITE_ROW) fn(stmt);
+            sqlite3_finalize(stmt);
+        };
+
+        each("SELECT max(created_utc) FROM main", [&](sqlite3_stmt* stmt) { last = std::max(last, (size_t) sqlite3_column_int64(stmt, 0)); });
+        if (seen) {
+            each("SELECT zbody(body) FROM main ORDER BY rowid", [&](sqlite3_stmt* stmt) {
+                seen->insert(std::string_view((const char*) sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0)));
+            });
+        }
+    }
 public:
-    Wrapper(std::string& comments, std::string& submissions, std::string& out) : in_cmt(comments), in_sub(submissions) {
-        if (fs::exists(out)) fs::remove(out);
+    // lexicon and proxy are optional, caller owns them
+    // append keeps an existing database and only reads files that are not in it yet (or changed), see Database::processed
+    // sampling with drop removes main, so only append to databases that were sampled with drop = false
+    // vfs opens the database through a registered sqlite vfs instead of the default one (i.e. ZstdVfs::id(), see vfs.hpp)
+    Wrapper(std::string& comments, std::string& submissions, std::string& out, const Lexicon* lexicon = nullptr, const ProxyModel* proxy = nullptr, bool append = false,
+        const char* vfs = nullptr)
+        : in_cmt(comments), in_sub(submissions), out_db(out), lexicon(lexicon), proxy(proxy), append(append), vfs(vfs) {
+        if (!append && fs::exists(out)) fs::remove(out);
 
         // this is a bit scuffed but we want these to be global variables but we need to init them
         // so they are defined in common.hpp (and used there), but we initialize them here
-        s1_first['.'] = true;
-        s1_first['?'] = true;
-        s1_first['!'] = true;
-        s1_second['\0'] = true;
-        s1_second['\r'] = true;
-        s1_second['\n'] = true;
-        s1_second['\t'] = true;
-        s1_second['\f'] = true;
-        s1_second['\v'] = true;
-        s1_second[' '] = true;
-
-        std::fill_n(s2_first, 256, true);
-        s2_first['\r'] = false;
-        s2_first['\n'] = false;
-        s2_first['\t'] = false;
-        s2_first['\f'] = false;
-        s2_first['\v'] = false;
-        s2_second['\n'] = true;
-        s2_second['\0'] = true;
-
-        cmt = new Database<Comment>(out, {"main", {
-            RAW_TEXT(body), // notice that we dont need to sanitize string since we write as a prepared statement
-            RAW_TEXT(subreddit),
-            RAW_TEXT(id),
-            {"parent_id", ST_TEXT, [](const Comment& j, std::string& out) {
-                const std::string* val = std::get_if<std::string>(&j.parent_id);
-                if (val) out = *val;
-                else out = std::to_string(std::get<double>(j.parent_id));
-            }},
-            {"created_utc", ST_INT, [&last = last](const Comment& j, std::string& out) {
-                const std::string* val = std::get_if<std::string>(&j.created_utc);
-                double d;
-                if (val) {
-                    d = atof(val->c_str());
-                    out = *val;
-                } else {
-                    d = std::get<double>(j.created_utc);
-                    out = std::to_string(d);
-                }
+        initSentenceEnds();
+        // num_sentences, sanitize_body and zbody on every connection opened from here on (see common.hpp)
+        registerTextFunctions();
 
-                // mildly inefficient but oh well!
-                if (d > last) last = d;
-            }},
-            INT(score),
-            {"num_sentences", ST_INT, [](const Comment& j, std::string& out) { out = std::to_string(j.num_sentences); }},
-            {"distinguished", ST_INT, [](const Comment& j, std::string& out) { getDistinguished(j.distinguished, out); }},
-        }}, false);
-
-        sub = new Database<Submission>(out, {"main", {
-            // submissions call body selftext, so rename here
-            {"body", ST_TEXT, [](const Submission& j, std::string& out) { out = j.selftext; }},
-            RAW_TEXT(subreddit),
-            RAW_TEXT(id),
-            {"parent_id", ST_TEXT, [](const Submission&, std::string& out) { out = ""; }},
-            {"created_utc", ST_INT, [&last = last](const Submission& j, std::string& out) {
-                const std::string* val = std::get_if<std::string>(&j.created_utc);
-                double d;
-                if (val) {
-                    d = atof(val->c_str());
-                    out = *val;
-                } else {
-                    d = std::get<double>(j.created_utc);
-                    out = std::to_string(d);
-                }
+        cmt = new Database<Comment, MainSchema<Comment>>(out, mainSchema<Comment>(last, lexicon, lex_counts, proxy), false, vfs);
+        sub = new Database<Submission, MainSchema<Submission>>(out, mainSchema<Submission>(last, lexicon, lex_counts, proxy), false, vfs);
+        cmt->setAppend(append);
+        sub->setAppend(append);
+
+        // ids used to be TEXT, appending packed ones to that would store them as numbers in text
+        if (append) {
+            sqlite3_stmt* stmt;
+            sqlite3_prepare_v2(sub->handle(), "SELECT type FROM pragma_table_info('main') WHERE name = 'id'", -1, &stmt, nullptr);
+            bool old = sqlite3_step(stmt) == SQLITE_ROW && std::string_view((const char*) sqlite3_column_text(stmt, 0)) == "TEXT";
+            sqlite3_finalize(stmt);
+            if (old) throw std::runtime_error("(wrapper.hpp) Can not append to " + out + ", it was written with text ids");
 
-                if (d > last) last = d;
-            }},
-            INT(score),
-            {"num_sentences", ST_INT, [](const Submission& j, std::string& out) { out = std::to_string(j.num_sentences); }},
-            {"distinguished", ST_INT, [](const Submission& j, std::string& out) { getDistinguished(j.distinguished, out); }},
-        }}, false);
+            auto [type, rows] = mainColumn("link_id");
+            if (rows && type.empty()) throw std::runtime_error("(wrapper.hpp) Can not append to " + out + ", it was written without link_id");
+        }
     }
 
     ~Wrapper() {
+        // statements need to be finalized before the connection is closed
+        delete tri_cmt;
+        delete tri_sub;
         delete cmt;
         delete sub;
+        delete seen;
+        delete output;
+        delete dict;
+        delete roster;
+        delete join;
         cmt = nullptr;
         sub = nullptr;
+        seen = nullptr;
+        tri_cmt = nullptr;
+        tri_sub = nullptr;
+    }
+
+    // store bodies compressed against a zstd dictionary trained on the first sample bodies (after sanitizing) of both files
+    // main.body becomes a BLOB, zbody(body) reads it back in sql (see zdict.hpp) and exportTable writes it out decompressed
+    // appending keeps using the newest dictionary in the database, call this right after constructing (it reopens main)
+    void compressBodies(size_t sample = 20000, size_t bytes = 112640, int level = 3) {
+        if (dict || tri_cmt || seen || output) throw std::runtime_error("(wrapper.hpp) compressBodies has to be called before anything else");
+
+        // main is only kept when appending to rows that are already there
+        auto [type, rows] = mainColumn("body");
+        bool fresh = !append || !rows;
+        if (!fresh && type != "BLOB") throw std::runtime_error("(wrapper.hpp) Can not append compressed bodies to " + out_db + ", it was written without them");
+
+        std::string trained = fresh ? "" : ZstdDict::latest(sub->handle());
+
+        if (trained.empty()) {
+            std::vector<std::string> bodies;
+            sampleBodies<Comment>(in_cmt, sample, bodies);
+            sampleBodies<Submission>(in_sub, sample, bodies);
+            trained = ZstdDict::train(bodies, bytes);
+            dict = new ZstdDict(trained, level);
+
+            // what the dictionary buys on the sample itself
+            size_t raw = 0, alone = 0;
+            std::string tmp(ZSTD_compressBound(1 << 16), '\0');
+            for (const auto& b : bodies) {
+                tmp.resize(ZSTD_compressBound(b.size()));
+                raw += b.size();
+                alone += ZSTD_compress(tmp.data(), tmp.size(), b.data(), b.size(), level);
+                dict->compress(b, tmp);
+            }
+            std::cout << std::format("\nDictionary: {} bytes from {} bodies, {:.2f}x one at a time, {:.2f}x with the dictionary\n",
+                trained.size(), bodies.size(), (double) raw / alone, (double) raw / dict->packed);
+            dict->raw = 0;
+            dict->packed = 0;
+        } else dict = new ZstdDict(trained, level);
+
+        reopen(fresh);
+        dict->save(sub->handle());
+    }
+
+    // who moderates where: a first pass over both files for (author, subreddit) pairs seen distinguished as moderator, then every row
+    // of main gets is_mod_author, since distinguished only marks the posts a moderator chose to distinguish (see roster.hpp)
+    // lines without a moderator distinguish are skipped before they are parsed and the rest only parse author, subreddit and
+    // distinguished, so the pass costs about as much as decompressing the files
+    // the pairs are also written to the mods table, call this right after constructing (it reopens main)
+    void modRoster() {
+        if (roster || tri_cmt || seen || output) throw std::runtime_error("(wrapper.hpp) modRoster has to be called before anything else");
+
+        auto [type, rows] = mainColumn("is_mod_author");
+        bool fresh = !append || !rows;
+        if (!fresh && type.empty()) throw std::runtime_error("(wrapper.hpp) Can not append is_mod_author to " + out_db + ", it was written without it");
+
+        auto start = Benchmark::timestamp();
+        roster = new ModRoster();
+        auto pass = [&](const std::string& file) {
+            Reader reader(file);
+            // just the value, dumps differ on spacing after the key and valid() checks the key anyway
+            reader.prefilter([](std::string_view line) { return line.find("\"moderator\"") != std::string_view::npos; });
+            for (const ModLink& j : reader.decompress<ModLink>(1000000, 0, false)) roster->add(j.author, j.subreddit);
+            reader.print_end();
+        };
+        pass(in_sub);
+        pass(in_cmt);
+        std::cout << std::format("roster: {} moderators, {} (author, subreddit) pairs in {} ms\n", roster->numAuthors(), roster->size(), Benchmark::elapsed_ms(start));
+
+        roster->save(sub->handle());
+        reopen(fresh);
+    }
+
+    // the fields of every comment's submission next to it in main (sub_score, sub_author, is_op, ... see JoinField), so analyses do not
+    // need to join main with itself afterwards
+    // the submissions are read first into a table keyed on their id (see join.hpp), which spills next to the database past maxBytes,
+    // and read then looks up the link_id of every comment while it streams
+    // call this right after constructing (it reopens main)
+    void joinSubmissions(int fields = JF_ALL, size_t maxBytes = (size_t) 256 << 20) {
+        if (join || tri_cmt || seen || output) throw std::runtime_error("(wrapper.hpp) joinSubmissions has to be called before anything else");
+        if (!(fields & JF_ALL)) throw std::runtime_error("(wrapper.hpp) joinSubmissions needs at least one field");
+
+        join = new SubmissionTable(out_db + ".join", fields, maxBytes);
+        bool fresh = !append || !mainColumn("id").second;
+        for (const auto& [c, f] : joinColumns) {
+            if (!fresh && mainColumn(c).first.empty() == join->has(f))
+                throw std::runtime_error(std::format("(wrapper.hpp) Can not append to {}, it was written with other submission fields ({})", out_db, c));
+        }
+
+        auto start = Benchmark::timestamp();
+        Reader reader(in_sub);
+        for (const SubmissionJoin& j : reader.decompress<SubmissionJoin>(1000000, 0, false)) {
+            join->push(packId(j.id, ID_SUBMISSION), j.author, j.score, toInt(j.created_utc), getDistinguished(j.distinguished));
+        }
+        reader.print_end();
+        const auto& r = join->finish();
+        std::cout << std::format("join: {} submissions, {:.1f} MiB in {} ms ({} runs, {:.1f} MiB spilled)\n",
+            r.rows, r.bytes / 1048576.0, Benchmark::elapsed_ms(start), r.runs, r.spilled / 1048576.0);
+
+        reopen(fresh);
+    }
+
+    // exact duplicate bodies (after sanitizing) are either only counted or also not inserted
+    // the set is shared, so a submission that copies a comment (or the other way around) also counts
+    // past maxBytes counting goes on with a cuckoo filter (a few false duplicates), dropping keeps the exact set it has so that
+    // no unique body is ever dropped (see FingerprintSet)
+    void dedup(DedupMode mode, size_t maxBytes = (size_t) 1 << 30) {
+        delete seen;
+        seen = mode == DD_OFF ? nullptr : new FingerprintSet(maxBytes, mode == DD_COUNT);
+        cmt->setDedup(seen, mode);
+        sub->setDedup(seen, mode);
+    }
+
+    // where main is written (see sink.hpp), the file sinks write next to the database ({name}.csv, {name}.ndjson, {name}.ndjson.zst, {name}.col)
+    // the columnar file (see columnar.hpp) is finished when the wrapper is destroyed
+    // anything but sqlite leaves main empty, so dont sample afterwards (trigrams still go to the database)
+    void sink(SinkType type, bool zstd = false) {
+        delete output;
+        output = nullptr;
+
+        fs::path base = fs::path(out_db).replace_extension();
+        std::string z = zstd ? ".zst" : "";
+        switch (type) {
+            case SK_SQLITE: break;
+            case SK_CSV: output = new CsvSink(base.string() + ".csv" + z, zstd); break;
+            case SK_NDJSON: output = new NdjsonSink(base.string() + ".ndjson" + z, zstd); break;
+            case SK_NULL: output = new NullSink(); break;
+            case SK_COLUMNAR: output = new ColumnarSink(base.string() + ".col"); break;
+        }
+
+        cmt->setSink(output);
+        sub->setSink(output);
+    }
+
+    // tune rows per insert/transaction while reading (see Database::setAdaptive)
+    // bulk also turns on the bulk load pragmas (see Database::bulkLoad), only for outputs that can be rebuilt from the dumps since
+    // a crash mid read can corrupt the database then
+    void adaptive(bool bulk = false) {
+        cmt->setAdaptive(true);
+        sub->setAdaptive(true);
+        if (!bulk) return;
+        cmt->bulkLoad();
+        sub->bulkLoad();
+    }
+
+    // main split into one table per month and distinguished class (main_2024_10_d1 for users in 2024-10), each in created_utc
+    // order, with main left as a view over all of them and the partitions table listing them with their created_utc range
+    // so sampling (and anything else that wants a month or a class) only reads the partitions it needs
+    // the split is one pass at the end of read: main in created_utc order through sqlite's external sorter, with at most maxBytes
+    // of page cache and the rest in temp files, and every row appended to its partition (so no partition is sorted on its own)
+    // not with append (the partitions are not kept up to date) or a sink (main is empty then)
+    void partition(size_t maxBytes = (size_t) 256 << 20) {
+        if (append || output) throw std::runtime_error("(wrapper.hpp) partition can not be used with append or a sink");
+        partitionBytes = maxBytes;
+    }
+
+    // write main through n parallel connections (see Database::setShards), merged back at the end of each read
+    void shards(int n) {
+        cmt->setShards(n);
+        sub->setShards(n);
+    }
+
+    // also write the sentence trigrams of every inserted row into the trigrams table, so the classifier does not need to split them
+    // call before read
+    void trigrams(int threads = 0) {
+        if (tri_cmt) return;
+
+        tri_cmt = new Trigrams(cmt->handle(), threads);
+        tri_sub = new Trigrams(sub->handle(), threads);
+
+        cmt->addHook([t = tri_cmt](const Comment& j) { t->push(packId(j.id, ID_COMMENT), j.body); }, [t = tri_cmt]() { t->flush(); });
+        sub->addHook([t = tri_sub](const Submission& j) { t->push(packId(j.id, ID_SUBMISSION), j.selftext); }, [t = tri_sub]() { t->flush(); });
+
+        // rows dropped when appending (see Database::processed) take their trigrams with them, trigrams are written in row order
+        // so that is everything from where the read of the first dropped row started (ids alone are not unique across comments and submissions)
+        sub->exec(std::format("CREATE TABLE IF NOT EXISTS {}_start (first_rowid INTEGER, trigram_rowid INTEGER)", Trigrams::table));
+        auto truncate = [](auto* db) {
+            return [db](int64_t first) {
+                db->exec(std::format(
+                    "DELETE FROM {0} WHERE rowid >= (SELECT min(trigram_rowid) FROM {0}_start WHERE first_rowid >= {1}); \
+                    DELETE FROM {0}_start WHERE first_rowid >= {1};",
+                    Trigrams::table, first));
+            };
+        };
+        cmt->onTruncate(truncate(cmt));
+        sub->onTruncate(truncate(sub));
     }
 
     void read(int count = 0) {
+        if (append) resume();
+
+        // where the trigrams of the next read start, see trigrams()
+        auto mark = [&]() {
+            if (!tri_cmt) return;
+            sub->exec(std::format(
+                "DELETE FROM {0}_start WHERE first_rowid >= (SELECT coalesce(max(rowid), 0) + 1 FROM main); \
+                INSERT INTO {0}_start SELECT (SELECT coalesce(max(rowid), 0) + 1 FROM main), (SELECT coalesce(max(rowid), 0) + 1 FROM {0});",
+                Trigrams::table));
+        };
+
+        mark();
         auto p1 = cmt->read(in_cmt, count, 50000, 5, false);
+        mark();
         auto p2 = sub->read(in_sub, count, 50000, 5, false);
 
-        std::cout << std::format("{}: {}/{}\n", p1.fileName, p1.readLinesTotal, p1.readLinesTotal - p1.readLinesFiltered - p1.readLinesInvalid);
-        std::cout << std::format("{}: {}/{}\n", p2.fileName, p2.readLinesTotal, p2.readLinesTotal - p2.readLinesFiltered - p2.readLinesInvalid);
+        for (const auto& p : {p1, p2}) {
+            if (p.skipped) {
+                std::cout << std::format("{}: already processed, skipped\n", p.fileName);
+                continue;
+            }
+            std::cout << std::format("{}: {}/{}", p.fileName, p.readLinesTotal, p.readLinesValid());
+            if (seen) std::cout << std::format(" ({} duplicate, {:.2f}%)", p.readLinesDuplicate, 100.0 * p.duplicateRatio());
+            std::cout << "\n";
+        }
+        if (output) std::cout << std::format("sink: {} rows, {} bytes written\n", output->rows, output->bytes);
+        if (join) {
+            // a chosen column is only null when there was no submission to join
+            const char* probe = std::find_if(std::begin(joinColumns), std::end(joinColumns), [&](const auto& c) { return join->has(c.second); })->first;
+            sqlite3_stmt* stmt;
+            std::string cmd = std::format("SELECT count(*), count({}) FROM main WHERE parent_id IS NOT NULL", probe);
+            sqlite3_prepare_v2(sub->handle(), cmd.c_str(), -1, &stmt, nullptr);
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+                std::cout << std::format("join: {} of {} comments matched their submission\n", sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 0));
+            sqlite3_finalize(stmt);
+        }
+        if (dict && dict->raw) std::cout << std::format("bodies: {} -> {} bytes ({:.2f}x)\n", dict->raw, dict->packed, (double) dict->raw / dict->packed);
+        if (seen) std::cout << std::format("dedup: {} unique bodies, {} bytes{}{}\n", seen->size(), seen->bytes(), seen->exact() ? "" : " (cuckoo filter)",
+            seen->dropped() ? std::format(", {} not kept", seen->dropped()) : "");
+
+        // parents, threads and replies are looked up by id (partitions get their own, see splitMain)
+        if (partitionBytes) splitMain();
+        else sub->exec("CREATE INDEX IF NOT EXISTS main_id ON main (id)");
     }
 
-    void sampleUsers(unsigned int count = 5000, bool drop = true) {
+    // reads count comments into scratch once through the runtime Schema (one std::function per column) and once through the
+    // compiled one, both with the same columns, to compare the per row cost of the two (process and sql need BENCHMARK_ENABLED)
+    void benchmarkSchema(const std::string& scratch, size_t count = 100000) {
+        auto compiled = mainSchema<Comment>(last, lexicon, lex_counts, proxy);
+
+        auto run = [&](auto& db, const char* name) {
+            Benchmark::reset();
+            auto t = Benchmark::timestamp();
+            auto r = db.template read<5>(in_cmt, count, 50000, 5, false);
+            double ms = std::max((int64_t) 1, Benchmark::elapsed_ms(t));
+
+            std::cout << std::format("schema {}: {} rows in {:.0f} ms ({:.0f} rows/s), process {:.1f} ms, sql {:.1f} ms\n",
+                name, r.readLinesValid(), ms, 1000.0 * r.readLinesValid() / ms, Benchmark::get("Process"), Benchmark::get("SQL"));
+        };
+
+        if (fs::exists(scratch)) fs::remove(scratch);
+        {
+            Database<Comment> db(scratch, compiled.runtime(), true);
+            run(db, "runtime");
+        }
+
+        fs::remove(scratch);
+        {
+            Database<Comment, MainSchema<Comment>> db(scratch, compiled, true);
+            run(db, "compiled");
+        }
+        fs::remove(scratch);
+    }
+
+    // reads count comments into scratch through the default vfs and then through vfs (i.e. ZstdVfs), reports file size,
+    // insert throughput and a full scan of main after reopening it
+    void benchmarkVfs(const std::string& scratch, const char* vfs, size_t count = 100000) {
+        auto run = [&](const char* v) {
+            if (fs::exists(scratch)) fs::remove(scratch);
+
+            double ins, scan;
+            size_t rows, text = 0;
+            {
+                Database<Comment, MainSchema<Comment>> db(scratch, mainSchema<Comment>(last, lexicon, lex_counts, proxy), true, v);
+                auto t = Benchmark::timestamp();
+                rows = db.read(in_cmt, count, 50000, 5, false).readLinesValid();
+                ins = std::max((int64_t) 1, Benchmark::elapsed_ms(t));
+            }
+            size_t bytes = fs::file_size(scratch);
+            {
+                Database<Comment, MainSchema<Comment>> db(scratch, mainSchema<Comment>(last, lexicon, lex_counts, proxy), false, v);
+                auto t = Benchmark::timestamp();
+                sqlite3_exec(db.handle(), "SELECT sum(length(body)) FROM main", [](void* out, int, char** v, char**) {
+                    *(size_t*) out = v[0] ? std::stoull(v[0]) : 0;
+                    return 0;
+                }, &text, nullptr);
+                scan = std::max((int64_t) 1, Benchmark::elapsed_ms(t));
+            }
+
+            std::cout << std::format("vfs {}: {} rows, {:.1f} MiB, insert {:.0f} rows/s, scan {:.0f} rows/s ({:.1f} MB/s of body)\n",
+                v ? v : "default", rows, bytes / 1048576.0, 1000.0 * rows / ins, 1000.0 * rows / scan, text / scan / 1000.0);
+            return bytes;
+        };
+
+        size_t plain = run(nullptr);
+        size_t packed = run(vfs);
+        std::cout << std::format("{:.2f}x smaller\n", (double) plain / std::max((size_t) 1, packed));
+        fs::remove(scratch);
+    }
+
+    // writes a table of the database (i.e. r_users after sampling) to {name}_{table}.csv or .ndjson (.zst if asked for)
+    // compressed bodies (see compressBodies) are decompressed on the way, reports how fast that went
+    void exportTable(const std::string& table, SinkType type, bool zstd = false) {
+        std::string file = std::format("{}_{}", fs::path(out_db).replace_extension().string(), table);
+        std::string z = zstd ? ".zst" : "";
+        std::unique_ptr<Sink> out;
+        switch (type) {
+            case SK_CSV: out = std::make_unique<CsvSink>(file + ".csv" + z, zstd); break;
+            case SK_NDJSON: out = std::make_unique<NdjsonSink>(file + ".ndjson" + z, zstd); break;
+            default: throw std::runtime_error("(wrapper.hpp) Tables can only be exported to csv or ndjson");
+        }
+
+        sqlite3_stmt* stmt;
+        std::string cmd = "SELECT * FROM " + table;
+        if (sqlite3_prepare_v2(sub->handle(), cmd.c_str(), cmd.size() + 1, &stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + cmd);
+
+        // blob columns are compressed text
+        SchemaColumns cols;
+        for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+            std::string decl = sqlite3_column_decltype(stmt, i) ? sqlite3_column_decltype(stmt, i) : "";
+            cols.push_back({sqlite3_column_name(stmt, i), decl == "INTEGER" ? ST_INT : decl == "REAL" ? ST_REAL : ST_TEXT});
+        }
+        out->open(table, cols);
+
+        ZstdDicts dicts(sub->handle());
+        std::vector<SchemaValue> row(cols.size());
+        std::vector<std::string> bufs(cols.size());
+        size_t rows = 0, packed = 0, raw = 0;
+        int64_t us = 0;
+        auto t = Benchmark::timestamp();
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            for (int i = 0; i < (int) cols.size(); i++) {
+                switch (sqlite3_column_type(stmt, i)) {
+                    case SQLITE_NULL: row[i].null(); break;
+                    case SQLITE_INTEGER: row[i].integer(sqlite3_column_int64(stmt, i)); break;
+                    case SQLITE_FLOAT: row[i].real(sqlite3_column_double(stmt, i)); break;
+                    case SQLITE_TEXT: row[i].text(std::string_view((const char*) sqlite3_column_text(stmt, i), sqlite3_column_bytes(stmt, i))); break;
+                    case SQLITE_BLOB: {
+                        std::string_view v((const char*) sqlite3_column_blob(stmt, i), sqlite3_column_bytes(stmt, i));
+                        auto d = Benchmark::timestamp();
+                        row[i].text(dicts.decode(v, bufs[i]));
+                        us += Benchmark::elapsed_us(d);
+                        packed += v.size();
+                        raw += row[i].s.size();
+                        break;
+                    }
+                }
+            }
+            out->write(row.data(), 1);
+            rows++;
+        }
+        sqlite3_finalize(stmt);
+        out->flush();
+
+        double ms = std::max((int64_t) 1, Benchmark::elapsed_ms(t));
+        std::cout << std::format("export {}: {} rows in {:.0f} ms ({:.0f} rows/s), {} bytes written", table, rows, ms, 1000.0 * rows / ms, out->bytes);
+        if (packed) std::cout << std::format(", bodies {} -> {} bytes decoded at {:.0f} MB/s", packed, raw, (double) raw / std::max((int64_t) 1, us));
+        std::cout << "\n";
+    }
+
+    // ad hoc query straight over the input files (see vtab.hpp), nothing is imported or written, comments are rc and submissions rs
+    // i.e. query("SELECT subreddit, count(*) FROM rc WHERE distinguished = 2 GROUP BY subreddit")
+    void query(const std::string& sql) {
+        size_t newest = 0;
+        std::vector<int> counts;
+
+        sqlite3* db;
+        if (sqlite3_open(":memory:", &db) != SQLITE_OK) throw std::runtime_error("(wrapper.hpp) Unable to open in memory database");
+        try {
+            registerDump<Comment>(db, "dump_comments", mainSchema<Comment>(newest, lexicon, counts, proxy, nullptr, roster, join));
+            registerDump<Submission>(db, "dump_submissions", mainSchema<Submission>(newest, lexicon, counts, proxy, nullptr, roster, join));
+
+            std::string cmd = std::format("CREATE VIRTUAL TABLE rc USING dump_comments('{}'); CREATE VIRTUAL TABLE rs USING dump_submissions('{}');", in_cmt, in_sub);
+            if (sqlite3_exec(db, cmd.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) throw std::runtime_error(std::format("(wrapper.hpp) {}", sqlite3_errmsg(db)));
+
+            sqlite3_stmt* stmt;
+            if (sqlite3_prepare_v2(db, sql.c_str(), sql.size() + 1, &stmt, nullptr) != SQLITE_OK)
+                throw std::runtime_error(std::format("(wrapper.hpp) Could not create prepared statement: {} ({})", sql, sqlite3_errmsg(db)));
+
+            std::vector<std::string> rows;
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                std::string r;
+                for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+                    const char* v = (const char*) sqlite3_column_text(stmt, i);
+                    r += std::format("{}{}", i == 0 ? "" : " | ", v ? v : "NULL");
+                }
+                rows.push_back(r);
+            }
+            sqlite3_finalize(stmt);
+
+            // after the read progress
+            std::cout << "\n";
+            for (const auto& r : rows) std::cout << r << "\n";
+        } catch (...) {
+            sqlite3_close(db);
+            throw;
+        }
+        sqlite3_close(db);
+    }
+
+    // tokenize the (remaining) trigrams for the roberta classifier into memory mappable shards, see bpe.hpp for the layout
+    // vocab and merges are vocab.json and merges.txt from the model (i.e. a local copy of mmochtak/authdetect)
+    TokenShard_Output tokenize(const std::string& vocab, const std::string& merges, const std::string& prefix, uint32_t width = 512, int threads = 0) {
+        if (!tri_cmt) throw std::runtime_error("(wrapper.hpp) tokenize requires trigrams()");
+
+        BPETokenizer tok(vocab, merges);
+        TokenShardWriter shards(tok, prefix, width, (size_t) 1 << 16, threads);
+
+        sqlite3_stmt* stmt;
+        std::string cmd = std::format("SELECT reddit_id(id), trigram_id, sent_trigram FROM {} ORDER BY rowid", Trigrams::table);
+        if (sqlite3_prepare_v2(sub->handle(), cmd.c_str(), cmd.size() + 1, &stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + cmd);
+
+        auto text = [stmt](int col) { return std::string_view((const char*) sqlite3_column_text(stmt, col), sqlite3_column_bytes(stmt, col)); };
+        while (sqlite3_step(stmt) == SQLITE_ROW) shards.push(text(0), sqlite3_column_int(stmt, 1), text(2));
+        sqlite3_finalize(stmt);
+        shards.flush();
+
+        const auto& r = shards.status();
+        std::cout << std::format("tokenized {} trigrams into {} shards ({} tokens, {} truncated at {})\n", r.rows, r.shards, r.tokens, r.truncated, width);
+        return r;
+    }
+
+    // who replied to whom over the input files as a memory mappable CSR file (see graph.hpp), nodes are packed ids (see packId)
+    // its own pass over the files since it wants every comment and not just the ones sanitize keeps
+    // memory stays around maxBytes however big the month is, the rest is spilled next to path while it is built
+    ReplyGraph_Output replyGraph(const std::string& path, size_t maxBytes = (size_t) 256 << 20) {
+        auto start = Benchmark::timestamp();
+        ReplyGraphWriter writer(path, maxBytes);
+        {
+            Reader reader(in_sub);
+            for (const SubmissionLink& j : reader.decompress<SubmissionLink>(1000000, 0, false)) {
+                writer.push(packId(j.id, ID_SUBMISSION), 0, getDistinguished(j.distinguished));
+            }
+            reader.print_end();
+        }
+        {
+            Reader reader(in_cmt);
+            for (const CommentLink& j : reader.decompress<CommentLink>(1000000, 0, false)) {
+                writer.push(packId(j.id, ID_COMMENT), packId(j.parent_id), getDistinguished(j.distinguished));
+            }
+            reader.print_end();
+        }
+        const auto& r = writer.finish();
+
+        ReplyGraph g(path);
+        std::cout << std::format("reply graph: {} nodes, {} edges in {} ms ({} runs, {:.1f} MiB spilled), {} mod replies to users, {} user replies to mods\n",
+            r.nodes, r.edges, Benchmark::elapsed_ms(start), r.runs, r.spilled / 1048576.0, g.count(D_USER, D_MOD), g.count(D_MOD, D_USER));
+        return r;
+    }
+
+    // id -> line index of both input files as {dir}/{file name}.idx (see dumpindex.hpp), keys are packed ids (see packId)
+    // i.e. DumpIndex(idx).fetch(file, ids, fn) for the raw lines of a few thousand ids, reencode the files first to make that a seek
+    void indexDumps(const std::string& dir, size_t maxBytes = (size_t) 256 << 20) {
+        for (const auto& [file, type] : {std::pair{in_cmt, ID_COMMENT}, std::pair{in_sub, ID_SUBMISSION}}) {
+            auto start = Benchmark::timestamp();
+            std::string path = (fs::path(dir) / (fs::path(file).filename().string() + ".idx")).string();
+            auto r = DumpIndex::build(file, path, [type](std::string_view line) { return lineId(line, type); }, maxBytes);
+            std::cout << std::format("index {}: {} rows, {} checkpoints in {} ms ({} runs, {:.1f} MiB spilled, {} lines without an id)\n",
+                fs::path(file).filename().string(), r.rows, r.checkpoints, Benchmark::elapsed_ms(start), r.runs, r.spilled / 1048576.0, r.skipped);
+        }
+    }
+
+    // parents of sampled rows pulled out of a second pass over the dumps into a context table (same columns as main)
+    // i.e. context("SELECT parent_id FROM r_users UNION ALL SELECT link_id FROM r_users"), see contextOf for both of every table
+    // parents are kept whatever sanitize would say (see CommentRecord), and lines are only parsed if an id in them gets past a
+    // bloom filter and then the exact set of wanted ids, the ids are found in the raw line (see rawId)
+    // nested objects (crossposts) have ids too, so a parsed line is only taken if its own id is wanted
+    Context_Output context(const std::string& ids) {
+        Context_Output r{};
+        std::unordered_set<int64_t> wanted;
+
+        sqlite3_stmt* stmt;
+        std::string cmd = std::format("SELECT * FROM ({})", ids);
+        if (sqlite3_prepare_v2(sub->handle(), cmd.c_str(), cmd.size() + 1, &stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error("(wrapper.hpp) Could not create prepared statement: " + cmd);
+        while (sqlite3_step(stmt) == SQLITE_ROW) if (sqlite3_column_type(stmt, 0) == SQLITE_INTEGER) wanted.insert(sqlite3_column_int64(stmt, 0));
+        sqlite3_finalize(stmt);
+        r.wanted = wanted.size();
+
+        BloomFilter bloom(wanted.size(), 0.001);
+        for (int64_t v : wanted) bloom.insert(v);
+
+        // ids in a line are numbered with the type of the file, so a submission id never matches a comment line
+        auto filter = [&](int type) {
+            return [&, type](std::string_view line) {
+                size_t at = 0;
+                std::string_view id;
+                bool passed = false;
+                while (rawId(line, at, id)) {
+                    int64_t v = packId(id, type);
+                    if (v == 0 || !bloom.contains(v)) continue;
+                    passed = true;
+                    if (wanted.contains(v)) return true;
+                }
+
+                if (passed) r.falsePositives++;
+                else r.rejected++;
+                return false;
+            };
+        };
+        auto own = [&](const std::string& id, int type) {
+            if (wanted.erase(packId(std::string_view(id), type))) {
+                r.found++;
+                return true;
+            }
+            r.falsePositives++;
+            return false;
+        };
+
+        size_t newest = 0;
+        std::vector<int> counts;
+        Database<ContextComment, MainSchema<ContextComment>> ctx_cmt(out_db, mainSchema<ContextComment>(newest, lexicon, counts, proxy, dict, roster, join, "context"), true, vfs);
+        Database<ContextSubmission, MainSchema<ContextSubmission>> ctx_sub(out_db, mainSchema<ContextSubmission>(newest, lexicon, counts, proxy, dict, roster, join, "context"), false, vfs);
+
+        ctx_sub.setPrefilter(filter(ID_SUBMISSION));
+        ctx_sub.setFilter([&](const ContextSubmission& j) { return own(j.id, ID_SUBMISSION); });
+        ctx_sub.read(in_sub);
+        ctx_cmt.setPrefilter(filter(ID_COMMENT));
+        ctx_cmt.setFilter([&](const ContextComment& j) { return own(j.id, ID_COMMENT); });
+        ctx_cmt.read(in_cmt);
+
+        size_t lines = r.rejected + r.falsePositives + r.found;
+        std::cout << std::format("context: {} of {} parents found, {} lines, {} ({:.2f}%) rejected by the bloom filter, {} false positives ({} KiB)\n",
+            r.found, r.wanted, lines, r.rejected, lines ? 100.0 * r.rejected / lines : 0.0, r.falsePositives, bloom.bytes() / 1024);
+        return r;
+    }
+
+    // context of the rows in tables: their parents (parent_id) and the submissions of their threads (link_id)
+    Context_Output contextOf(const std::vector<std::string>& tables) {
+        std::string ids;
+        for (const auto& t : tables) ids += std::format("{}SELECT parent_id FROM {} UNION ALL SELECT link_id FROM {}", ids.empty() ? "" : " UNION ALL ", t, t);
+        return context(ids);
+    }
+
+    // only keep trigrams of sampled rows
+    void pruneTrigrams(const std::string& ids) {
+        if (!tri_cmt) return;
         sub->exec(std::format(
-            "DROP TABLE IF EXISTS r_users; \
-            DROP TABLE IF EXISTS r_mods; \
-            CREATE TABLE r_users AS SELECT * FROM main WHERE rowid IN \
-                (SELECT rowid FROM main WHERE distinguished = 1 ORDER BY RANDOM() LIMIT {}); \
-            CREATE TABLE r_mods AS SELECT * FROM main WHERE rowid IN \
-                (SELECT rowid FROM main WHERE distinguished = 2 ORDER BY RANDOM() LIMIT {});",
-            count, count
+            "DELETE FROM {0} WHERE id NOT IN ({1}); \
+            CREATE INDEX IF NOT EXISTS {0}_id ON {0} (id);",
+            Trigrams::table, ids
         ));
+    }
 
-        if (drop) sub->exec("DROP TABLE main; VACUUM");
+    void sampleUsers(unsigned int count = 5000, bool drop = true) {
+        if (partitioned) {
+            // only the user (mod) partitions are read
+            sub->exec(
+                "DROP TABLE IF EXISTS r_users; \
+                DROP TABLE IF EXISTS r_mods; \
+                CREATE TABLE r_users AS SELECT * FROM main WHERE 0; \
+                CREATE TABLE r_mods AS SELECT * FROM main WHERE 0;");
+            samplePartitions("r_users", "distinguished = 1", "1", count);
+            samplePartitions("r_mods", "distinguished = 2", "1", count);
+        } else {
+            sub->exec(std::format(
+                "DROP TABLE IF EXISTS r_users; \
+                DROP TABLE IF EXISTS r_mods; \
+                CREATE TABLE r_users AS SELECT * FROM main WHERE rowid IN \
+                    (SELECT rowid FROM main WHERE distinguished = 1 ORDER BY RANDOM() LIMIT {}); \
+                CREATE TABLE r_mods AS SELECT * FROM main WHERE rowid IN \
+                    (SELECT rowid FROM main WHERE distinguished = 2 ORDER BY RANDOM() LIMIT {});",
+                count, count
+            ));
+        }
+
+        if (drop) {
+            pruneTrigrams("SELECT id FROM r_users UNION ALL SELECT id FROM r_mods");
+            dropMain();
+        }
     }
 
     void sampleSubreddit(unsigned int count = 1000, bool drop = true) {
@@ -157,6 +1049,13 @@ public:
             int64_t start = months[i];
 
             std::string end = i == months.size() - 1 ? "" : std::format("AND created_utc < {}", months[i + 1]);
+            if (partitioned) {
+                // partitions that overlap the month
+                std::string overlap = std::format("last_utc >= {}{}", start, i == months.size() - 1 ? "" : std::format(" AND first_utc < {}", months[i + 1]));
+                samplePartitions("r_subreddit", overlap, std::format("created_utc >= {} {}", start, end), count);
+                continue;
+            }
+
             std::string cmd = std::format(
                 "INSERT INTO r_subreddit SELECT * FROM main WHERE rowid IN \
                     (SELECT rowid FROM main WHERE created_utc >= {} {} ORDER BY RANDOM() LIMIT {});",
@@ -165,7 +1064,10 @@ public:
             sub->exec(cmd);
         }
 
-        if (drop) sub->exec("DROP TABLE main; VACUUM;");
+        if (drop) {
+            pruneTrigrams("SELECT id FROM r_subreddit");
+            dropMain();
+        }
     }
 };
 
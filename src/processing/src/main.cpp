@@ -6,6 +6,7 @@
 #include <filesystem>
 namespace fs = std::filesystem;
 #include "wrapper.hpp"
+#include "cohort.hpp"
 
 #ifdef _WIN32
 fs::path m_in = "C:/Users/andallfor/Documents/GitHub/396H-Project/data/in/months";
@@ -13,6 +14,9 @@ fs::path s_in = "C:/Users/andallfor/Documents/GitHub/396H-Project/data/in/subred
 
 fs::path m_out = "C:/Users/andallfor/Documents/GitHub/396H-Project/data/finished/users";
 fs::path s_out = "C:/Users/andallfor/Documents/GitHub/396H-Project/data/finished/subreddits";
+
+fs::path l_in = "C:/Users/andallfor/Documents/GitHub/396H-Project/data/in/lexicons";
+fs::path c_out = "C:/Users/andallfor/Documents/GitHub/396H-Project/src/classifier/csvs/finished";
 #endif
 #ifdef linux
 fs::path m_in = "/mnt/c/Users/andallfor/Documents/GitHub/396H-Project/data/in/months";
@@ -20,6 +24,9 @@ fs::path s_in = "/mnt/c/Users/andallfor/Documents/GitHub/396H-Project/data/in/su
 
 fs::path m_out = "/mnt/c/Users/andallfor/Documents/GitHub/396H-Project/data/finished/users";
 fs::path s_out = "/mnt/c/Users/andallfor/Documents/GitHub/396H-Project/data/finished/subreddits";
+
+fs::path l_in = "/mnt/c/Users/andallfor/Documents/GitHub/396H-Project/data/in/lexicons";
+fs::path c_out = "/mnt/c/Users/andallfor/Documents/GitHub/396H-Project/src/classifier/csvs/finished";
 #endif
 
 struct resolvedPath {
@@ -86,10 +93,151 @@ int main(int argc, const char** argv) {
         // "2024-09",
     };
 
+    // every file in l_in is one category, adds a lex_{category} column with the number of matches
+    Lexicon* lexicon = fs::exists(l_in) ? new Lexicon(l_in.string()) : nullptr;
+    if (lexicon) std::cout << std::format("Loaded {} lexicons ({} terms)", lexicon->size(), lexicon->terms()) << std::endl;
+
+    // proxy classifier (see proxy.hpp), trained on the classifier output and adds a proxy_auth column when it exists
+    std::vector<std::string> scored;
+    if (fs::exists(c_out)) {
+        for (const auto& e : fs::directory_iterator(c_out)) {
+            if (e.path().filename().string().ends_with("_per_text.csv")) scored.push_back(e.path().string());
+        }
+    }
+
+    if (false) {
+        ProxyModel model;
+        model.train(scored);
+        model.save((c_out / "proxy.bin").string());
+    }
+
+    if (false) ProxyModel((c_out / "proxy.bin").string()).evaluate(scored);
+
+    ProxyModel* proxy = fs::exists(c_out / "proxy.bin") ? new ProxyModel((c_out / "proxy.bin").string()) : nullptr;
+
+    // compiled v runtime schema, build with BENCHMARK_ENABLED for the process/sql split
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        std::string scratch = (m_out / "scratch.db").string();
+        Wrapper wrapper(r.cmt, r.sub, scratch, lexicon, proxy);
+        wrapper.benchmarkSchema((m_out / "scratch_bench.db").string());
+    }
+
+    // re-filter a month that was read with wrapper.sink(SK_COLUMNAR) without going back to the dump (see columnar.hpp)
+    if (false) {
+        ColumnarReader col((m_out / (months.at(0) + ".col")).string());
+        std::unordered_map<std::string, size_t> perSub;
+        auto r = col.scan({ColumnFilter::equals("distinguished", D_MOD), ColumnFilter::between("num_sentences", 3, INT64_MAX)}, {"subreddit"},
+            [&](const SchemaValue* row) { perSub[std::string(row[0].s)]++; });
+        std::cout << std::format("{} of {} rows ({} of {} blocks skipped), {} subreddits", r.matched, col.rows(), r.blocksSkipped, r.blocks, perSub.size()) << std::endl;
+    }
+
+    // zstd compressed database file (see vfs.hpp) against the default vfs, pass vfs.id() to Wrapper to write months compressed
+    if (false) {
+        ZstdVfs vfs("zstd", 3, 1 << 16);
+        auto r = resolveMonth(months.at(0));
+        std::string scratch = (m_out / "scratch.db").string();
+        Wrapper wrapper(r.cmt, r.sub, scratch, lexicon, proxy);
+        wrapper.benchmarkVfs((m_out / "scratch_bench.db").string(), vfs.id());
+    }
+
+    // ad hoc query over a month without importing it (see vtab.hpp), the wrapper still wants a database so give it a scratch one
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        std::string scratch = (m_out / "scratch.db").string();
+        Wrapper wrapper(r.cmt, r.sub, scratch, lexicon, proxy);
+        wrapper.query("SELECT subreddit, count(*), avg(score) FROM rc WHERE distinguished = 2 AND num_sentences >= 3 GROUP BY subreddit ORDER BY 2 DESC LIMIT 20");
+    }
+
+    // bodies stored as zstd blobs against a dictionary trained on the month (see zdict.hpp), read them back with zbody(body)
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+        wrapper.compressBodies();
+        // only exported, so the bulk load pragmas are worth the risk of a corrupt database on a crash
+        wrapper.adaptive(true);
+        wrapper.read();
+        wrapper.exportTable("main", SK_CSV);
+    }
+
+    // who replied to whom in a month (see graph.hpp), ReplyGraph maps the file so reply queries are array scans
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        std::string scratch = (m_out / "scratch.db").string();
+        Wrapper wrapper(r.cmt, r.sub, scratch, lexicon, proxy);
+        wrapper.replyGraph((m_out / (months.at(0) + ".graph")).string());
+    }
+
+    // sampled rows plus their parents and thread submissions (see Wrapper::context), which takes a second (cheap) pass over the dumps
     if (false) {
+        auto r = resolveMonth(months.at(0));
+        Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+        wrapper.adaptive();
+        wrapper.read();
+        wrapper.sampleUsers();
+        wrapper.contextOf({"r_users", "r_mods"});
+    }
+
+    // is_mod_author for every post by someone who moderates that subreddit, not just the distinguished ones (see roster.hpp)
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+        wrapper.modRoster();
+        wrapper.adaptive();
+        wrapper.read();
+    }
+
+    // submission score, author and whether the commenter is OP next to every comment (see Wrapper::joinSubmissions)
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+        wrapper.joinSubmissions(JF_SCORE | JF_AUTHOR | JF_OP);
+        wrapper.adaptive();
+        wrapper.read();
+    }
+
+    // raw lines of a few ids straight from the dump (see dumpindex.hpp), the reencoded copy has 4 MiB frames so fetching is a seek
+    if (false) {
+        auto r = resolveMonth(months.at(0));
+        std::string cmt = (m_out / fs::path(r.cmt).filename()).string();
+        std::string sub = (m_out / fs::path(r.sub).filename()).string();
+        DumpIndex::reencode(r.cmt, cmt);
+        DumpIndex::reencode(r.sub, sub);
+
+        std::string scratch = (m_out / "scratch.db").string();
+        Wrapper wrapper(cmt, sub, scratch, lexicon, proxy);
+        wrapper.indexDumps(m_out.string());
+
+        DumpIndex idx(cmt + ".idx");
+        idx.fetch(cmt, {packId("t1_abc123"), packId("t1_abc124")}, [](int64_t id, std::string_view line) { std::cout << line << std::endl; });
+    }
+
+    // full posting histories of a list of authors (one name per line) over every month, read in parallel into one database (see cohort.hpp)
+    if (false) {
+        Cohort cohort(Cohort::load((m_out / "cohort.txt").string()));
         for (auto& month : months) {
             auto r = resolveMonth(month);
-            Wrapper wrapper(r.cmt, r.sub, r.db);
+            cohort.add(month, r.cmt, r.sub);
+        }
+        cohort.run((m_out / "cohort.db").string());
+    }
+
+    if (false) {
+        for (auto& month : months) {
+            auto r = resolveMonth(month);
+            Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+            wrapper.adaptive();
+            wrapper.read();
+            wrapper.sampleUsers();
+        }
+    }
+
+    // main split by month and distinguished class after reading, so sampling only reads the partitions it needs
+    if (false) {
+        for (auto& month : months) {
+            auto r = resolveMonth(month);
+            Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+            wrapper.partition();
             wrapper.read();
             wrapper.sampleUsers();
         }
@@ -98,12 +246,16 @@ int main(int argc, const char** argv) {
     if (true) {
         for (auto& subreddit : subreddits) {
             auto r = resolveSubreddit(subreddit);
-            Wrapper wrapper(r.cmt, r.sub, r.db);
+            Wrapper wrapper(r.cmt, r.sub, r.db, lexicon, proxy);
+            wrapper.adaptive();
             wrapper.read();
             wrapper.sampleSubreddit();
         }
     }
 
+    delete lexicon;
+    delete proxy;
+
     std::cout << "hello world" << std::endl;
 
     return 0;